@@ -0,0 +1,21 @@
+#ifndef UNO_ALLOC_COUNT_H
+#define UNO_ALLOC_COUNT_H
+
+// force-included into every source object of the bench build (see the
+// makefile) so heap traffic from the code under test is counted per
+// operation. Nothing here may pull in libc headers: files that set feature
+// macros must still be the first to include them.
+#include <stddef.h>
+
+extern unsigned long long bench_allocs;      // malloc, calloc and realloc calls
+extern unsigned long long bench_alloc_bytes; // bytes they asked for
+
+void *bench_malloc(size_t size);
+void *bench_calloc(size_t count, size_t size);
+void *bench_realloc(void *ptr, size_t size);
+
+#define malloc(size) bench_malloc(size)
+#define calloc(count, size) bench_calloc(count, size)
+#define realloc(ptr, size) bench_realloc(ptr, size)
+
+#endif // UNO_ALLOC_COUNT_H
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE 1 // clock_gettime under -std=c99
+#include "client.h"
+#include "log_format.h"
+#include "network.h"
+#include "replay.h"
+#include "uno.h"
+#include "vterm.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc_count.h" // after stdlib.h, the harness itself calls the real ones
+
+// Microbenchmarks for the engine and protocol hot paths. Every benchmark
+// is warmed up, its batch size doubled until one batch takes BENCH_BATCH_NS,
+// then BENCH_REPS batches are timed. One CSV line per benchmark goes to
+// stdout so runs can be diffed or loaded into a spreadsheet:
+//
+//   uno_bench [NAME...]   only runs benchmarks whose name contains a NAME
+//   uno_bench --replay [RECORDING]
+//                         per-frame report of the client renderer drawing a
+//                         recording (or a seeded bot game), see replay.h
+
+#define BENCH_REPS 15
+#define BENCH_WARMUP_NS 50000000LL // at least this long before measuring
+#define BENCH_BATCH_NS 10000000LL
+#define BENCH_SEED 1               // same decks and bot choices every run
+#define GAME_TURN_LIMIT 2000       // a game nobody can finish stops here
+
+#undef malloc
+#undef calloc
+#undef realloc
+
+unsigned long long bench_allocs;
+unsigned long long bench_alloc_bytes;
+
+void *bench_malloc(size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += size;
+  return malloc(size);
+}
+
+void *bench_calloc(size_t count, size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += count * size;
+  return calloc(count, size);
+}
+
+void *bench_realloc(void *ptr, size_t size) {
+  bench_allocs++;
+  bench_alloc_bytes += size;
+  return realloc(ptr, size);
+}
+
+struct Bench {
+  const char *name;
+  void (*setup)(int arg); // untimed, may be NULL
+  void (*run)(int arg);   // one operation
+  void (*teardown)(int arg);
+  int arg;
+};
+
+static volatile uint64_t sink; // results land here so no work is elided
+
+// --- protocol ---
+
+struct ProtocolCase {
+  uint8_t type;
+  int hand_cards; // for MSG_HAND
+};
+
+static const struct ProtocolCase protocol_cases[] = {
+    {MSG_WELCOME, 0}, {MSG_WAITING_FOR_PLAYERS, 0},
+    {MSG_STATE, 0},   {MSG_HAND, 7},
+    {MSG_HAND, MAX_HAND_SIZE}, {MSG_ACTION, 0},
+    {MSG_GAME_OVER, 0},        {MSG_ERROR, 0},
+    {MSG_JOIN, 0},             {MSG_PING, 0},
+};
+
+static struct Packet packet;
+static char wire[MAX_PACKET_SIZE];
+static int wire_len;
+
+// a packet of the case's type with every field set
+static void protocol_setup(int arg) {
+  const struct ProtocolCase *c = &protocol_cases[arg];
+  memset(&packet, 0, sizeof(packet));
+  packet.type = c->type;
+  switch (c->type) {
+  case MSG_WELCOME:
+    packet.data.welcome.player_id = 2;
+    packet.data.welcome.session = 0x0123456789abcdefULL;
+    break;
+  case MSG_WAITING_FOR_PLAYERS:
+    packet.data.lobby.num_players = 3;
+    packet.data.lobby.seats = 4;
+    strcpy(packet.data.lobby.code, "ABC123");
+    break;
+  case MSG_STATE:
+    packet.data.game_state.seq = 42;
+    packet.data.game_state.current_player_id = 1;
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+      packet.data.game_state.player_hand_sizes[i] = 7;
+    }
+    get_card_details("red Skip", &packet.data.game_state.top_card);
+    packet.data.game_state.last_action.type = ACTION_PLAY_CARD;
+    break;
+  case MSG_HAND:
+    packet.data.player_hand.num_cards = c->hand_cards;
+    for (int i = 0; i < c->hand_cards; i++) {
+      get_card_details(deck[i % DECK_SIZE], &packet.data.player_hand.cards[i]);
+    }
+    break;
+  case MSG_ACTION:
+    packet.data.action.type = ACTION_PLAY_CARD;
+    packet.data.action.card_index = 3;
+    break;
+  case MSG_GAME_OVER:
+    packet.data.winner_id = 1;
+    break;
+  case MSG_ERROR:
+    packet.data.error_code = ERROR_INVALID_ACTION;
+    break;
+  case MSG_JOIN:
+    packet.data.join.mode = JOIN_RESUME;
+    packet.data.join.session = 0x0123456789abcdefULL;
+    packet.data.join.last_seq = 42;
+    break;
+  case MSG_PING:
+    packet.data.ping.id = 7;
+    packet.data.ping.sent_us = 123456789;
+    packet.data.ping.interval_ms = 5000;
+    break;
+  }
+  wire_len = serialize_packet(&packet, wire);
+}
+
+static void serialize_run(int arg) {
+  (void)arg;
+  sink += serialize_packet(&packet, wire);
+}
+
+static void deserialize_run(int arg) {
+  (void)arg;
+  struct Packet *decoded = deserialize_packet(wire, wire_len);
+  sink += decoded->type;
+  free(decoded);
+}
+
+// --- engine ---
+
+static struct GameDetails game;
+static CardDetails wild;
+static CardDetails cards[DECK_SIZE];
+static CardDetails pile[DECK_SIZE - 28]; // every card not in a starting hand
+static int next_index;
+
+static void engine_setup(int arg) {
+  (void)arg;
+  set_active_game(&game);
+  init_game();
+  get_card_details("black wild", &wild);
+  for (int i = 0; i < DECK_SIZE; i++) {
+    get_card_details(deck[i], &cards[i]);
+  }
+  memcpy(pile, cards, sizeof(pile));
+  next_index = 0;
+}
+
+static void engine_teardown(int arg) {
+  (void)arg;
+  cleanup();
+  set_active_game(NULL);
+}
+
+static void can_play_card_run(int arg) {
+  (void)arg;
+  sink += can_play_card(0, next_index);
+  next_index = (next_index + 1) % game.hands[0].card_count;
+}
+
+// a wild is always legal; the draw puts the hand back to its size and
+// reshuffles the pile whenever the deck runs out
+static void play_card_run(int arg) {
+  (void)arg;
+  game.hands[0].cards[0] = wild;
+  sink += play_card(0, 0);
+  sink += pickup_card(0)->color_code;
+}
+
+static void shuffle_deck_run(int arg) {
+  (void)arg;
+  shuffle_deck(cards, DECK_SIZE);
+  sink += cards[0].color_code;
+}
+
+// empty deck over a full discard pile, the timing includes restoring it
+static void draw_reshuffle_run(int arg) {
+  (void)arg;
+  memcpy(game.discard_pile.cards, pile, sizeof(pile));
+  game.discard_pile.stack_top_index = DECK_SIZE - 28 - 1;
+  game.deck_stack.stack_top_index = -1;
+  sink += draw_card_from_deck()->color_code;
+}
+
+// deal, four bots play until one wins, tear down
+static void full_game_run(int arg) {
+  (void)arg;
+  set_active_game(&game);
+  init_game();
+  int turns = 0;
+  while (turns < GAME_TURN_LIMIT) {
+    int player = get_current_player();
+    bot_play(player);
+    next_player();
+    turns++;
+    if (game.hands[player].card_count == 0) {
+      break;
+    }
+  }
+  cleanup();
+  set_active_game(NULL);
+  sink += turns;
+}
+
+// --- render ---
+
+static struct Packet **replay_packets;
+static int replay_count;
+static struct VTerm replay_vt;
+
+static void replay_setup(int arg) {
+  (void)arg;
+  replay_count = load_replay(NULL, &replay_packets);
+  vterm_init(&replay_vt, REPLAY_ROWS, REPLAY_COLS);
+}
+
+static void replay_teardown(int arg) {
+  (void)arg;
+  free_replay(replay_packets, replay_count);
+  vterm_free(&replay_vt);
+}
+
+// only the renderer is timed, what it wrote is thrown away uninterpreted
+static void discard_frame(void *ctx, int bytes) {
+  struct VTerm *vt = ctx;
+  vt->pending.len = 0;
+  sink += bytes;
+}
+
+// a whole game drawn from scratch, screen and sprite cache included
+static void replay_run(int arg) {
+  (void)arg;
+  client_replay(replay_packets, replay_count, 0, &replay_vt, discard_frame,
+                &replay_vt);
+}
+
+// --- log ---
+
+// a record from the server's packet loop, as the producer keeps it and as
+// the writer formats it for the console
+static struct LogSite log_site = {.level = LOG_LEVEL_INFO,
+                                  .file = __FILE__,
+                                  .line = __LINE__,
+                                  .fmt = "Received packet from player %d: "
+                                         "type %d"};
+
+static void log_setup(int arg) {
+  (void)arg;
+  log_site_parse(&log_site);
+}
+
+static void log_pack(unsigned char *buf, ...) {
+  va_list args;
+  va_start(args, buf);
+  sink += log_pack_args(&log_site, args, buf, LOG_ARGS_MAX);
+  va_end(args);
+}
+
+static void log_pack_run(int arg) {
+  unsigned char buf[LOG_ARGS_MAX];
+  log_pack(buf, arg, MSG_ACTION);
+}
+
+static void log_format_run(int arg) {
+  unsigned char buf[LOG_ARGS_MAX];
+  char text[256];
+  log_pack(buf, arg, MSG_ACTION);
+  log_format(log_site.fmt, buf, 2 * sizeof(int), text, sizeof(text));
+  sink += text[0];
+}
+
+#define PROTOCOL_BENCH(name, index)                                          \
+  {"serialize/" name, protocol_setup, serialize_run, NULL, index},           \
+      {"deserialize/" name, protocol_setup, deserialize_run, NULL, index}
+
+static const struct Bench benches[] = {
+    PROTOCOL_BENCH("welcome", 0),
+    PROTOCOL_BENCH("waiting", 1),
+    PROTOCOL_BENCH("state", 2),
+    PROTOCOL_BENCH("hand7", 3),
+    PROTOCOL_BENCH("hand50", 4),
+    PROTOCOL_BENCH("action", 5),
+    PROTOCOL_BENCH("game_over", 6),
+    PROTOCOL_BENCH("error", 7),
+    PROTOCOL_BENCH("join", 8),
+    PROTOCOL_BENCH("ping", 9),
+    {"engine/can_play_card", engine_setup, can_play_card_run, engine_teardown,
+     0},
+    {"engine/play_card", engine_setup, play_card_run, engine_teardown, 0},
+    {"engine/shuffle_deck", engine_setup, shuffle_deck_run, engine_teardown, 0},
+    {"engine/draw_reshuffle", engine_setup, draw_reshuffle_run,
+     engine_teardown, 0},
+    {"game/full", NULL, full_game_run, NULL, 0},
+    {"render/replay", replay_setup, replay_run, replay_teardown, 0},
+    {"log/pack", log_setup, log_pack_run, NULL, 3},
+    {"log/format", log_setup, log_format_run, NULL, 3},
+};
+
+static long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long long time_batch(const struct Bench *bench, long long iterations) {
+  long long start = now_ns();
+  for (long long i = 0; i < iterations; i++) {
+    bench->run(bench->arg);
+  }
+  return now_ns() - start;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void run_bench(const struct Bench *bench) {
+  srand(BENCH_SEED);
+  if (bench->setup) {
+    bench->setup(bench->arg);
+  }
+
+  long long iterations = 1;
+  long long warmup_start = now_ns();
+  for (;;) {
+    long long elapsed = time_batch(bench, iterations);
+    if (elapsed < BENCH_BATCH_NS) {
+      iterations *= 2;
+    } else if (now_ns() - warmup_start >= BENCH_WARMUP_NS) {
+      break;
+    }
+  }
+
+  double ns_per_op[BENCH_REPS];
+  unsigned long long allocs = bench_allocs;
+  unsigned long long bytes = bench_alloc_bytes;
+  for (int rep = 0; rep < BENCH_REPS; rep++) {
+    ns_per_op[rep] = (double)time_batch(bench, iterations) / iterations;
+  }
+  double ops = (double)iterations * BENCH_REPS;
+  qsort(ns_per_op, BENCH_REPS, sizeof(double), compare_double);
+  printf("%s,%lld,%d,%.1f,%.1f,%.1f,%.2f,%.1f\n", bench->name, iterations,
+         BENCH_REPS, ns_per_op[0], ns_per_op[BENCH_REPS / 2],
+         ns_per_op[BENCH_REPS - 1], (bench_allocs - allocs) / ops,
+         (bench_alloc_bytes - bytes) / ops);
+  fflush(stdout);
+
+  if (bench->teardown) {
+    bench->teardown(bench->arg);
+  }
+}
+
+static int selected(const char *name, int argc, char *argv[]) {
+  if (argc < 2) {
+    return 1;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (strstr(name, argv[i]) != NULL) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // the engine seeds rand() from the clock on its first shuffle, get that
+  // out of the way so BENCH_SEED decides every deck
+  shuffle_deck(cards, 0);
+
+  if (argc > 1 && strcmp(argv[1], "--replay") == 0) {
+    srand(BENCH_SEED);
+    return run_replay_report(argc > 2 ? argv[2] : NULL) < 0 ? 1 : 0;
+  }
+
+  printf("name,iterations,reps,ns_op_min,ns_op_median,ns_op_max,allocs_op,"
+         "bytes_op\n");
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    if (selected(benches[i].name, argc, argv)) {
+      run_bench(&benches[i]);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE 1 // clock_gettime under -std=c99
+#include "replay.h"
+#include "client.h"
+#include "histogram.h"
+#include "uno.h"
+#include "vterm.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPLAY_TURN_LIMIT 2000 // a game nobody can finish stops here
+
+static int append_packet(const struct Packet *packet, struct Packet **packets,
+                         int count) {
+  struct Packet *copy = malloc(sizeof(struct Packet));
+  if (copy == NULL) {
+    return count; // the replay is a turn short
+  }
+  *copy = *packet;
+  packets[count] = copy;
+  return count + 1;
+}
+
+// what table.c broadcasts after every turn, for seat 0
+static int record_turn(struct GameDetails *game, uint32_t seq,
+                       struct Packet **packets, int count) {
+  struct Packet state = {.type = MSG_STATE};
+  state.data.game_state.seq = seq;
+  state.data.game_state.current_player_id = game->current_player;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    state.data.game_state.player_hand_sizes[i] = game->hands[i].card_count;
+  }
+  state.data.game_state.top_card = *get_top_discard();
+  state.data.game_state.direction = get_direction() > 0 ? 0 : 1;
+  count = append_packet(&state, packets, count);
+
+  struct Packet hand = {.type = MSG_HAND};
+  int cards = game->hands[0].card_count;
+  hand.data.player_hand.num_cards =
+      cards < MAX_HAND_SIZE ? cards : MAX_HAND_SIZE;
+  memcpy(hand.data.player_hand.cards, game->hands[0].cards,
+         sizeof(CardDetails) * hand.data.player_hand.num_cards);
+  return append_packet(&hand, packets, count);
+}
+
+// four bots play a game, the caller has seeded rand() so it is the same
+// game every run
+static int record_bot_game(struct Packet ***out) {
+  struct Packet **packets =
+      malloc(sizeof(struct Packet *) * 2 * (REPLAY_TURN_LIMIT + 1));
+  if (packets == NULL) {
+    return -1;
+  }
+  struct GameDetails game;
+  set_active_game(&game);
+  init_game();
+  uint32_t seq = 1;
+  int count = record_turn(&game, seq, packets, 0);
+  for (int turn = 0; turn < REPLAY_TURN_LIMIT; turn++) {
+    int player = get_current_player();
+    bot_play(player);
+    next_player();
+    if (game.hands[player].card_count == 0) {
+      break;
+    }
+    count = record_turn(&game, ++seq, packets, count);
+  }
+  cleanup();
+  set_active_game(NULL);
+  *out = packets;
+  return count;
+}
+
+int load_replay(const char *path, struct Packet ***out) {
+  if (path == NULL) {
+    return record_bot_game(out);
+  }
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  int count = 0, cap = 256;
+  struct Packet **packets = malloc(sizeof(struct Packet *) * cap);
+  // zeroed past the payload like read_packet's, a short one reads as zeros
+  char *payload = calloc(1, MAX_PACKET_SIZE);
+  uint32_t net_len;
+  while (packets && payload &&
+         fread(&net_len, sizeof(net_len), 1, file) == 1) {
+    uint32_t len = ntohl(net_len);
+    if (len > MAX_PACKET_SIZE) {
+      fprintf(stderr, "%s: bad packet length %u\n", path, len);
+      break;
+    }
+    memset(payload, 0, MAX_PACKET_SIZE);
+    if (fread(payload, 1, len, file) != len) {
+      break; // recording cut off mid packet
+    }
+    if (count == cap) {
+      cap *= 2;
+      struct Packet **grown = realloc(packets, sizeof(struct Packet *) * cap);
+      if (grown == NULL) {
+        break;
+      }
+      packets = grown;
+    }
+    packets[count] = deserialize_packet(payload, len);
+    if (packets[count] != NULL) {
+      count++;
+    }
+  }
+  free(payload);
+  fclose(file);
+  if (packets == NULL) {
+    return -1;
+  }
+  *out = packets;
+  return count;
+}
+
+void free_replay(struct Packet **packets, int count) {
+  for (int i = 0; i < count; i++) {
+    free(packets[i]);
+  }
+  free(packets);
+}
+
+struct ReplayStats {
+  struct VTerm *vt;
+  struct Histogram cpu_ns;
+  struct Histogram bytes;
+  unsigned long long total_bytes;
+  long long frame_start_ns;
+};
+
+static long long cpu_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the time since the last frame ended is this frame's, the emulation that
+// follows is left out of it
+static void frame_done(void *ctx, int bytes) {
+  struct ReplayStats *stats = ctx;
+  histogram_record(&stats->cpu_ns, cpu_now_ns() - stats->frame_start_ns);
+  histogram_record(&stats->bytes, bytes > 0 ? bytes : 0);
+  stats->total_bytes += bytes > 0 ? bytes : 0;
+  vterm_update(stats->vt);
+  stats->frame_start_ns = cpu_now_ns();
+}
+
+static void print_histogram(const char *name, const struct Histogram *hist) {
+  fprintf(stderr, "%s p50=%llu p90=%llu p99=%llu max=%llu mean=%llu\n", name,
+          (unsigned long long)histogram_percentile(hist, 50),
+          (unsigned long long)histogram_percentile(hist, 90),
+          (unsigned long long)histogram_percentile(hist, 99),
+          (unsigned long long)hist->max,
+          (unsigned long long)histogram_mean(hist));
+}
+
+int run_replay_report(const char *path) {
+  struct Packet **packets;
+  int count = load_replay(path, &packets);
+  if (count < 0) {
+    return -1;
+  }
+  // the seat the recording was made from is in its hand packets
+  uint8_t player_id = SPECTATOR_ID;
+  for (int i = 0; i < count; i++) {
+    if (packets[i]->type == MSG_HAND) {
+      player_id = packets[i]->data.player_hand.player_id;
+      break;
+    }
+  }
+
+  struct VTerm vt;
+  struct ReplayStats stats = {.vt = &vt};
+  histogram_reset(&stats.cpu_ns);
+  histogram_reset(&stats.bytes);
+  if (vterm_init(&vt, REPLAY_ROWS, REPLAY_COLS) < 0) {
+    free_replay(packets, count);
+    return -1;
+  }
+  // the first frame includes allocating the screen and the sprites, as it
+  // does when the client starts
+  stats.frame_start_ns = cpu_now_ns();
+  int status = client_replay(packets, count, player_id, &vt, frame_done,
+                             &stats);
+  if (status == 0) {
+    fprintf(stderr,
+            "packets=%d frames=%llu bytes=%llu unknown_sequences=%llu\n",
+            count, (unsigned long long)stats.bytes.count, stats.total_bytes,
+            vt.unknown);
+    print_histogram("frame_cpu_ns", &stats.cpu_ns);
+    print_histogram("frame_bytes", &stats.bytes);
+    vterm_dump(&vt, stdout);
+  }
+  vterm_free(&vt);
+  free_replay(packets, count);
+  return status;
+}
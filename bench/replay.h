@@ -0,0 +1,21 @@
+#ifndef UNO_BENCH_REPLAY_H
+#define UNO_BENCH_REPLAY_H
+
+#include "network.h"
+
+#define REPLAY_ROWS 40 // size of the virtual terminal frames are drawn into
+#define REPLAY_COLS 120
+
+// packets of a file written by the client's --record option, or of a
+// seeded bot game seen from seat 0 when path is NULL. Returns the count
+// and a malloc'd array in *packets, -1 if the file cannot be read
+int load_replay(const char *path, struct Packet ***packets);
+
+void free_replay(struct Packet **packets, int count);
+
+// draws the packets into a virtual terminal through the client's renderer
+// and reports bytes and CPU time per frame on stderr, then prints the final
+// screen on stdout so it can be kept and diffed as a snapshot
+int run_replay_report(const char *path);
+
+#endif // UNO_BENCH_REPLAY_H
@@ -1,10 +1,20 @@
+#define _GNU_SOURCE 1 // clock_gettime under -std=c99
 
 #include "client.h"
+#include "event_loop.h"
+#include "histogram.h"
+#include "input.h"
+#include "local.h"
 #include "logger.h"
 #include "network.h"
+#include "render.h"
+#include "vterm.h"
+#include "shm.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h> // for non-blocking input
 #include <iso646.h>
+#include <signal.h>
 #include <stdarg.h> // Required for va_list
 #include <stdint.h>
 #include <stdio.h>
@@ -12,35 +22,132 @@
 #include <string.h>
 #include <sys/ioctl.h> // for terminal size
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
-// Debug viewport at the top of the screen
-void debug_print(const char *fmt, ...) {
-  // 1. Save cursor position (optional but good practice)
-  // printf("\0337");
+// everything the client draws lands in this grid, see render.h
+static struct Screen screen;
+// where the drawing functions write: the screen, or a sprite being cached
+static struct Screen *canvas = &screen;
 
-  // 2. Move to Row 2, Column 1 (Safe zone)
-  move_cursor(1, 2);
+static long long client_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-  // 3. Clear the entire line first (to remove old debug msg)
-  printf("\033[2K");
+static long long client_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-  // 4. Print the "DEBUG: " prefix in Red to make it visible
-  printf("\033[1;31m[DEBUG] \033[0m");
+// echoes a server heartbeat so it can measure our round trip
+static void answer_ping(int sockfd, const struct Packet *ping) {
+  struct Packet pong = {MSG_PONG, .data.ping = ping->data.ping};
+  send_packet(sockfd, &pong);
+}
 
-  // 5. Print the actual message
+// Debug viewport at the top of the screen
+void debug_print(const char *fmt, ...) {
+  char text[256];
   va_list args;
   va_start(args, fmt);
-  vprintf(fmt, args);
+  vsnprintf(text, sizeof(text), fmt, args);
   va_end(args);
 
-  // 6. Reset cursor acts as a flush usually
-  fflush(stdout);
+  // Row 2 is the safe zone, clear the old message first
+  screen_fill(canvas, 1, 2, canvas->cols, 1);
+  move_cursor(1, 2);
+
+  // the "[DEBUG] " prefix in red to make it visible
+  set_color(196);
+  screen_print(canvas, "[DEBUG] ");
+  set_color(COLOR_DEFAULT);
+  screen_print(canvas, text);
 }
 #define CARD_WIDTH 11
 #define CARD_HEIGHT 7
 #define OPPS_MAX_CARDS                                                         \
   5 // less cards that are visibile in opponents hands but they can have more
+#define RESUME_ATTEMPTS 5
+#define RESUME_RETRY_MS 1000
+#define SIDE_REGION_WIDTH (CARD_WIDTH + 8) // left and right opponent columns
+#define HAND_MARGIN 6 // columns each side of the hand for the "◀ 12" counts
+#define RESIZE_SETTLE_MS 50 // quiet time that ends a burst of resize events
+#define INPUT_KEYS_MAX 256  // keys handled per tick, the rest wait
+#define NOTICE_MS 2000
+#define NO_PLAYER 0xFF // current_player_id while our move is in flight
+#define OVERLAY_KEY 'p'
+#define OVERLAY_REFRESH_MS 1000
+#define OVERLAY_LINES 4
+#define OVERLAY_WIDTH 40
+
+// screen areas that no longer match the game state, repaint() redraws them
+enum DirtyRegion {
+  DIRTY_HAND = 1 << 0,
+  DIRTY_DECK = 1 << 1,
+  DIRTY_TOP_CARD = 1 << 2,
+  DIRTY_OPPONENTS = 0xF << 3, // one bit per seat, see DIRTY_OPPONENT
+  DIRTY_ALL = DIRTY_HAND | DIRTY_DECK | DIRTY_TOP_CARD | DIRTY_OPPONENTS
+};
+#define DIRTY_OPPONENT(seat) (1 << (3 + (seat)))
+
+static int dirty_regions;
+
+// the leftmost card of the hand that is on screen. A hand wider than the
+// terminal shows a window of it that follows the selection
+static int hand_first;
+
+// hand index of the wild waiting on the colour menu, -1 when it is closed
+static int wild_menu_card = -1;
+
+// when the red notice above the hand comes down, 0 when none is up
+static long long notice_until_ms;
+
+// a play drawn before the server confirmed it. MSG_STATE settles it,
+// MSG_ERROR undoes it
+struct Prediction {
+  int pending;
+  int card_index;           // where the card was in the hand
+  CardDetails card;         // as it was in the hand
+  CardDetails top_card;     // the pile as we drew it
+  CardDetails old_top_card; // the pile before, for a rollback
+};
+static struct Prediction prediction;
+
+// what rendering costs on this terminal, for the overlay OVERLAY_KEY
+// toggles and the summary printed when the client exits. A frame is a
+// loop pass that wrote something to the terminal
+struct FrameStats {
+  struct Histogram frame_us; // from the wakeup to the end of the write
+  struct Histogram frame_bytes;
+  struct Histogram flush_us; // from a game packet's arrival to its frame
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t packets;
+  long long start_us;
+  long long window_us; // start of the current fps window
+  uint64_t window_frames;
+  double fps; // over the last full window
+};
+static struct FrameStats frame_stats;
+static int overlay_visible;
+static long long overlay_refresh_ms;
+static char overlay_text[OVERLAY_LINES][OVERLAY_WIDTH + 1];
+
+#define SPRITE_SLOTS 128 // power of two, about twice the distinct faces
+
+// a card face drawn once and copied into place from then on
+struct CardSprite {
+  char text[16]; // original_text, empty for a free slot
+  short color;   // wilds on the pile carry the colour that was picked
+  struct Screen art;
+};
+
+static struct CardSprite card_sprites[SPRITE_SLOTS];
+static struct Screen card_back_sprite;
+static struct Screen deck_sprite;
 
 struct termios orig_termios;
 
@@ -48,56 +155,85 @@ void move_cursor(int x, int y);
 void set_color(int fg);
 void draw_card(int x, int y, const char *text, const char *value, int color);
 void draw_opponent_hands(const uint8_t *player_hand_sizes, uint8_t player_id,
-                         int rows, int cols);
+                         int rows, int cols, int dirty);
+static struct CardSprite *card_sprite(const CardDetails *details);
 
 // Function to draw a single card at specific coordinates
 void draw_single_card_at_coords(int x, int y, const CardDetails *details) {
+  struct CardSprite *sprite = card_sprite(details);
+  if (sprite != NULL) {
+    screen_blit(canvas, &sprite->art, x, y);
+    return;
+  }
   draw_card(x, y, details->original_text, details->value_str,
             details->color_code);
-  printf("\033[0m"); // Reset color after drawing
+  set_color(COLOR_DEFAULT); // Reset color after drawing
 }
 
 // Function to clear a card area
 void clear_card_area(int x, int y) {
-  for (int row = 0; row < CARD_HEIGHT; ++row) {
-    move_cursor(x, y + row);
-    for (int col = 0; col < CARD_WIDTH; ++col) {
-      printf(" ");
-    }
-  }
+  screen_fill(canvas, x, y, CARD_WIDTH, CARD_HEIGHT);
 }
 
 void clear_region(int x, int y, int width, int height) {
   if (width <= 0 || height <= 0)
     return;
-  for (int row = 0; row < height; row++) {
-    move_cursor(x, y + row);
-    for (int col = 0; col < width; col++) {
-      printf(" ");
-    }
-  }
+  screen_fill(canvas, x, y, width, height);
 }
 
-void draw_card_back(int x, int y) {
+static void draw_card_back_art(int x, int y) {
   set_color(15);
   move_cursor(x, y);
-  printf("┌─────────┐");
+  screen_print(canvas, "┌─────────┐");
   for (int i = 1; i <= 5; i++) {
     move_cursor(x, y + i);
-    printf("│░░░░░░░░░│");
+    screen_print(canvas, "│░░░░░░░░░│");
   }
   move_cursor(x, y + 6);
-  printf("└─────────┘");
+  screen_print(canvas, "└─────────┘");
+}
+
+void draw_card_back(int x, int y) {
+  if (card_back_sprite.back != NULL) {
+    screen_blit(canvas, &card_back_sprite, x, y);
+  } else {
+    draw_card_back_art(x, y);
+  }
+}
+
+// how many cards of the hand fit across the screen, with room for the
+// counts of the ones left off either side
+static int hand_slots(int card_count, int cols) {
+  int fit = (cols - 2 * HAND_MARGIN) / CARD_WIDTH;
+  if (fit < 1)
+    fit = 1;
+  return card_count < fit ? card_count : fit;
+}
+
+// moves hand_first so the selection is on screen, scrolling as little as
+// it can. Returns the number of cards shown and their left edge
+static int hand_window(int card_count, int selected_index, int cols,
+                       int *start_x) {
+  int slots = hand_slots(card_count, cols);
+  if (selected_index < hand_first)
+    hand_first = selected_index;
+  else if (selected_index >= hand_first + slots)
+    hand_first = selected_index - slots + 1;
+  if (hand_first > card_count - slots)
+    hand_first = card_count - slots;
+  if (hand_first < 0)
+    hand_first = 0;
+  *start_x = (cols / 2) - ((slots * CARD_WIDTH) / 2);
+  return slots;
 }
 
 void clear_player_hand_area(int card_count, int cols, int y) {
   if (card_count <= 0)
     return;
-  int start_x = (cols / 2) - ((card_count * CARD_WIDTH) / 2);
-  for (int i = 0; i < card_count; i++) {
-    clear_card_area(start_x + i * CARD_WIDTH, y - 1);
-    clear_card_area(start_x + i * CARD_WIDTH, y);
-  }
+  int slots = hand_slots(card_count, cols);
+  int start_x = (cols / 2) - ((slots * CARD_WIDTH) / 2);
+  clear_region(start_x - HAND_MARGIN, y - 1,
+               slots * CARD_WIDTH + 2 * HAND_MARGIN, CARD_HEIGHT + 1);
 }
 
 void disable_raw_mode() { tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios); }
@@ -118,19 +254,11 @@ void get_terminal_size(int *rows, int *cols) {
   *cols = ws.ws_col;
 }
 
-void move_cursor(int x, int y) { printf("\033[%d;%dH", y, x); }
+void move_cursor(int x, int y) { screen_move(canvas, x, y); }
 
 void set_color(int fg) {
-  // color codes: 0-255
-  printf("\x1b[38;5;%dm", fg);
-}
-
-int get_input() {
-  char c;
-  if (read(STDIN_FILENO, &c, 1) == 1) {
-    return c;
-  }
-  return -1; // Error or no input
+  // color codes: 0-255, or COLOR_DEFAULT
+  screen_color(canvas, fg);
 }
 
 void draw_centered_text(int x, int y, const char *text) {
@@ -144,17 +272,17 @@ void draw_centered_text(int x, int y, const char *text) {
   int extra_space = (total_inner_width - text_len) % 2; // For odd-lengths
 
   move_cursor(x, y);
-  printf("│"); // Left border
+  screen_print(canvas, "│"); // Left border
 
   for (int i = 0; i < padding; i++)
-    printf(" ");
+    screen_print(canvas, " ");
 
-  printf("%.*s", total_inner_width, text);
+  screen_printf(canvas, "%.*s", total_inner_width, text);
 
   for (int i = 0; i < (padding + extra_space); i++)
-    printf(" ");
+    screen_print(canvas, " ");
 
-  printf("│"); // Right border
+  screen_print(canvas, "│"); // Right border
 }
 
 void draw_card(int x, int y, const char *text, const char *value, int color) {
@@ -162,127 +290,220 @@ void draw_card(int x, int y, const char *text, const char *value, int color) {
 
   set_color(color);
   move_cursor(x, y);
-  printf("┌─────────┐");
+  screen_print(canvas, "┌─────────┐");
 
   move_cursor(x, y + 1);
   switch (type) {
   case 1:
-    printf("│ %s       │", value);
+    screen_printf(canvas, "│ %s       │", value);
     break;
   case 2:
-    printf("│ %s      │", value);
+    screen_printf(canvas, "│ %s      │", value);
     break;
   case 3:
-    printf("│%s     │", value);
+    screen_printf(canvas, "│%s     │", value);
     break;
   case 4:
-    printf("│%s     │", value);
+    screen_printf(canvas, "│%s     │", value);
     break;
   case 5:
-    printf("│%s    │", value);
+    screen_printf(canvas, "│%s    │", value);
     break;
   case 7:
-    printf("│%s  │", value);
+    screen_printf(canvas, "│%s  │", value);
     break;
   default:
-    printf("│         │");
+    screen_print(canvas, "│         │");
     // unexpected length
     break;
   }
 
   move_cursor(x, y + 2);
-  printf("│         │");
+  screen_print(canvas, "│         │");
 
   draw_centered_text(x, y + 3, text); // draw text centered
 
   move_cursor(x, y + 4);
-  printf("│         │");
+  screen_print(canvas, "│         │");
 
   move_cursor(x, y + 5);
   switch (type) {
   case 0:
-    printf("│         │");
+    screen_print(canvas, "│         │");
     break;
   case 1:
-    printf("│       %s │", value);
+    screen_printf(canvas, "│       %s │", value);
     break;
   case 2:
-    printf("│      %s │", value);
+    screen_printf(canvas, "│      %s │", value);
     break;
   case 3:
-    printf("│     %s│", value);
+    screen_printf(canvas, "│     %s│", value);
     break;
   case 4:
-    printf("│     %s│", value);
+    screen_printf(canvas, "│     %s│", value);
     break;
   case 5:
-    printf("│    %s│", value);
+    screen_printf(canvas, "│    %s│", value);
     break;
   case 7:
-    printf("│  %s│", value);
+    screen_printf(canvas, "│  %s│", value);
     break;
   default:
-    printf("│       %s │", value);
+    screen_printf(canvas, "│       %s │", value);
     // unexpected length
     break;
   }
 
   move_cursor(x, y + 6);
-  printf("└─────────┘");
+  screen_print(canvas, "└─────────┘");
 }
 
+void redraw_whole_hand(const CardDetails *cards, int card_count,
+                       int selected_index, int x, int y);
+
 void redraw_hand(const CardDetails *cards, int card_count, int selected_index,
                  int x, int y, int prev_selected_index) {
   if (card_count <= 0 || selected_index < 0 || selected_index >= card_count)
     return;
   if (selected_index != prev_selected_index) {
-    int start_x = (x / 2) - ((card_count * CARD_WIDTH) / 2);
+    int first = hand_first;
+    int start_x;
+    int slots = hand_window(card_count, selected_index, x, &start_x);
+    if (hand_first != first) {
+      // scrolled, every card on screen moved
+      clear_player_hand_area(card_count, x, y);
+      redraw_whole_hand(cards, card_count, selected_index, x, y);
+      return;
+    }
     int base_y = y;
 
-    if (prev_selected_index >= 0 && prev_selected_index < card_count) {
-      clear_card_area(start_x + prev_selected_index * (CARD_WIDTH), base_y - 1);
-      draw_single_card_at_coords(start_x + prev_selected_index * (CARD_WIDTH),
-                                 base_y, &cards[prev_selected_index]);
+    if (prev_selected_index >= hand_first &&
+        prev_selected_index < hand_first + slots) {
+      int prev_x = start_x + (prev_selected_index - hand_first) * CARD_WIDTH;
+      clear_card_area(prev_x, base_y - 1);
+      draw_single_card_at_coords(prev_x, base_y, &cards[prev_selected_index]);
     }
 
-    clear_card_area(start_x + selected_index * (CARD_WIDTH), base_y);
-    draw_single_card_at_coords(start_x + selected_index * (CARD_WIDTH),
-                               base_y - 1, &cards[selected_index]);
+    int selected_x = start_x + (selected_index - hand_first) * CARD_WIDTH;
+    clear_card_area(selected_x, base_y);
+    draw_single_card_at_coords(selected_x, base_y - 1,
+                               &cards[selected_index]);
   }
-  fflush(stdout);
 }
 
-void draw_deck(int x, int y) {
+static void draw_deck_art(int x, int y) {
   set_color(15); // White color for deck
   move_cursor(x, y);
-  printf("┌─────────┐");
+  screen_print(canvas, "┌─────────┐");
   for (int i = 1; i <= 5; i++) {
     move_cursor(x, y + i);
-    printf("│░░░░░░░░░│");
+    screen_print(canvas, "│░░░░░░░░░│");
   }
   move_cursor(x, y + 6);
-  printf("└─────────┘");
+  screen_print(canvas, "└─────────┘");
 
   // Draw count
   move_cursor(x + 3, y + 3);
-  printf("UNO");
+  screen_print(canvas, "UNO");
+}
+
+void draw_deck(int x, int y) {
+  if (deck_sprite.back != NULL) {
+    screen_blit(canvas, &deck_sprite, x, y);
+  } else {
+    draw_deck_art(x, y);
+  }
+}
+
+static unsigned sprite_hash(const char *text, short color) {
+  unsigned hash = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < 16 && text[i] != '\0'; i++) {
+    hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+  }
+  return (hash ^ (unsigned short)color) * 16777619u;
+}
+
+// the cached face of a card, drawn the first time it is asked for. NULL
+// if the cache is full or out of memory, callers then draw directly
+static struct CardSprite *card_sprite(const CardDetails *details) {
+  unsigned slot = sprite_hash(details->original_text, details->color_code);
+  for (int probe = 0; probe < SPRITE_SLOTS; probe++) {
+    struct CardSprite *sprite = &card_sprites[(slot + probe) % SPRITE_SLOTS];
+    if (sprite->text[0] == '\0') {
+      if (screen_init(&sprite->art, CARD_HEIGHT, CARD_WIDTH) < 0) {
+        return NULL;
+      }
+      snprintf(sprite->text, sizeof(sprite->text), "%s",
+               details->original_text);
+      sprite->color = details->color_code;
+      canvas = &sprite->art;
+      draw_card(1, 1, details->original_text, details->value_str,
+                details->color_code);
+      canvas = &screen;
+      return sprite;
+    }
+    if (sprite->color == details->color_code &&
+        strncmp(sprite->text, details->original_text,
+                sizeof(sprite->text) - 1) == 0) {
+      return sprite;
+    }
+  }
+  return NULL;
+}
+
+// draws every face the deck can show up front, wilds in each colour they
+// can be played as, so no frame pays for formatting card art
+static void build_sprite_cache() {
+  static const uint8_t wild_colors[] = {196, 40, 20, 220};
+  for (int i = 0; i < DECK_SIZE; i++) {
+    CardDetails details = {0};
+    get_card_details(deck[i], &details);
+    card_sprite(&details);
+    if (strcmp(details.color_str, "black") == 0) {
+      for (int c = 0; c < 4; c++) {
+        details.color_code = wild_colors[c];
+        card_sprite(&details);
+      }
+    }
+  }
+  if (screen_init(&card_back_sprite, CARD_HEIGHT, CARD_WIDTH) == 0) {
+    canvas = &card_back_sprite;
+    draw_card_back_art(1, 1);
+  }
+  if (screen_init(&deck_sprite, CARD_HEIGHT, CARD_WIDTH) == 0) {
+    canvas = &deck_sprite;
+    draw_deck_art(1, 1);
+  }
+  canvas = &screen;
+}
+
+static void free_sprite_cache() {
+  for (int i = 0; i < SPRITE_SLOTS; i++) {
+    if (card_sprites[i].text[0] != '\0') {
+      screen_free(&card_sprites[i].art);
+      card_sprites[i].text[0] = '\0';
+    }
+  }
+  screen_free(&card_back_sprite);
+  screen_free(&deck_sprite);
 }
 
 void draw_color_menu(int x, int y) {
   move_cursor(x, y);
-  printf("Choose a color:");
+  screen_print(canvas, "Choose a color:");
   move_cursor(x, y + 1);
   set_color(196); // red
-  printf("1. Red");
+  screen_print(canvas, "1. Red");
   move_cursor(x, y + 2);
   set_color(40); // green
-  printf("2. Green");
+  screen_print(canvas, "2. Green");
   move_cursor(x, y + 3);
   set_color(20); // blue
-  printf("3. Blue");
+  screen_print(canvas, "3. Blue");
   move_cursor(x, y + 4);
   set_color(220); // yellow
-  printf("4. Yellow");
+  screen_print(canvas, "4. Yellow");
   set_color(15); // reset color
 }
 
@@ -291,6 +512,10 @@ void draw_hand(const CardDetails *cards, int card_count, int selected_index,
   int start_x = x;
   int base_y = y; // Fixed y position for hand
 
+  // the cards past the right edge would only be clipped
+  int fit = (canvas->cols - x + 1) / CARD_WIDTH;
+  if (card_count > fit)
+    card_count = fit;
   for (int i = 0; i < card_count; i++) {
     const CardDetails *details = &cards[i];
 
@@ -303,21 +528,39 @@ void draw_hand(const CardDetails *cards, int card_count, int selected_index,
   }
 }
 
+// draws the window of the hand around selected_index, so the cost goes
+// with the terminal width and not the hand size
 void redraw_whole_hand(const CardDetails *cards, int card_count,
                        int selected_index, int x, int y) {
-  int start_x = (x / 2) - ((card_count * CARD_WIDTH) / 2);
+  if (card_count <= 0)
+    return;
+  int start_x;
+  int slots = hand_window(card_count, selected_index, x, &start_x);
   int base_y = y;
 
-  for (int i = 0; i < card_count; i++) {
+  for (int i = hand_first; i < hand_first + slots; i++) {
     const CardDetails *details = &cards[i];
 
     int current_y = base_y;
     if (i == selected_index) {
       current_y = base_y - 1; // Highlighted position
     }
-    draw_single_card_at_coords(start_x + i * (CARD_WIDTH), current_y, details);
+    draw_single_card_at_coords(start_x + (i - hand_first) * CARD_WIDTH,
+                               current_y, details);
+  }
+
+  // how many cards are off each edge
+  set_color(250);
+  int hidden_right = card_count - hand_first - slots;
+  if (hand_first > 0) {
+    move_cursor(start_x - HAND_MARGIN, base_y + CARD_HEIGHT / 2);
+    screen_printf(canvas, "◀ %d", hand_first);
+  }
+  if (hidden_right > 0) {
+    move_cursor(start_x + slots * CARD_WIDTH + 1, base_y + CARD_HEIGHT / 2);
+    screen_printf(canvas, "%d ▶", hidden_right);
   }
-  fflush(stdout);
+  set_color(COLOR_DEFAULT);
 }
 
 void draw_horizontal_opp_hand(int x, int y, int count, int cols) {
@@ -336,7 +579,7 @@ void draw_horizontal_opp_hand(int x, int y, int count, int cols) {
 
   if (count > visible) {
     move_cursor(x + visible * CARD_WIDTH + 1, y + (CARD_HEIGHT / 2));
-    printf("+%d", count - visible);
+    screen_printf(canvas, "+%d", count - visible);
   }
 }
 
@@ -370,166 +613,277 @@ void draw_vertical_opp_hand(int x, int count, int min_y, int max_y) {
     if (label_y > max_y)
       label_y = max_y;
     move_cursor(x + 2, label_y);
-    printf("+%d", count - visible);
+    screen_printf(canvas, "+%d", count - visible);
   }
 }
 
+// redraws the opponents whose DIRTY_OPPONENT bit is set. The top hand keeps
+// to the band between the side columns so each region can be cleared
+// without touching its neighbours
 void draw_opponent_hands(const uint8_t *player_hand_sizes, uint8_t player_id,
-                         int rows, int cols) {
+                         int rows, int cols, int dirty) {
   int top_player = (player_id + 2) % MAX_PLAYERS;
   int left_player = (player_id + 1) % MAX_PLAYERS;
   int right_player = (player_id + 3) % MAX_PLAYERS;
   int top_y = 5;
   int side_min_y = 5;
   int side_max_y = rows - CARD_HEIGHT - 3;
-  int right_region_x = cols - (CARD_WIDTH + 8);
+  int right_region_x = cols - SIDE_REGION_WIDTH;
   int right_hand_x = cols - CARD_WIDTH - 1;
   if (right_region_x < 1)
     right_region_x = 1;
   if (right_hand_x < 1)
     right_hand_x = 1;
-
-  clear_region(1, top_y, cols, CARD_HEIGHT + 1);
-  clear_region(1, side_min_y, CARD_WIDTH + 8, side_max_y - side_min_y + 1);
-  clear_region(right_region_x, side_min_y, CARD_WIDTH + 8,
-               side_max_y - side_min_y + 1);
-
-  int top_count = player_hand_sizes[top_player];
-  int top_visible = top_count;
-  int top_fit = (cols - 4) / CARD_WIDTH;
-  if (top_visible > top_fit)
-    top_visible = top_fit;
-  if (top_visible > OPPS_MAX_CARDS)
-    top_visible = OPPS_MAX_CARDS;
-  if (top_visible < 0)
-    top_visible = 0;
-  int top_x = (cols / 2) - ((top_visible * CARD_WIDTH) / 2);
-  if (top_x < 2)
-    top_x = 2;
-  draw_horizontal_opp_hand(top_x, top_y, top_count, cols);
+  int band_x = SIDE_REGION_WIDTH + 1;
+  int band_width = right_region_x - band_x;
+
+  if ((dirty & DIRTY_OPPONENT(top_player)) && band_width > 0) {
+    clear_region(band_x, top_y, band_width, CARD_HEIGHT + 1);
+
+    int top_count = player_hand_sizes[top_player];
+    int top_visible = top_count;
+    int top_fit = (band_width - 4) / CARD_WIDTH;
+    if (top_visible > top_fit)
+      top_visible = top_fit;
+    if (top_visible > OPPS_MAX_CARDS)
+      top_visible = OPPS_MAX_CARDS;
+    if (top_visible < 0)
+      top_visible = 0;
+    int top_x = (cols / 2) - ((top_visible * CARD_WIDTH) / 2);
+    if (top_x < band_x)
+      top_x = band_x;
+    draw_horizontal_opp_hand(top_x, top_y, top_count, band_width);
+  }
 
   if (side_max_y >= side_min_y) {
-    draw_vertical_opp_hand(2, player_hand_sizes[left_player], side_min_y,
-                           side_max_y);
-    draw_vertical_opp_hand(right_hand_x, player_hand_sizes[right_player],
-                           side_min_y, side_max_y);
+    if (dirty & DIRTY_OPPONENT(left_player)) {
+      clear_region(1, side_min_y, SIDE_REGION_WIDTH,
+                   side_max_y - side_min_y + 1);
+      draw_vertical_opp_hand(2, player_hand_sizes[left_player], side_min_y,
+                             side_max_y);
+    }
+    if (dirty & DIRTY_OPPONENT(right_player)) {
+      clear_region(right_region_x, side_min_y, SIDE_REGION_WIDTH,
+                   side_max_y - side_min_y + 1);
+      draw_vertical_opp_hand(right_hand_x, player_hand_sizes[right_player],
+                             side_min_y, side_max_y);
+    }
   }
 }
 
-void read_input(int c, int *selected_index, int cols, int y,
-                int prev_selected_index, Hand *current_hand, int server_sock,
-                uint8_t player_id) {
-  if (c == '\033') {
-    char seq[2];
-    usleep(1000); // small delay to allow full escape sequence to arrive
-    if (read(STDIN_FILENO, &seq[0], 1) == 0)
-      return;
-    if (read(STDIN_FILENO, &seq[1], 1) == 0)
-      return;
-    debug_print("Key Pressed: %d ('%c')", c, (c >= 32 && c <= 126) ? c : '?');
+// moves the selection by delta cards, clamped to the hand. However many
+// arrow presses delta adds up, the hand is redrawn once
+static void move_selection(int delta, int *selected_index,
+                           int *prev_selected_index, Hand *current_hand,
+                           int cols, int y) {
+  if (delta == 0) {
+    return;
+  }
+  *selected_index += delta;
+  if (*selected_index < 0)
+    *selected_index = 0;
+  else if (*selected_index >= current_hand->card_count)
+    *selected_index =
+        current_hand->card_count > 0 ? current_hand->card_count - 1 : 0;
+  debug_print("Action: %s -> Index %d", delta > 0 ? "RIGHT" : "LEFT",
+              *selected_index);
+
+  if (current_hand->card_count > 0) {
+    redraw_hand(current_hand->cards, current_hand->card_count,
+                *selected_index, cols, y, *prev_selected_index);
+  }
+  *prev_selected_index = *selected_index;
+}
 
-    if (seq[0] == '[') {
-      switch (seq[1]) {
-      case 'A':
-        // Up arrow
-        debug_print("Up Arrow Pressed");
-        break;
-      case 'B':
-        // Down arrow
-        debug_print("Down Arrow Pressed");
-        break;
-      case 'C':
-        // Right arrow
-        debug_print("Action: right -> Index %d", *selected_index);
-        *selected_index += 1;
-        break;
-      case 'D':
-        // Left arrow
-        debug_print("Action: LEFT -> Index %d", *selected_index);
+static void close_color_menu(int cols, int y) {
+  wild_menu_card = -1;
+  clear_region(cols / 2 - 10, y - 10, 20, 6);
+  // the menu may have covered part of the table
+  dirty_regions |= DIRTY_ALL & ~DIRTY_HAND;
+}
 
-        *selected_index -= 1;
-        break;
-      case 13:
-        // ebter key
-        *selected_index = 0;
-        break;
-      }
-      if (*selected_index < 0)
-        *selected_index = 0;
-      else if (*selected_index >= current_hand->card_count)
-        *selected_index =
-            current_hand->card_count > 0 ? current_hand->card_count - 1 : 0;
-
-      if (current_hand->card_count > 0) {
-        redraw_hand(current_hand->cards, current_hand->card_count,
-                    *selected_index, cols, y, prev_selected_index);
-      }
+// handles one decoded key other than the arrows. Enter plays the selected
+// card, space draws. A wild opens the colour menu instead of blocking on
+// it: while it is up 1-4 play the wild in that colour and ESC backs out.
+// Returns 1 and fills action when the key asks for a move
+int read_input(int key, int selected_index, int cols, int y,
+               const Hand *current_hand, struct Action *action) {
+  memset(action, 0, sizeof(*action));
+  if (wild_menu_card >= 0) {
+    switch (key) {
+    case '1':
+      action->chosen_color = 196;
+      break; // red
+    case '2':
+      action->chosen_color = 40;
+      break; // green
+    case '3':
+      action->chosen_color = 20;
+      break; // blue
+    case '4':
+      action->chosen_color = 220;
+      break; // yellow
+    case KEY_ESCAPE:
+      close_color_menu(cols, y);
+      return 0;
+    default:
+      return 0; // the menu stays up until it gets an answer
     }
+    action->type = ACTION_PLAY_CARD;
+    action->card_index = wild_menu_card;
+    close_color_menu(cols, y);
+    return 1;
   }
-  if (c == 10) {
+
+  if (key == '\n') {
     // enter key
     if (current_hand->card_count <= 0) {
-      return;
+      return 0;
     }
-    debug_print("Action: PLAY CARD at Index %d", *selected_index);
-    struct Action play_action = {
-        .type = ACTION_PLAY_CARD,
-        .player_id = player_id, // will be set by server
-        .card_index = *selected_index,
-        .chosen_color = 0,
-    };
+    debug_print("Action: PLAY CARD at Index %d", selected_index);
 
-    CardDetails *played_card = &current_hand->cards[*selected_index];
+    const CardDetails *played_card = &current_hand->cards[selected_index];
     if (strcmp(played_card->color_str, "black") == 0) {
       // Wild card, prompt for color
-      int menu_x = cols / 2 - 10;
-      int menu_y = y - 10;
-      draw_color_menu(menu_x, menu_y);
-      int color_choice = -1;
-      while (color_choice < '1' || color_choice > '4') {
-        color_choice = get_input();
-      }
-      switch (color_choice) {
-      case '1':
-        play_action.chosen_color = 196;
-        break; // red
-      case '2':
-        play_action.chosen_color = 40;
-        break; // green
-      case '3':
-        play_action.chosen_color = 20;
-        break; // blue
-      case '4':
-        play_action.chosen_color = 220;
-        break; // yellow
-      }
-      clear_region(menu_x, menu_y, 20, 6);
+      draw_color_menu(cols / 2 - 10, y - 10);
+      wild_menu_card = selected_index;
+      return 0;
     }
-
-    struct Packet packet = {.type = MSG_ACTION, .data.action = play_action};
-    send_packet(server_sock, &packet);
+    action->type = ACTION_PLAY_CARD;
+    action->card_index = selected_index;
+    return 1;
   }
-  if (c == 32) {
+  if (key == ' ') {
     // space key
-    struct Action draw_action = {.type = ACTION_DRAW_CARD,
-                                 .player_id = player_id,
-                                 .card_index = 0, // Ignored
-                                 .chosen_color = 0};
-    struct Packet packet = {.type = MSG_ACTION, .data.action = draw_action};
-    send_packet(server_sock, &packet);
+    action->type = ACTION_DRAW_CARD;
+    return 1;
+  }
+  return 0;
+}
+
+// the notice line sits above the raised card, between the side columns
+static void clear_notice(int cols, int y) {
+  notice_until_ms = 0;
+  clear_region(SIDE_REGION_WIDTH + 1, y - 2, cols - 2 * SIDE_REGION_WIDTH, 1);
+}
 
-    draw_deck(60, 5);
+// a short message in red, taken down after NOTICE_MS
+static void show_notice(const char *text, int cols, int y) {
+  clear_notice(cols, y);
+  int x = (cols - (int)strlen(text)) / 2;
+  move_cursor(x > SIDE_REGION_WIDTH ? x : SIDE_REGION_WIDTH + 1, y - 2);
+  set_color(196);
+  screen_print(canvas, text);
+  set_color(COLOR_DEFAULT);
+  notice_until_ms = client_now_ms() + NOTICE_MS;
+}
+
+// shows a legal play as made before the server has seen it: the card
+// leaves the hand and lands on the pile this frame. Returns 0, changing
+// nothing, when the rules would refuse it on the pile as we last saw it
+static int predict_play(const struct Action *action, Hand *hand,
+                        int *selected_index, CardDetails *top_card,
+                        uint8_t *hand_size, int cols, int y) {
+  int index = action->card_index;
+  if (index < 0 || index >= hand->card_count ||
+      !card_playable(&hand->cards[index], top_card)) {
+    return 0;
+  }
+  prediction.pending = 1;
+  prediction.card_index = index;
+  prediction.card = hand->cards[index];
+  prediction.old_top_card = *top_card;
+
+  *top_card = hand->cards[index];
+  if (action->chosen_color != 0) {
+    // what change_color will make of the wild on the server
+    top_card->color_code = action->chosen_color;
+    if (action->chosen_color == 196) {
+      strcpy(top_card->color_str, "red");
+    } else if (action->chosen_color == 40) {
+      strcpy(top_card->color_str, "green");
+    } else if (action->chosen_color == 20) {
+      strcpy(top_card->color_str, "blue");
+    } else {
+      strcpy(top_card->color_str, "yellow");
+    }
   }
+  prediction.top_card = *top_card;
+
+  clear_player_hand_area(hand->card_count, cols, y);
+  memmove(&hand->cards[index], &hand->cards[index + 1],
+          sizeof(CardDetails) * (hand->card_count - index - 1));
+  hand->card_count--;
+  (*hand_size)--;
+  if (*selected_index >= hand->card_count && *selected_index > 0) {
+    *selected_index = hand->card_count - 1;
+  }
+  dirty_regions |= DIRTY_HAND | DIRTY_TOP_CARD;
+  return 1;
 }
 
-ClientGameDetails *connect_to_server(const char *ip, uint16_t port) {
-  // create socket and connect to server
-  ClientGameDetails *details = malloc(sizeof(ClientGameDetails));
+// puts back what predict_play took, the server refused the move
+static void rollback_play(Hand *hand, CardDetails *top_card,
+                          uint8_t *hand_size, int cols, int y) {
+  prediction.pending = 0;
+  // the hand was allocated at its old size, there is room for the card
+  clear_player_hand_area(hand->card_count, cols, y);
+  int index = prediction.card_index;
+  memmove(&hand->cards[index + 1], &hand->cards[index],
+          sizeof(CardDetails) * (hand->card_count - index));
+  hand->cards[index] = prediction.card;
+  hand->card_count++;
+  (*hand_size)++;
+  *top_card = prediction.old_top_card;
+  dirty_regions |= DIRTY_HAND | DIRTY_TOP_CARD;
+}
 
+// drains everything typed so far into keys, as much as max allows; the
+// rest stays in the terminal for the next wake-up. Returns the key count,
+// *hangup is set once the terminal is gone
+static int read_keys(struct InputDecoder *decoder, int *keys, int max,
+                     int *hangup) {
+  int count = input_expire(decoder, client_now_ms(), keys);
+  char bytes[INPUT_KEYS_MAX];
+  // one byte more than read can be a key, see input_feed
+  while (max - count > 1) {
+    size_t room = max - count - 1;
+    ssize_t n = read(STDIN_FILENO, bytes,
+                     room < sizeof(bytes) ? room : sizeof(bytes));
+    if (n <= 0) {
+      // stdin stays readable at end of file, waiting on it would spin
+      *hangup = n == 0 || errno != EAGAIN;
+      break; // otherwise nothing more was typed
+    }
+    count += input_feed(decoder, bytes, n, client_now_ms(), keys + count);
+  }
+  return count;
+}
+
+static ClientGameDetails *join_server(ClientGameDetails *details, int sockfd,
+                                      const struct JoinRequest *join);
+
+static ClientGameDetails *new_details() {
+  ClientGameDetails *details = calloc(1, sizeof(ClientGameDetails));
+  details->server_sock = -1;
+  return details;
+}
+
+static struct JoinRequest make_join(uint8_t join_mode, const char *game_code) {
+  struct JoinRequest join = {0};
+  join.mode = join_mode;
+  if (game_code != NULL) {
+    strncpy(join.code, game_code, GAME_CODE_LEN);
+  }
+  return join;
+}
+
+// returns a connected socket or -1
+static int dial_server(const char *ip, uint16_t port) {
   int sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd < 0) {
     perror("socket");
-    return details;
+    return -1;
   }
   struct sockaddr_in server_addr;
 
@@ -539,7 +893,7 @@ ClientGameDetails *connect_to_server(const char *ip, uint16_t port) {
   if (inet_pton(AF_INET, ip, &server_addr.sin_addr) <= 0) {
     perror("inet_pton");
     close(sockfd);
-    return details;
+    return -1;
   }
 
   if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) <
@@ -547,24 +901,422 @@ ClientGameDetails *connect_to_server(const char *ip, uint16_t port) {
     printf("failed to connect to server at %s:%d\n", ip, port);
     perror("connect");
     close(sockfd);
+    return -1;
+  }
+  return sockfd;
+}
+
+ClientGameDetails *connect_to_server(const char *ip, uint16_t port,
+                                     uint8_t join_mode, const char *game_code) {
+  // create socket and connect to server
+  ClientGameDetails *details = new_details();
+  details->server_ip = ip;
+  details->server_port = port;
+
+  int sockfd = dial_server(ip, port);
+  if (sockfd < 0) {
     return details;
   }
-  struct Packet *welcome_packet;
+  struct JoinRequest join = make_join(join_mode, game_code);
+  return join_server(details, sockfd, &join);
+}
 
-  int status = read_packet(sockfd, &welcome_packet);
-  if (status < 0 || welcome_packet->type != MSG_WELCOME) {
-    printf("failed to receive welcome packet from server\n");
-    close(sockfd);
+int resume_session(ClientGameDetails *details, uint32_t last_seq) {
+  if (details->server_ip == NULL || details->session == 0) {
+    return -1;
+  }
+  int sockfd = dial_server(details->server_ip, details->server_port);
+  if (sockfd < 0) {
+    return -1;
+  }
+  struct JoinRequest join = make_join(JOIN_RESUME, NULL);
+  join.session = details->session;
+  join.last_seq = last_seq;
+  details->server_sock = -1;
+  join_server(details, sockfd, &join);
+  return details->server_sock;
+}
+
+ClientGameDetails *connect_to_local_server(const char *shm_path,
+                                           uint8_t join_mode,
+                                           const char *game_code) {
+  ClientGameDetails *details = new_details();
+
+  int fd = shm_connect(shm_path);
+  if (fd < 0) {
+    return details;
+  }
+  struct JoinRequest join = make_join(join_mode, game_code);
+  return join_server(details, fd, &join);
+}
+
+ClientGameDetails *connect_in_process(int channel_fd, uint8_t join_mode,
+                                      const char *game_code) {
+  ClientGameDetails *details = new_details();
+
+  if (channel_fd < 0) {
+    printf("failed to start the embedded server\n");
     return details;
   }
+  struct JoinRequest join = make_join(join_mode, game_code);
+  return join_server(details, channel_fd, &join);
+}
 
-  printf("connected to server, assigned player ID: %d\n",
-         welcome_packet->data.player_id);
-  details->player_id = welcome_packet->data.player_id;
+// sends MSG_JOIN and waits in the lobby until the table starts
+static ClientGameDetails *join_server(ClientGameDetails *details, int sockfd,
+                                      const struct JoinRequest *join) {
+  struct Packet join_packet = {0};
+  join_packet.type = MSG_JOIN;
+  join_packet.data.join = *join;
+  if (send_packet(sockfd, &join_packet) < 0) {
+    printf("failed to join the lobby\n");
+    close_connection(sockfd);
+    return details;
+  }
+
+  // wait in the lobby until the table starts
+  struct Packet *welcome_packet;
+  for (;;) {
+    int status = read_packet(sockfd, &welcome_packet);
+    if (status < 0) {
+      printf("failed to receive welcome packet from server\n");
+      close_connection(sockfd);
+      return details;
+    }
+    if (welcome_packet->type == MSG_WELCOME) {
+      break;
+    }
+    if (welcome_packet->type == MSG_PING) {
+      answer_ping(sockfd, welcome_packet);
+    } else if (welcome_packet->type == MSG_WAITING_FOR_PLAYERS) {
+      struct LobbyStatus *lobby = &welcome_packet->data.lobby;
+      if (lobby->code[0] != '\0') {
+        printf("private game %s: %d/%d players, share the code to invite "
+               "friends\n",
+               lobby->code, lobby->num_players, lobby->seats);
+      } else {
+        printf("waiting for players: %d/%d\n", lobby->num_players,
+               lobby->seats);
+      }
+    } else if (welcome_packet->type == MSG_ERROR) {
+      printf("server refused to seat us (error %d)\n",
+             welcome_packet->data.error_code);
+      free(welcome_packet);
+      close_connection(sockfd);
+      return details;
+    }
+    free(welcome_packet);
+  }
+
+  struct Welcome *welcome = &welcome_packet->data.welcome;
+  if (welcome->player_id == SPECTATOR_ID) {
+    printf("connected to server, watching\n");
+  } else if (join->mode == JOIN_RESUME) {
+    printf("reconnected to server, back in seat %d\n", welcome->player_id);
+  } else {
+    printf("connected to server, assigned player ID: %d\n",
+           welcome->player_id);
+  }
+  details->player_id = welcome->player_id;
+  details->session = welcome->session;
   details->server_sock = sockfd;
+  free(welcome_packet);
   return details;
 }
 
+// one redial after a dropped connection, the main loop spaces attempts
+// RESUME_RETRY_MS apart. Returns the new socket or -1
+static int reconnect(ClientGameDetails *link, uint32_t last_seq,
+                     int attempt) {
+  debug_print("Connection lost, reconnecting (%d/%d)", attempt,
+              RESUME_ATTEMPTS);
+  screen_present(&screen, STDOUT_FILENO);
+  int sock = resume_session(link, last_seq);
+  if (sock >= 0) {
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    set_socket_timeout(sock, 3);
+  }
+  return sock;
+}
+
+// the next packet from the server without blocking: 1 with a packet, 0 if
+// no whole one is here yet, a PacketReadError once the link is lost. A
+// socket is read into in at most once per wake-up, so a frame split across
+// segments waits there for the rest; channels only ever hold whole frames
+static int next_server_packet(int fd, struct InBuf *in, int *readable,
+                              struct Packet **packet) {
+  if (local_channel(fd) != NULL || shm_channel(fd) != NULL) {
+    if (!*readable || !packet_ready(fd)) {
+      return 0;
+    }
+    *readable = 0;
+    return read_packet(fd, packet) == READ_OK ? 1 : READ_ERROR_RECV_LEN;
+  }
+  int result = in_buf_next(in, packet);
+  if (result != 0 || !*readable) {
+    return result;
+  }
+  *readable = 0;
+  if (in_buf_fill(fd, in) < 0) {
+    // whole frames are always taken out, what is left is part of one
+    return in->len > 0 ? READ_ERROR_RECV_PAYLOAD : READ_ERROR_RECV_LEN;
+  }
+  return in_buf_next(in, packet);
+}
+
+static void reset_frame_stats(long long now_us) {
+  memset(&frame_stats, 0, sizeof(frame_stats));
+  histogram_reset(&frame_stats.frame_us);
+  histogram_reset(&frame_stats.frame_bytes);
+  histogram_reset(&frame_stats.flush_us);
+  frame_stats.start_us = now_us;
+  frame_stats.window_us = now_us;
+}
+
+// counts one pass of the main loop; wake_us is when it started, packet_us
+// when it picked up a game packet or 0
+static void record_frame(int bytes, long long wake_us, long long packet_us) {
+  if (bytes <= 0) {
+    return;
+  }
+  long long now_us = client_now_us();
+  histogram_record(&frame_stats.frame_us, now_us - wake_us);
+  histogram_record(&frame_stats.frame_bytes, bytes);
+  if (packet_us != 0) {
+    histogram_record(&frame_stats.flush_us, now_us - packet_us);
+  }
+  frame_stats.frames++;
+  frame_stats.window_frames++;
+  frame_stats.bytes += bytes;
+}
+
+// formats the numbers once per OVERLAY_REFRESH_MS so the overlay itself
+// costs one small frame a second
+static void refresh_overlay(long long now_ms) {
+  long long now_us = now_ms * 1000;
+  long long window_us = now_us - frame_stats.window_us;
+  if (window_us > 0) {
+    frame_stats.fps = frame_stats.window_frames * 1e6 / window_us;
+  }
+  frame_stats.window_us = now_us;
+  frame_stats.window_frames = 0;
+  overlay_refresh_ms = now_ms + OVERLAY_REFRESH_MS;
+
+  const struct Histogram *frame_us = &frame_stats.frame_us;
+  const struct Histogram *bytes = &frame_stats.frame_bytes;
+  const struct Histogram *flush_us = &frame_stats.flush_us;
+  snprintf(overlay_text[0], sizeof(overlay_text[0]),
+           "frame us p50 %llu p99 %llu max %llu",
+           (unsigned long long)histogram_percentile(frame_us, 50),
+           (unsigned long long)histogram_percentile(frame_us, 99),
+           (unsigned long long)frame_us->max);
+  snprintf(overlay_text[1], sizeof(overlay_text[1]),
+           "bytes/frame p50 %llu p99 %llu",
+           (unsigned long long)histogram_percentile(bytes, 50),
+           (unsigned long long)histogram_percentile(bytes, 99));
+  snprintf(overlay_text[2], sizeof(overlay_text[2]),
+           "fps %.1f frames %llu packets %llu",
+           frame_stats.fps, (unsigned long long)frame_stats.frames,
+           (unsigned long long)frame_stats.packets);
+  snprintf(overlay_text[3], sizeof(overlay_text[3]),
+           "packet->flush us p50 %llu p99 %llu",
+           (unsigned long long)histogram_percentile(flush_us, 50),
+           (unsigned long long)histogram_percentile(flush_us, 99));
+}
+
+// top right corner under the debug line. Drawn over the table every frame
+// it is up, the screen diff keeps that free while the text stays the same
+static void draw_overlay(int cols) {
+  int x = cols - OVERLAY_WIDTH;
+  screen_fill(canvas, x, 3, OVERLAY_WIDTH, OVERLAY_LINES);
+  set_color(250);
+  for (int i = 0; i < OVERLAY_LINES; i++) {
+    move_cursor(x, 3 + i);
+    screen_print(canvas, overlay_text[i]);
+  }
+  set_color(COLOR_DEFAULT);
+}
+
+static void toggle_overlay(int cols) {
+  overlay_visible = !overlay_visible;
+  if (overlay_visible) {
+    refresh_overlay(client_now_ms());
+  } else {
+    screen_fill(canvas, cols - OVERLAY_WIDTH, 3, OVERLAY_WIDTH, OVERLAY_LINES);
+    dirty_regions |= DIRTY_ALL; // whatever the overlay covered
+  }
+}
+
+static void print_frame_stats() {
+  double seconds = (client_now_us() - frame_stats.start_us) / 1e6;
+  const struct Histogram *frame_us = &frame_stats.frame_us;
+  const struct Histogram *bytes = &frame_stats.frame_bytes;
+  const struct Histogram *flush_us = &frame_stats.flush_us;
+  printf("frames=%llu fps=%.1f packets=%llu bytes=%llu seconds=%.1f\n",
+         (unsigned long long)frame_stats.frames,
+         seconds > 0 ? frame_stats.frames / seconds : 0.0,
+         (unsigned long long)frame_stats.packets,
+         (unsigned long long)frame_stats.bytes, seconds);
+  printf("frame_us p50=%llu p90=%llu p99=%llu max=%llu mean=%llu\n",
+         (unsigned long long)histogram_percentile(frame_us, 50),
+         (unsigned long long)histogram_percentile(frame_us, 90),
+         (unsigned long long)histogram_percentile(frame_us, 99),
+         (unsigned long long)frame_us->max,
+         (unsigned long long)histogram_mean(frame_us));
+  printf("frame_bytes p50=%llu p90=%llu p99=%llu max=%llu mean=%llu\n",
+         (unsigned long long)histogram_percentile(bytes, 50),
+         (unsigned long long)histogram_percentile(bytes, 90),
+         (unsigned long long)histogram_percentile(bytes, 99),
+         (unsigned long long)bytes->max,
+         (unsigned long long)histogram_mean(bytes));
+  printf("packet_to_flush_us p50=%llu p90=%llu p99=%llu max=%llu mean=%llu\n",
+         (unsigned long long)histogram_percentile(flush_us, 50),
+         (unsigned long long)histogram_percentile(flush_us, 90),
+         (unsigned long long)histogram_percentile(flush_us, 99),
+         (unsigned long long)flush_us->max,
+         (unsigned long long)histogram_mean(flush_us));
+}
+
+// redraws whatever dirty_regions names, then clears it
+static void repaint(const Hand *hand, int selected_index,
+                    const CardDetails *top_card,
+                    const uint8_t *player_hand_sizes, uint8_t view_id,
+                    int rows, int cols) {
+  int dirty = dirty_regions;
+  dirty_regions = 0;
+
+  if (dirty & DIRTY_HAND) {
+    clear_player_hand_area(hand->card_count, cols, rows - CARD_HEIGHT);
+    redraw_whole_hand(hand->cards, hand->card_count, selected_index, cols,
+                      rows - CARD_HEIGHT);
+  }
+  if (dirty & DIRTY_DECK) {
+    int center_region_x = (cols / 2) - 10;
+    if (center_region_x < 1) {
+      center_region_x = 1;
+    }
+    clear_region(center_region_x, (rows / 2) - 1, 30, CARD_HEIGHT + 2);
+    draw_deck((cols / 2) - 8, (rows / 2));
+    dirty |= DIRTY_TOP_CARD; // shares the cleared centre
+  }
+  if (dirty & DIRTY_TOP_CARD) {
+    draw_single_card_at_coords(8 + (cols / 2), rows / 2, top_card);
+  }
+  if (dirty & DIRTY_OPPONENTS) {
+    draw_opponent_hands(player_hand_sizes, view_id, rows, cols, dirty);
+  }
+}
+
+// takes a MSG_STATE, marking the regions it changed for repaint
+static void apply_state(const struct GameState *state, CardDetails *top_card,
+                        uint8_t *player_hand_sizes) {
+  if (memcmp(top_card, &state->top_card, sizeof(CardDetails)) != 0) {
+    dirty_regions |= DIRTY_TOP_CARD;
+  }
+  for (int seat = 0; seat < MAX_PLAYERS; seat++) {
+    if (player_hand_sizes[seat] != state->player_hand_sizes[seat]) {
+      dirty_regions |= DIRTY_OPPONENT(seat);
+    }
+  }
+  memcpy(top_card, &state->top_card, sizeof(CardDetails));
+  memcpy(player_hand_sizes, state->player_hand_sizes,
+         sizeof(uint8_t) * MAX_PLAYERS);
+}
+
+static int same_hand(const struct PlayerHand *incoming, const Hand *hand) {
+  return incoming->num_cards == hand->card_count &&
+         (incoming->num_cards == 0 ||
+          memcmp(hand->cards, incoming->cards,
+                 sizeof(CardDetails) * incoming->num_cards) == 0);
+}
+
+// takes a MSG_HAND, keeping the selection inside the new hand
+static void apply_hand(const struct PlayerHand *incoming, Hand *hand,
+                       int *selected_index, int rows, int cols) {
+  if (same_hand(incoming, hand)) {
+    return; // same cards, nothing to repaint
+  }
+  clear_player_hand_area(hand->card_count, cols, rows - CARD_HEIGHT);
+  dirty_regions |= DIRTY_HAND;
+
+  // Update Data
+  hand->cards = realloc(hand->cards, sizeof(CardDetails) * incoming->num_cards);
+  hand->card_count = incoming->num_cards;
+  memcpy(hand->cards, incoming->cards, sizeof(CardDetails) * hand->card_count);
+
+  // Safety Check
+  if (*selected_index >= hand->card_count)
+    *selected_index = hand->card_count - 1;
+  if (*selected_index < 0)
+    *selected_index = 0;
+}
+
+// appends a packet to the --record file in wire format, length prefix and
+// all, so a recording reads like the stream from a TCP server
+static void record_packet(FILE *record, struct Packet *packet) {
+  if (record == NULL) {
+    return;
+  }
+  uint8_t frame[sizeof(uint32_t) + MAX_PACKET_SIZE];
+  uint32_t payload_size = serialize_packet(packet, frame + sizeof(uint32_t));
+  uint32_t len = htonl(payload_size);
+  memcpy(frame, &len, sizeof(len));
+  fwrite(frame, 1, sizeof(len) + payload_size, record);
+}
+
+int client_replay(struct Packet *const *packets, int count, uint8_t player_id,
+                  struct VTerm *vt, replay_frame_fn frame_done, void *ctx) {
+  if (screen_init(&screen, vt->rows, vt->cols) < 0) {
+    return -1;
+  }
+  screen.vterm = vt;
+  screen.sync_output = 1;
+  build_sprite_cache();
+  screen_raw(&screen, "\033[?25l\033[2J");
+
+  int rows = screen.rows;
+  int cols = screen.cols;
+  uint8_t view_id = player_id == SPECTATOR_ID ? 0 : player_id;
+  CardDetails top_card = {0};
+  uint8_t player_hand_sizes[MAX_PLAYERS] = {0};
+  Hand hand = {0};
+  int selected_index = 0;
+  int seen_state = 0;
+
+  for (int i = 0; i < count; i++) {
+    const struct Packet *packet = packets[i];
+    if (packet->type == MSG_STATE) {
+      apply_state(&packet->data.game_state, &top_card, player_hand_sizes);
+      if (!seen_state) {
+        seen_state = 1;
+        dirty_regions = DIRTY_ALL; // the first frame run_client draws
+      }
+    } else if (packet->type == MSG_HAND) {
+      apply_hand(&packet->data.player_hand, &hand, &selected_index, rows,
+                 cols);
+    } else {
+      continue; // lobby traffic and heartbeats draw nothing
+    }
+    if (!seen_state) {
+      continue;
+    }
+    if (dirty_regions) {
+      repaint(&hand, selected_index, &top_card, player_hand_sizes, view_id,
+              rows, cols);
+    }
+    int bytes = screen_present(&screen, -1);
+    if (frame_done != NULL) {
+      frame_done(ctx, bytes);
+    }
+  }
+
+  dirty_regions = 0;
+  free_sprite_cache();
+  screen_free(&screen);
+  free(hand.cards);
+  return 0;
+}
+
 void run_client(const ClientGameDetails details) {
   LOG_INFO("Starting client with player ID %d", details.player_id);
 
@@ -577,9 +1329,17 @@ void run_client(const ClientGameDetails details) {
   if (read_packet(details.server_sock, &state_packet) < 0 ||
       state_packet->type != MSG_STATE) {
     printf("failed to receive initial game state\n");
-    close(details.server_sock);
+    close_connection(details.server_sock);
     return;
   }
+  FILE *record = NULL;
+  if (details.record_path != NULL) {
+    record = fopen(details.record_path, "wb");
+    if (record == NULL) {
+      perror(details.record_path);
+    }
+  }
+  record_packet(record, state_packet);
   LOG_INFO("Received initial game state from server");
   LOG_INFO("CURRENT PLAYER ID: %d",
            state_packet->data.game_state.current_player_id);
@@ -600,169 +1360,391 @@ void run_client(const ClientGameDetails details) {
   memcpy(&direction, &state_packet->data.game_state.direction, sizeof(uint8_t));
   memcpy(&top_card, &state_packet->data.game_state.top_card,
          sizeof(CardDetails));
+  uint32_t last_seq = state_packet->data.game_state.seq;
+  free(state_packet);
 
-  struct Packet *hand_packet;
-  if (read_packet(details.server_sock, &hand_packet) < 0 ||
-      hand_packet->type != MSG_HAND) {
-    printf("failed to receive initial hand\n");
-    close(details.server_sock);
-    return;
-  }
-  LOG_INFO("Received initial hand from server");
-  LOG_INFO("Hand has %d cards", hand_packet->data.player_hand.num_cards);
-  LOG_INFO("Cards in hand:");
-  for (int i = 0; i < hand_packet->data.player_hand.num_cards; i++) {
-    CardDetails *card = &hand_packet->data.player_hand.cards[i];
-    LOG_INFO("Card %d: %s of %s", i, card->value_str, card->color_str);
-  }
+  // spectators have no hand and see the table from seat 0
+  int spectator = details.player_id == SPECTATOR_ID;
+  uint8_t view_id = spectator ? 0 : details.player_id;
 
   Hand current_hand;
-  current_hand.cards =
-      malloc(sizeof(CardDetails) * hand_packet->data.player_hand.num_cards);
-  current_hand.card_count = hand_packet->data.player_hand.num_cards;
-  memcpy(current_hand.cards, hand_packet->data.player_hand.cards,
-         sizeof(CardDetails) * current_hand.card_count);
+  current_hand.cards = NULL;
+  current_hand.card_count = 0;
+
+  if (!spectator) {
+    struct Packet *hand_packet;
+    if (read_packet(details.server_sock, &hand_packet) < 0 ||
+        hand_packet->type != MSG_HAND) {
+      printf("failed to receive initial hand\n");
+      close_connection(details.server_sock);
+      if (record != NULL) {
+        fclose(record);
+      }
+      return;
+    }
+    record_packet(record, hand_packet);
+    LOG_INFO("Received initial hand from server");
+    LOG_INFO("Hand has %d cards", hand_packet->data.player_hand.num_cards);
+    LOG_INFO("Cards in hand:");
+    for (int i = 0; i < hand_packet->data.player_hand.num_cards; i++) {
+      CardDetails *card = &hand_packet->data.player_hand.cards[i];
+      LOG_INFO("Card %d: %s of %s", i, card->value_str, card->color_str);
+    }
 
-  LOG_INFO("Copied hand to local state");
+    current_hand.cards =
+        malloc(sizeof(CardDetails) * hand_packet->data.player_hand.num_cards);
+    current_hand.card_count = hand_packet->data.player_hand.num_cards;
+    memcpy(current_hand.cards, hand_packet->data.player_hand.cards,
+           sizeof(CardDetails) * current_hand.card_count);
+    free(hand_packet);
+
+    LOG_INFO("Copied hand to local state");
+  }
 
   enable_raw_mode();
-  printf("\033[?25l");
-  printf("\033[2J");
 
   int rows, cols;
   get_terminal_size(&rows, &cols);
+  if (screen_init(&screen, rows, cols) < 0) {
+    printf("failed to allocate the screen\n");
+    disable_raw_mode();
+    free(current_hand.cards);
+    close_connection(details.server_sock);
+    if (record != NULL) {
+      fclose(record);
+    }
+    return;
+  }
+  // a frame is one write() to the terminal, wrapped in a synchronized
+  // update so it never shows half drawn
+  screen.sync_output = 1;
+  build_sprite_cache();
+  fflush(stdout); // lobby messages go out before the first frame
+  screen_raw(&screen, "\033[?25l\033[2J");
 
   int selected_index = 0;
   int prev_selected_index = -1;
+  struct InputDecoder decoder;
+  input_init(&decoder);
+  wild_menu_card = -1;
+  prediction.pending = 0;
+  reset_frame_stats(client_now_us());
   int running = 1;
+  int game_over = 0;
+  // a server that misses PING_MISSES heartbeats is treated as a drop
+  long long last_heard_ms = client_now_ms();
+  uint32_t ping_interval_ms = 0;
+  // the socket changes if we have to resume the session
+  ClientGameDetails link = details;
+  int server_sock = details.server_sock;
+  struct InBuf server_in; // part of a frame from a TCP server
+  server_in.len = 0;
+  // while the link is down, the next redial and how many were made
+  long long resume_at_ms = 0;
+  int resume_attempts = 0;
 
   // Make socket + stdin non-blocking
-  fcntl(details.server_sock, F_SETFL, O_NONBLOCK);
+  fcntl(server_sock, F_SETFL, O_NONBLOCK);
   fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
 
   LOG_INFO("Entering  rendering phase");
 
-  redraw_whole_hand(current_hand.cards, current_hand.card_count, selected_index,
-                    cols, rows - CARD_HEIGHT);
   prev_selected_index = selected_index;
+  dirty_regions = DIRTY_ALL;
+  repaint(&current_hand, selected_index, &top_card, player_hand_sizes, view_id,
+          rows, cols);
 
-  draw_deck((cols / 2) - 8, (rows / 2));
-  draw_single_card_at_coords(8 + (cols / 2), rows / 2, &top_card);
-  draw_opponent_hands(player_hand_sizes, details.player_id, rows, cols);
-
-  fflush(stdout);
+  screen_present(&screen, STDOUT_FILENO);
 
   LOG_INFO("Entering main client loop");
 
-  set_socket_timeout(details.server_sock, 3); // Non-blocking with select
+  // dragging a window edge sends a stream of SIGWINCH, lay out once it ends
+  long long relayout_at_ms = 0;
 
-  fd_set readfds;
-  while (running) {
+  set_socket_timeout(server_sock, 3);
 
-    FD_ZERO(&readfds);
-    FD_SET(STDIN_FILENO, &readfds);
-    FD_SET(details.server_sock, &readfds);
+  // nothing runs on a tick, the loop sleeps until a fd is readable or the
+  // earliest of the deadlines below comes due
+  struct EventLoop events;
+  if (event_loop_init(&events, STDIN_FILENO, server_sock) < 0) {
+    perror("event loop");
+    running = 0;
+  }
+  while (running) {
+    long long now_ms = client_now_ms();
+    int escape_ms = input_timeout(&decoder, now_ms);
+    long long deadline_ms = 0;
+    long long due_ms[] = {
+        relayout_at_ms,
+        notice_until_ms,
+        overlay_visible ? overlay_refresh_ms : 0,
+        escape_ms >= 0 ? now_ms + escape_ms : 0, // a lone ESC is a key
+        ping_interval_ms > 0
+            ? last_heard_ms + (long long)ping_interval_ms * PING_MISSES + 1
+            : 0,
+        resume_at_ms,
+    };
+    for (size_t i = 0; i < sizeof(due_ms) / sizeof(due_ms[0]); i++) {
+      if (due_ms[i] != 0 && (deadline_ms == 0 || due_ms[i] < deadline_ms)) {
+        deadline_ms = due_ms[i];
+      }
+    }
+    event_loop_set_deadline(&events, deadline_ms);
 
-    int maxfd = (STDIN_FILENO > details.server_sock ? STDIN_FILENO
-                                                    : details.server_sock) +
-                1;
+    int ready = event_loop_wait(&events, now_ms);
+    long long wake_us = client_now_us();
+    long long packet_us = 0; // arrival of a game packet handled this pass
 
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 16000; // ~60 FPS tick
+    if (ready < 0) {
+      perror("event loop");
+      break;
+    }
 
-    int activity = select(maxfd, &readfds, NULL, NULL, &timeout);
+    // -----------------------
+    // TERMINAL RESIZE
+    // -----------------------
+    if (ready & EVENT_RESIZE) {
+      relayout_at_ms = client_now_ms() + RESIZE_SETTLE_MS;
+    } else if (relayout_at_ms != 0 && client_now_ms() >= relayout_at_ms) {
+      relayout_at_ms = 0;
+      int new_rows, new_cols;
+      get_terminal_size(&new_rows, &new_cols);
+      if (screen_resize(&screen, new_rows, new_cols) == 0) {
+        // every position is derived from rows and cols, so a full repaint
+        // with the new values is the new layout
+        rows = screen.rows;
+        cols = screen.cols;
+        prev_selected_index = selected_index;
+        wild_menu_card = -1; // went with the old screen contents
+        notice_until_ms = 0;
+        dirty_regions = DIRTY_ALL;
+        LOG_INFO("Terminal resized to %dx%d", cols, rows);
+      }
+    }
 
-    if (activity < 0) {
-      perror("select");
-      break;
+    if (notice_until_ms != 0 && client_now_ms() >= notice_until_ms) {
+      clear_notice(cols, rows - CARD_HEIGHT);
     }
 
     // -----------------------
     // KEYBOARD INPUT
     // -----------------------
-    if (FD_ISSET(STDIN_FILENO, &readfds)) {
-
-      int c = get_input();
-      if (c == 'q') {
+    // everything typed since the last wake-up is handled in one go, so a
+    // burst of arrow presses moves the selection once
+    if ((ready & EVENT_INPUT) ||
+        input_timeout(&decoder, client_now_ms()) >= 0) {
+      int keys[INPUT_KEYS_MAX];
+      int hangup = 0;
+      int key_count = read_keys(&decoder, keys, INPUT_KEYS_MAX, &hangup);
+      if (hangup) {
         running = 0;
-      } else if (c != -1) {
-
-        read_input(c, &selected_index, cols, rows - CARD_HEIGHT,
-                   prev_selected_index, &current_hand, details.server_sock,
-                   details.player_id);
-        prev_selected_index = selected_index;
       }
+      int moves = 0; // arrow presses not applied yet
+      int y = rows - CARD_HEIGHT;
+
+      for (int i = 0; i < key_count && running; i++) {
+        int key = keys[i];
+        if (key == 'q') {
+          running = 0;
+        } else if (key == OVERLAY_KEY) {
+          toggle_overlay(cols);
+        } else if (spectator) {
+          continue;
+        } else if (key == KEY_LEFT || key == KEY_RIGHT) {
+          if (wild_menu_card < 0) {
+            moves += key == KEY_RIGHT ? 1 : -1;
+          }
+        } else {
+          // enter plays the card the arrows before it landed on
+          move_selection(moves, &selected_index, &prev_selected_index,
+                         &current_hand, cols, y);
+          moves = 0;
+          struct Action action;
+          if (!read_input(key, selected_index, cols, y, &current_hand,
+                          &action)) {
+            continue;
+          }
+          action.player_id = details.player_id;
+          if (server_sock < 0) {
+            show_notice("Reconnecting to the server", cols, y);
+            continue;
+          }
+          if (current_player_id != details.player_id) {
+            show_notice(current_player_id == NO_PLAYER
+                            ? "Waiting for the server"
+                            : "Not your turn",
+                        cols, y);
+            continue;
+          }
+          if (action.type == ACTION_PLAY_CARD &&
+              !predict_play(&action, &current_hand, &selected_index,
+                            &top_card, &player_hand_sizes[view_id], cols,
+                            y)) {
+            show_notice("That card does not match the pile", cols, y);
+            continue;
+          }
+          // the turn is gone until the server says otherwise
+          current_player_id = NO_PLAYER;
+          prev_selected_index = selected_index;
+          struct Packet packet = {.type = MSG_ACTION, .data.action = action};
+          send_packet(server_sock, &packet);
+        }
+      }
+      move_selection(moves, &selected_index, &prev_selected_index,
+                     &current_hand, cols, y);
     }
 
     // -----------------------
     // SERVER PACKETS
     // -----------------------
-    if (FD_ISSET(details.server_sock, &readfds)) {
+    int server_silent =
+        ping_interval_ms > 0 && client_now_ms() - last_heard_ms >
+                                    (long long)ping_interval_ms * PING_MISSES;
+    // redials run off the loop's deadline, input and redraws carry on
+    // between them
+    if (resume_at_ms != 0 && client_now_ms() >= resume_at_ms) {
+      server_sock = reconnect(&link, last_seq, ++resume_attempts);
+      if (server_sock >= 0) {
+        event_loop_set_server(&events, server_sock);
+        resume_at_ms = 0;
+        last_heard_ms = client_now_ms();
+      } else if (resume_attempts < RESUME_ATTEMPTS) {
+        resume_at_ms = client_now_ms() + RESUME_RETRY_MS;
+      } else {
+        printf("Server disconnected.\n");
+        running = 0;
+      }
+    }
 
+    // every whole frame the socket had is handled before sleeping again,
+    // a partial one waits in server_in for the rest
+    int server_readable = (ready & EVENT_SERVER) != 0;
+    while (running && server_sock >= 0) {
       struct Packet *packet;
-      int status = read_packet(details.server_sock, &packet);
+      int status = server_silent
+                       ? READ_ERROR_RECV_LEN
+                       : next_server_packet(server_sock, &server_in,
+                                            &server_readable, &packet);
+      if (status == 0) {
+        break;
+      }
 
       if (status < 0) {
         debug_print("Error reading packet from server: %d", status);
-        printf("Server disconnected.\n");
-        running = 0;
+        close_connection(server_sock);
+        // a dropped player gets the seat back, a finished game is over
+        if (prediction.pending) {
+          // the move may never have arrived, the resumed state decides
+          rollback_play(&current_hand, &top_card, &player_hand_sizes[view_id],
+                        cols, rows - CARD_HEIGHT);
+          current_player_id = details.player_id;
+        }
+        server_sock = -1;
+        event_loop_set_server(&events, -1);
+        server_in.len = 0;
+        ping_interval_ms = 0;
+        if (game_over || spectator) {
+          printf("Server disconnected.\n");
+          running = 0;
+        } else {
+          resume_at_ms = client_now_ms(); // first redial right away
+          resume_attempts = 0;
+        }
+        break;
+      } else if (packet->type == MSG_PING) {
+        record_packet(record, packet);
+        last_heard_ms = client_now_ms();
+        ping_interval_ms = packet->data.ping.interval_ms;
+        answer_ping(server_sock, packet);
+        free(packet);
       } else {
+        last_heard_ms = client_now_ms();
+        record_packet(record, packet);
+        frame_stats.packets++;
+        packet_us = wake_us;
 
         switch (packet->type) {
 
         case MSG_STATE:
-          memcpy(&top_card, &packet->data.game_state.top_card,
-                 sizeof(CardDetails));
-          memcpy(&player_hand_sizes, &packet->data.game_state.player_hand_sizes,
-                 sizeof(uint8_t) * MAX_PLAYERS);
+          last_seq = packet->data.game_state.seq;
+          apply_state(&packet->data.game_state, &top_card, player_hand_sizes);
+          current_player_id = packet->data.game_state.current_player_id;
+          if (prediction.pending) {
+            // the first state after our move has it on the pile, or the
+            // server saw things differently and its state has just won
+            prediction.pending = 0;
+            if (strcmp(top_card.original_text,
+                       prediction.top_card.original_text) != 0 ||
+                top_card.color_code != prediction.top_card.color_code) {
+              show_notice("The server saw a different move", cols,
+                          rows - CARD_HEIGHT);
+            }
+          }
           break;
 
-        case MSG_HAND: {
-
-          int old_count = current_hand.card_count;
-          clear_player_hand_area(old_count, cols, rows - CARD_HEIGHT);
-
-          // Update Data
-          current_hand.cards =
-              realloc(current_hand.cards,
-                      sizeof(CardDetails) * packet->data.player_hand.num_cards);
-          current_hand.card_count = packet->data.player_hand.num_cards;
-          memcpy(current_hand.cards, packet->data.player_hand.cards,
-                 sizeof(CardDetails) * current_hand.card_count);
-
-          // Safety Check
-          if (selected_index >= current_hand.card_count)
-            selected_index = current_hand.card_count - 1;
-          if (selected_index < 0)
-            selected_index = 0;
+        case MSG_HAND:
+          if (wild_menu_card >= 0 &&
+              !same_hand(&packet->data.player_hand, &current_hand)) {
+            close_color_menu(cols, rows - CARD_HEIGHT); // index is stale
+          }
+          apply_hand(&packet->data.player_hand, &current_hand, &selected_index,
+                     rows, cols);
           prev_selected_index = selected_index;
+          break;
 
+        case MSG_ERROR:
+          if (prediction.pending) {
+            rollback_play(&current_hand, &top_card,
+                          &player_hand_sizes[view_id], cols,
+                          rows - CARD_HEIGHT);
+            selected_index = prediction.card_index;
+            prev_selected_index = selected_index;
+          }
+          // a refused move keeps the turn, any other error means it was
+          // not ours to begin with
+          if (packet->data.error_code == ERROR_INVALID_ACTION) {
+            current_player_id = details.player_id;
+            show_notice("Move refused", cols, rows - CARD_HEIGHT);
+          } else {
+            show_notice("Not your turn", cols, rows - CARD_HEIGHT);
+          }
+          break;
+
+        case MSG_GAME_OVER:
+          game_over = 1;
           break;
-        }
         }
 
         free(packet);
+      }
+    }
 
-        // redraw after server update
-        clear_player_hand_area(current_hand.card_count, cols, rows - CARD_HEIGHT);
-        int center_region_x = (cols / 2) - 10;
-        if (center_region_x < 1) {
-          center_region_x = 1;
-        }
-        clear_region(center_region_x, (rows / 2) - 1, 30, CARD_HEIGHT + 2);
-        redraw_whole_hand(current_hand.cards, current_hand.card_count,
-                          selected_index, cols, rows - CARD_HEIGHT);
-        draw_deck((cols / 2) - 8, (rows / 2));
-        draw_single_card_at_coords(8 + (cols / 2), rows / 2, &top_card);
-        draw_opponent_hands(player_hand_sizes, details.player_id, rows, cols);
-
-        fflush(stdout);
+    if (dirty_regions) {
+      repaint(&current_hand, selected_index, &top_card, player_hand_sizes,
+              view_id, rows, cols);
+    }
+    if (overlay_visible) {
+      if (client_now_ms() >= overlay_refresh_ms) {
+        refresh_overlay(client_now_ms());
       }
+      draw_overlay(cols);
     }
+    // only the cells that changed since the last wake-up reach the terminal
+    record_frame(screen_present(&screen, STDOUT_FILENO), wake_us, packet_us);
   }
 
-  printf("\033[?25h");
+  event_loop_free(&events);
+  screen_raw(&screen, "\033[0m\033[?25h");
+  screen_present(&screen, STDOUT_FILENO);
   disable_raw_mode();
-  close(details.server_sock);
+  free_sprite_cache();
+  screen_free(&screen);
+  free(current_hand.cards);
+  if (server_sock >= 0) {
+    close_connection(server_sock);
+  }
+  if (record != NULL) {
+    fclose(record);
+  }
+  print_frame_stats();
 }
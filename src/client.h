@@ -11,23 +11,45 @@ typedef struct {
     uint8_t player_id;
     int server_sock;
     Hand* current_hand;
+    uint64_t session; // from MSG_WELCOME, resumes the seat after a drop
+    const char* server_ip; // NULL when the connection cannot be redialed
+    uint16_t server_port;
+    const char* record_path; // every packet from the server is saved here, NULL for none
 } ClientGameDetails;
 
+struct Packet;
+struct VTerm;
+
+// called by client_replay after each frame with the bytes it wrote
+typedef void (*replay_frame_fn)(void* ctx, int bytes);
+
 void enable_raw_mode();
 
 void disable_raw_mode();
 
 void draw_single_card_at_coords(int x, int y, const CardDetails* details);
 
-ClientGameDetails* connect_to_server(const char* ip, uint16_t port);
+// join_mode is a JoinMode, game_code is only used to join or watch a table
+ClientGameDetails* connect_to_server(const char* ip, uint16_t port, uint8_t join_mode, const char* game_code);
+// same, over shared memory with a server on this host
+ClientGameDetails* connect_to_local_server(const char* shm_path, uint8_t join_mode, const char* game_code);
+// reconnects over TCP and takes back the seat of details->session,
+// last_seq is the last MSG_STATE applied. Returns the new socket or -1
+int resume_session(ClientGameDetails* details, uint32_t last_seq);
+// same, over the in-process channel of an embedded server (see local.h)
+ClientGameDetails* connect_in_process(int channel_fd, uint8_t join_mode, const char* game_code);
 void clear_card_area(int x, int y);
 void get_terminal_size(int* rows, int* cols) ;
 
 void move_cursor(int x, int y);
 void set_color(int fg);
-int get_input() ;
 void draw_centered_text(int x, int y, const char* text);
 void draw_card(int x, int y, const char* text, const char* value, int color);
 void run_client(const ClientGameDetails details);
+// draws recorded packets (see --record) with the code run_client uses,
+// one frame per MSG_STATE or MSG_HAND, into vt instead of the terminal.
+// player_id is the seat the recording was made from. -1 if out of memory
+int client_replay(struct Packet* const* packets, int count, uint8_t player_id,
+                  struct VTerm* vt, replay_frame_fn frame_done, void* ctx);
 
 #endif // UNO_CLIENT_H
@@ -1,14 +1,12 @@
-
 #ifndef UNO_CLI_DEBUG_H
 #define UNO_CLI_DEBUG_H
 
+#include "logger.h"
 
-#define LOG_FILE_NAME "application.log"
-
-// A variadic macro that automatically passes file name, line number, and function name
-#define LOG_TO_FILE(format, ...) \
-    log_message(__FILE__, __LINE__, __func__, format, ##__VA_ARGS__)
+// binary, see logger.h; ./uno --decode-log prints it as text
+#define LOG_FILE_NAME "application.binlog"
 
-void log_message(const char* file, int line, const char* func, const char* format, ...);
+// kept for older call sites, a debug-level record like any other
+#define LOG_TO_FILE(format, ...) LOG_DEBUG(format, ##__VA_ARGS__)
 
 #endif //UNO_CLI_DEBUG_H
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE 1 // sigset_t and pthread_sigmask under -std=c99
+#include "event_loop.h"
+#include "shm.h" // notifiers
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+#ifdef __linux__
+
+static int watch_fd(struct EventLoop *loop, int op, int fd, uint32_t tag) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u32 = tag;
+  return epoll_ctl(loop->epoll_fd, op, fd, &event);
+}
+
+int event_loop_init(struct EventLoop *loop, int input_fd, int server_fd) {
+  memset(loop, 0, sizeof(*loop));
+  loop->input_fd = input_fd;
+  loop->server_fd = -1;
+  loop->signal_fd = -1;
+  loop->timer_fd = -1;
+
+  // a signalfd only sees signals no thread takes first, the embedded
+  // server's thread blocks everything too (see start_embedded_server)
+  sigset_t resize;
+  sigemptyset(&resize);
+  sigaddset(&resize, SIGWINCH);
+  pthread_sigmask(SIG_BLOCK, &resize, NULL);
+
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  loop->signal_fd = signalfd(-1, &resize, SFD_NONBLOCK | SFD_CLOEXEC);
+  loop->timer_fd =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (loop->epoll_fd < 0 || loop->signal_fd < 0 || loop->timer_fd < 0 ||
+      watch_fd(loop, EPOLL_CTL_ADD, input_fd, EVENT_INPUT) < 0 ||
+      watch_fd(loop, EPOLL_CTL_ADD, loop->signal_fd, EVENT_RESIZE) < 0 ||
+      watch_fd(loop, EPOLL_CTL_ADD, loop->timer_fd, EVENT_TIMER) < 0) {
+    event_loop_free(loop);
+    return -1;
+  }
+  event_loop_set_server(loop, server_fd);
+  return 0;
+}
+
+void event_loop_free(struct EventLoop *loop) {
+  if (loop->epoll_fd >= 0) {
+    close(loop->epoll_fd);
+  }
+  if (loop->signal_fd >= 0) {
+    close(loop->signal_fd);
+  }
+  if (loop->timer_fd >= 0) {
+    close(loop->timer_fd);
+  }
+  loop->epoll_fd = loop->signal_fd = loop->timer_fd = -1;
+  sigset_t resize;
+  sigemptyset(&resize);
+  sigaddset(&resize, SIGWINCH);
+  pthread_sigmask(SIG_UNBLOCK, &resize, NULL);
+}
+
+void event_loop_set_server(struct EventLoop *loop, int server_fd) {
+  if (loop->server_fd >= 0) {
+    // fails harmlessly when the old fd is already closed, which dropped it
+    watch_fd(loop, EPOLL_CTL_DEL, loop->server_fd, 0);
+  }
+  loop->server_fd = server_fd;
+  if (server_fd >= 0) {
+    watch_fd(loop, EPOLL_CTL_ADD, server_fd, EVENT_SERVER);
+  }
+}
+
+// one-shot at the deadline, all zeros disarms it
+static void arm_timer(struct EventLoop *loop) {
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = loop->deadline_ms / 1000;
+  spec.it_value.tv_nsec = (loop->deadline_ms % 1000) * 1000000;
+  timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+  loop->armed_ms = loop->deadline_ms;
+}
+
+int event_loop_wait(struct EventLoop *loop, long long now_ms) {
+  (void)now_ms; // the timer runs on the same clock
+  if (loop->deadline_ms != loop->armed_ms) {
+    arm_timer(loop);
+  }
+  struct epoll_event events[4];
+  int count = epoll_wait(loop->epoll_fd, events, 4, -1);
+  if (count < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+  int ready = 0;
+  for (int i = 0; i < count; i++) {
+    ready |= events[i].data.u32;
+  }
+  if (ready & EVENT_RESIZE) {
+    struct signalfd_siginfo info;
+    while (read(loop->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    }
+  }
+  if (ready & EVENT_TIMER) {
+    uint64_t expirations;
+    ssize_t n = read(loop->timer_fd, &expirations, sizeof(expirations));
+    (void)n;
+    loop->armed_ms = 0; // fired, so no longer armed
+  }
+  return ready;
+}
+
+#else
+
+// the handler's only way out of signal context
+static int resize_notify_fd = -1;
+
+static void handle_resize(int sig) {
+  (void)sig;
+  notifier_signal(resize_notify_fd);
+}
+
+int event_loop_init(struct EventLoop *loop, int input_fd, int server_fd) {
+  memset(loop, 0, sizeof(*loop));
+  loop->input_fd = input_fd;
+  loop->server_fd = server_fd;
+  if (make_notifier(loop->resize_fds) < 0) {
+    loop->resize_fds[0] = loop->resize_fds[1] = -1;
+    return -1;
+  }
+  resize_notify_fd = loop->resize_fds[1];
+  signal(SIGWINCH, handle_resize);
+  return 0;
+}
+
+void event_loop_free(struct EventLoop *loop) {
+  signal(SIGWINCH, SIG_DFL);
+  resize_notify_fd = -1;
+  if (loop->resize_fds[0] >= 0) {
+    close(loop->resize_fds[0]);
+    close(loop->resize_fds[1]);
+  }
+  loop->resize_fds[0] = loop->resize_fds[1] = -1;
+}
+
+void event_loop_set_server(struct EventLoop *loop, int server_fd) {
+  loop->server_fd = server_fd;
+}
+
+int event_loop_wait(struct EventLoop *loop, long long now_ms) {
+  struct pollfd pfds[3] = {
+      {loop->input_fd, POLLIN, 0},
+      {loop->resize_fds[0], POLLIN, 0},
+      {loop->server_fd, POLLIN, 0}, // poll skips a negative fd
+  };
+  int timeout = -1;
+  if (loop->deadline_ms != 0) {
+    long long left = loop->deadline_ms - now_ms;
+    timeout = left > 0 ? (int)left : 0;
+  }
+  int count = poll(pfds, 3, timeout);
+  if (count < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+  int ready = 0;
+  if (pfds[0].revents) {
+    ready |= EVENT_INPUT;
+  }
+  if (pfds[1].revents) {
+    notifier_drain(loop->resize_fds[0]);
+    ready |= EVENT_RESIZE;
+  }
+  if (pfds[2].revents) {
+    ready |= EVENT_SERVER;
+  }
+  if (count == 0) {
+    ready |= EVENT_TIMER;
+  }
+  return ready;
+}
+
+#endif
+
+void event_loop_set_deadline(struct EventLoop *loop, long long deadline_ms) {
+  loop->deadline_ms = deadline_ms;
+}
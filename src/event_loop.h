@@ -0,0 +1,47 @@
+#ifndef UNO_EVENT_LOOP_H
+#define UNO_EVENT_LOOP_H
+
+// What the client waits on: the terminal, the server connection, terminal
+// resizes and at most one deadline. Nothing wakes it otherwise, an idle
+// client sleeps in the kernel. On Linux the fds sit in an epoll set with a
+// signalfd for SIGWINCH and a timerfd that is only armed while a deadline
+// is pending. Elsewhere it is poll() with the deadline as the timeout and
+// a pipe the SIGWINCH handler writes to.
+
+enum EventBits {
+  EVENT_INPUT = 1 << 0,  // the terminal is readable
+  EVENT_SERVER = 1 << 1, // so is the server connection
+  EVENT_RESIZE = 1 << 2, // SIGWINCH arrived, maybe several
+  EVENT_TIMER = 1 << 3,  // the deadline passed
+};
+
+struct EventLoop {
+  int input_fd;
+  int server_fd;         // -1 while there is none
+  long long deadline_ms; // CLOCK_MONOTONIC ms like client_now_ms, 0 for none
+#ifdef __linux__
+  int epoll_fd;
+  int signal_fd;
+  int timer_fd;
+  long long armed_ms; // what timer_fd is set to, 0 when disarmed
+#else
+  int resize_fds[2]; // notifier written by the SIGWINCH handler
+#endif
+};
+
+// takes over SIGWINCH until event_loop_free. -1 if the fds cannot be made
+int event_loop_init(struct EventLoop *loop, int input_fd, int server_fd);
+
+void event_loop_free(struct EventLoop *loop);
+
+// the connection changes when the session is resumed, -1 for none
+void event_loop_set_server(struct EventLoop *loop, int server_fd);
+
+// wake up at deadline_ms even if nothing else happens, 0 for never
+void event_loop_set_deadline(struct EventLoop *loop, long long deadline_ms);
+
+// blocks until at least one thing happened, returns its EventBits. A
+// signal can make it return 0. -1 on error
+int event_loop_wait(struct EventLoop *loop, long long now_ms);
+
+#endif // UNO_EVENT_LOOP_H
@@ -0,0 +1,71 @@
+#include "histogram.h"
+#include <string.h>
+
+#define SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+int histogram_bucket(uint64_t value) {
+  if (value > UINT32_MAX) {
+    value = UINT32_MAX;
+  }
+  if (value < SUB_BUCKETS) {
+    return (int)value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int sub = (int)(value >> (msb - HISTOGRAM_SUB_BITS)) & (SUB_BUCKETS - 1);
+  return (msb - HISTOGRAM_SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// highest value that lands in the bucket
+static uint64_t bucket_limit(int bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t low = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return low + ((uint64_t)1 << shift) - 1;
+}
+
+void histogram_reset(struct Histogram *hist) { memset(hist, 0, sizeof(*hist)); }
+
+void histogram_record(struct Histogram *hist, uint64_t value) {
+  hist->buckets[histogram_bucket(value)]++;
+  hist->count++;
+  hist->sum += value;
+  if (value > hist->max) {
+    hist->max = value;
+  }
+}
+
+void histogram_merge(struct Histogram *into, const struct Histogram *from) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    into->buckets[i] += from->buckets[i];
+  }
+  into->count += from->count;
+  into->sum += from->sum;
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+}
+
+uint64_t histogram_percentile(const struct Histogram *hist, double percentile) {
+  if (hist->count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(percentile / 100.0 * hist->count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank) {
+      uint64_t limit = bucket_limit(i);
+      return limit < hist->max ? limit : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+uint64_t histogram_mean(const struct Histogram *hist) {
+  return hist->count ? hist->sum / hist->count : 0;
+}
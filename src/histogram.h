@@ -0,0 +1,35 @@
+#ifndef UNO_HISTOGRAM_H
+#define UNO_HISTOGRAM_H
+
+#include <stdint.h>
+
+// fixed-size log-linear histogram: values below 8 get a bucket each, every
+// power of two above is split into 8 buckets, so any recorded value is
+// reported within 12.5%. Values are clamped to 32 bits.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS (32 << HISTOGRAM_SUB_BITS)
+
+struct Histogram {
+  uint32_t buckets[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+
+void histogram_reset(struct Histogram *hist);
+
+// index into buckets that value is counted in
+int histogram_bucket(uint64_t value);
+
+void histogram_record(struct Histogram *hist, uint64_t value);
+
+// adds every sample of from into into
+void histogram_merge(struct Histogram *into, const struct Histogram *from);
+
+// value at or below which percentile (0-100) of the samples fall, 0 when
+// the histogram is empty
+uint64_t histogram_percentile(const struct Histogram *hist, double percentile);
+
+uint64_t histogram_mean(const struct Histogram *hist);
+
+#endif // UNO_HISTOGRAM_H
@@ -0,0 +1,101 @@
+#include "input.h"
+
+void input_init(struct InputDecoder *decoder) {
+  decoder->state = INPUT_GROUND;
+  decoder->seq_len = 0;
+  decoder->escape_ms = 0;
+}
+
+static int arrow_key(unsigned char final) {
+  switch (final) {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'C':
+    return KEY_RIGHT;
+  case 'D':
+    return KEY_LEFT;
+  }
+  return -1;
+}
+
+int input_feed(struct InputDecoder *decoder, const char *bytes, int len,
+               long long now_ms, int *keys) {
+  int count = 0;
+  for (int i = 0; i < len; i++) {
+    unsigned char byte = bytes[i];
+
+    switch (decoder->state) {
+    case INPUT_GROUND:
+      if (byte == 27) {
+        decoder->state = INPUT_ESCAPE;
+        decoder->seq_len = 0;
+        decoder->escape_ms = now_ms;
+      } else {
+        keys[count++] = byte;
+      }
+      break;
+
+    case INPUT_ESCAPE:
+      if (byte == '[') {
+        decoder->state = INPUT_CSI;
+      } else if (byte == 'O') {
+        decoder->state = INPUT_SS3;
+      } else if (byte == 27) {
+        // ESC ESC, the first was pressed on its own
+        keys[count++] = KEY_ESCAPE;
+        decoder->escape_ms = now_ms;
+      } else {
+        // ESC then a key, how terminals send Alt+key. Take them separately
+        keys[count++] = KEY_ESCAPE;
+        keys[count++] = byte;
+        decoder->state = INPUT_GROUND;
+      }
+      break;
+
+    case INPUT_CSI:
+      // parameters and intermediates until a final byte in 0x40-0x7e
+      if (byte >= 0x40 && byte <= 0x7e) {
+        int key = arrow_key(byte);
+        if (key >= 0) {
+          keys[count++] = key; // modifiers (ESC [ 1 ; 5 C) are ignored
+        }
+        decoder->state = INPUT_GROUND;
+      } else if (byte < 0x20 || ++decoder->seq_len > INPUT_SEQ_MAX) {
+        decoder->state = INPUT_GROUND; // not a sequence after all
+      }
+      break;
+
+    case INPUT_SS3: {
+      int key = arrow_key(byte);
+      if (key >= 0) {
+        keys[count++] = key;
+      }
+      decoder->state = INPUT_GROUND;
+      break;
+    }
+    }
+  }
+  return count;
+}
+
+int input_expire(struct InputDecoder *decoder, long long now_ms, int *keys) {
+  if (input_timeout(decoder, now_ms) != 0) {
+    return 0;
+  }
+  int count = 0;
+  if (decoder->state == INPUT_ESCAPE) {
+    keys[count++] = KEY_ESCAPE;
+  }
+  decoder->state = INPUT_GROUND;
+  return count;
+}
+
+int input_timeout(const struct InputDecoder *decoder, long long now_ms) {
+  if (decoder->state == INPUT_GROUND) {
+    return -1;
+  }
+  long long left = decoder->escape_ms + INPUT_ESC_TIMEOUT_MS - now_ms;
+  return left > 0 ? (int)left : 0;
+}
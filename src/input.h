@@ -0,0 +1,49 @@
+#ifndef UNO_INPUT_H
+#define UNO_INPUT_H
+
+// Turns raw terminal bytes into key presses. Bytes are fed in whatever
+// pieces read() returns them, so an escape sequence split across reads
+// still decodes as one key. A lone ESC looks like the start of a sequence
+// until INPUT_ESC_TIMEOUT_MS pass with nothing after it.
+#define INPUT_ESC_TIMEOUT_MS 25
+#define INPUT_SEQ_MAX 16 // longer sequences are dropped
+
+// keys are plain bytes, or one of these for the ones that take a sequence
+enum Key {
+  KEY_ESCAPE = 27,
+  KEY_UP = 256,
+  KEY_DOWN,
+  KEY_RIGHT,
+  KEY_LEFT,
+};
+
+enum InputState {
+  INPUT_GROUND,
+  INPUT_ESCAPE, // seen ESC
+  INPUT_CSI,    // seen ESC [, waiting for the final byte
+  INPUT_SS3,    // seen ESC O, arrows in application cursor mode
+};
+
+struct InputDecoder {
+  int state;
+  int seq_len;         // bytes after the ESC, to cap runaway sequences
+  long long escape_ms; // when the pending ESC arrived
+};
+
+void input_init(struct InputDecoder *decoder);
+
+// decodes len bytes that arrived at now_ms into keys, which needs room for
+// len + 1 entries (a byte after a pending ESC is two keys). Sequences we
+// have no key for, function keys or mouse reports, are swallowed. Returns
+// the number of keys written
+int input_feed(struct InputDecoder *decoder, const char *bytes, int len,
+               long long now_ms, int *keys);
+
+// ends a sequence that timed out: a bare ESC becomes KEY_ESCAPE, anything
+// longer is dropped. Returns the number of keys written, 0 or 1
+int input_expire(struct InputDecoder *decoder, long long now_ms, int *keys);
+
+// ms until input_expire has something to do, -1 when nothing is pending
+int input_timeout(const struct InputDecoder *decoder, long long now_ms);
+
+#endif // UNO_INPUT_H
@@ -0,0 +1,382 @@
+#define _GNU_SOURCE 1 // clock_gettime under -std=c99
+#include "loadgen.h"
+#include "histogram.h"
+#include "logger.h"
+#include "network.h"
+#include "timer.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOADGEN_RETRY_MS 1000 // before redialing after an error
+#define LOADGEN_REPORT_MS 1000
+
+struct LoadBot {
+  int fd;   // -1 between games
+  int seat; // -1 until MSG_WELCOME
+  int my_turn;    // the last MSG_STATE handed us the turn
+  int force_draw; // the server refused our card
+  long long action_sent_us; // 0 when no move waits for its MSG_STATE
+  CardDetails top_card;
+  CardDetails hand[MAX_HAND_SIZE];
+  int hand_size;
+  struct InBuf in;
+  struct Timer think_timer;  // our move, think_ms after the turn began
+  struct Timer rejoin_timer; // back into the queue after a game or error
+};
+
+struct LoadStats {
+  uint64_t messages_in;
+  uint64_t messages_out;
+  uint64_t games;
+  uint64_t turns;
+  uint64_t connect_errors;
+  uint64_t disconnects; // connections lost outside of a game over
+  uint64_t server_errors; // MSG_ERROR replies
+  struct Histogram turn_latency_us; // our move until the MSG_STATE after it
+};
+
+struct Loadgen {
+  struct LoadgenConfig config;
+  struct LoadBot *bots;
+  struct LoadStats stats;
+  struct TimerWheel timers;
+  int stopping;
+};
+
+static long long loadgen_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long long loadgen_now_ms() { return loadgen_now_us() / 1000; }
+
+static void bot_drop(struct Loadgen *lg, int id, int error);
+
+static int bot_send(struct Loadgen *lg, int id, struct Packet *packet) {
+  struct LoadBot *bot = &lg->bots[id];
+  if (send_packet(bot->fd, packet) < 0) {
+    bot_drop(lg, id, 1);
+    return -1;
+  }
+  lg->stats.messages_out++;
+  return 0;
+}
+
+static void bot_connect(struct Loadgen *lg, int id) {
+  struct LoadBot *bot = &lg->bots[id];
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(lg->config.port);
+  inet_pton(AF_INET, lg->config.ip, &addr.sin_addr);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    lg->stats.connect_errors++;
+    timer_schedule(&lg->timers, &bot->rejoin_timer,
+                   loadgen_now_ms() + LOADGEN_RETRY_MS);
+    return;
+  }
+
+  bot->fd = fd;
+  bot->seat = -1;
+  bot->my_turn = 0;
+  bot->force_draw = 0;
+  bot->action_sent_us = 0;
+  bot->hand_size = 0;
+  bot->in.len = 0;
+
+  struct Packet join = {0};
+  join.type = MSG_JOIN;
+  join.data.join.mode = JOIN_QUICK_MATCH;
+  if (bot_send(lg, id, &join) == 0) {
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+  }
+}
+
+static void bot_drop(struct Loadgen *lg, int id, int error) {
+  struct LoadBot *bot = &lg->bots[id];
+  if (bot->fd < 0) {
+    return;
+  }
+  close(bot->fd);
+  bot->fd = -1;
+  timer_cancel(&lg->timers, &bot->think_timer);
+  if (error) {
+    lg->stats.disconnects++;
+  }
+  if (!lg->stopping) {
+    timer_schedule(&lg->timers, &bot->rejoin_timer,
+                   loadgen_now_ms() + (error ? LOADGEN_RETRY_MS : 0));
+  }
+}
+
+// first card the server will accept
+static int pick_card(const struct LoadBot *bot) {
+  for (int i = 0; i < bot->hand_size; i++) {
+    if (card_playable(&bot->hand[i], &bot->top_card)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// wilds name the colour we hold most of
+static uint8_t pick_color(const struct LoadBot *bot) {
+  static const uint8_t colors[] = {196, 40, 20, 220};
+  int best = 0, best_count = -1;
+  for (int c = 0; c < 4; c++) {
+    int count = 0;
+    for (int i = 0; i < bot->hand_size; i++) {
+      count += bot->hand[i].color_code == colors[c];
+    }
+    if (count > best_count) {
+      best = c;
+      best_count = count;
+    }
+  }
+  return colors[best];
+}
+
+static void think_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Loadgen *lg = timer->ctx;
+  struct LoadBot *bot = &lg->bots[timer->arg];
+  (void)now_ms;
+  if (bot->fd < 0) {
+    return;
+  }
+
+  struct Packet packet = {0};
+  packet.type = MSG_ACTION;
+  packet.data.action.player_id = bot->seat;
+  int index = bot->force_draw ? -1 : pick_card(bot);
+  if (index >= 0) {
+    packet.data.action.type = ACTION_PLAY_CARD;
+    packet.data.action.card_index = index;
+    packet.data.action.chosen_color = pick_color(bot);
+  } else {
+    packet.data.action.type = ACTION_DRAW_CARD;
+  }
+  bot->my_turn = 0;
+  bot->force_draw = 0;
+  bot->action_sent_us = loadgen_now_us();
+  bot_send(lg, timer->arg, &packet);
+}
+
+static void rejoin_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Loadgen *lg = timer->ctx;
+  (void)now_ms;
+  if (!lg->stopping) {
+    bot_connect(lg, timer->arg);
+  }
+}
+
+static void handle_packet(struct Loadgen *lg, int id, struct Packet *packet) {
+  struct LoadBot *bot = &lg->bots[id];
+  lg->stats.messages_in++;
+
+  switch (packet->type) {
+  case MSG_WELCOME:
+    bot->seat = packet->data.welcome.player_id;
+    break;
+  case MSG_STATE:
+    bot->top_card = packet->data.game_state.top_card;
+    if (bot->action_sent_us != 0) {
+      histogram_record(&lg->stats.turn_latency_us,
+                       loadgen_now_us() - bot->action_sent_us);
+      lg->stats.turns++;
+      bot->action_sent_us = 0;
+    }
+    bot->my_turn = packet->data.game_state.current_player_id == bot->seat;
+    break;
+  case MSG_HAND: {
+    int count = packet->data.player_hand.num_cards;
+    memcpy(bot->hand, packet->data.player_hand.cards,
+           count * sizeof(CardDetails));
+    bot->hand_size = count;
+    // the hand follows the state, so we move knowing both
+    if (bot->my_turn && !timer_pending(&bot->think_timer)) {
+      timer_schedule(&lg->timers, &bot->think_timer,
+                     loadgen_now_ms() + lg->config.think_ms);
+    }
+    break;
+  }
+  case MSG_ERROR:
+    lg->stats.server_errors++;
+    if (bot->action_sent_us != 0) {
+      // the turn is still ours, drawing always works
+      bot->action_sent_us = 0;
+      bot->force_draw = 1;
+      timer_schedule(&lg->timers, &bot->think_timer, loadgen_now_ms());
+    }
+    break;
+  case MSG_PING: {
+    struct Packet pong = {MSG_PONG, .data.ping = packet->data.ping};
+    bot_send(lg, id, &pong);
+    break;
+  }
+  case MSG_GAME_OVER:
+    lg->stats.games++;
+    bot_drop(lg, id, 0);
+    break;
+  }
+}
+
+static void handle_readable(struct Loadgen *lg, int id) {
+  struct LoadBot *bot = &lg->bots[id];
+  for (;;) {
+    int n = in_buf_fill(bot->fd, &bot->in);
+    struct Packet *packet;
+    int result;
+    while (bot->fd >= 0 && (result = in_buf_next(&bot->in, &packet)) != 0) {
+      if (result < 0) {
+        bot_drop(lg, id, 1);
+        return;
+      }
+      handle_packet(lg, id, packet);
+      free(packet);
+    }
+    if (bot->fd < 0) {
+      return;
+    }
+    if (n < 0) {
+      bot_drop(lg, id, 1);
+      return;
+    }
+    if (n == 0) {
+      return;
+    }
+  }
+}
+
+static void print_report(struct Loadgen *lg, double seconds) {
+  struct LoadStats *stats = &lg->stats;
+  struct Histogram *latency = &stats->turn_latency_us;
+  printf("clients=%d think_ms=%d duration_s=%.1f\n", lg->config.clients,
+         lg->config.think_ms, seconds);
+  printf("games=%llu turns=%llu turns_per_s=%.0f\n",
+         (unsigned long long)stats->games, (unsigned long long)stats->turns,
+         stats->turns / seconds);
+  printf("messages_in=%llu messages_in_per_s=%.0f messages_out=%llu "
+         "messages_out_per_s=%.0f\n",
+         (unsigned long long)stats->messages_in, stats->messages_in / seconds,
+         (unsigned long long)stats->messages_out,
+         stats->messages_out / seconds);
+  printf("turn_latency_us p50=%llu p90=%llu p99=%llu p999=%llu max=%llu "
+         "mean=%llu\n",
+         (unsigned long long)histogram_percentile(latency, 50),
+         (unsigned long long)histogram_percentile(latency, 90),
+         (unsigned long long)histogram_percentile(latency, 99),
+         (unsigned long long)histogram_percentile(latency, 99.9),
+         (unsigned long long)latency->max,
+         (unsigned long long)histogram_mean(latency));
+  printf("errors connect=%llu disconnect=%llu server=%llu\n",
+         (unsigned long long)stats->connect_errors,
+         (unsigned long long)stats->disconnects,
+         (unsigned long long)stats->server_errors);
+}
+
+int run_loadgen(const struct LoadgenConfig *config) {
+  struct Loadgen *lg = calloc(1, sizeof(struct Loadgen));
+  struct pollfd *pfds = calloc(config->clients, sizeof(struct pollfd));
+  int *pfd_bot = calloc(config->clients, sizeof(int));
+  if (lg) {
+    lg->bots = calloc(config->clients, sizeof(struct LoadBot));
+  }
+  if (!lg || !lg->bots || !pfds || !pfd_bot) {
+    if (lg) {
+      free(lg->bots);
+    }
+    free(lg);
+    free(pfds);
+    free(pfd_bot);
+    return -1;
+  }
+  lg->config = *config;
+  if (raise_fd_limit(config->clients + 64) < config->clients + 16) {
+    LOG_WARN("Open file limit is below %d clients, expect connect errors",
+             config->clients);
+  }
+
+  long long start_ms = loadgen_now_ms();
+  long long end_ms = start_ms + (long long)config->duration_s * 1000;
+  long long next_report_ms = start_ms + LOADGEN_REPORT_MS;
+  timer_wheel_init(&lg->timers, start_ms);
+  for (int i = 0; i < config->clients; i++) {
+    struct LoadBot *bot = &lg->bots[i];
+    bot->fd = -1;
+    timer_init(&bot->think_timer, think_timer_fired, lg, i);
+    timer_init(&bot->rejoin_timer, rejoin_timer_fired, lg, i);
+    bot_connect(lg, i);
+  }
+  LOG_INFO("Load generator: %d clients against %s:%d for %d s",
+           config->clients, config->ip, config->port, config->duration_s);
+
+  for (;;) {
+    long long now_ms = loadgen_now_ms();
+    if (now_ms >= end_ms) {
+      break;
+    }
+    if (now_ms >= next_report_ms) {
+      LOG_INFO("%llds: %llu games, %llu turns, turn p99 %llu us, %llu errors",
+               (now_ms - start_ms) / 1000,
+               (unsigned long long)lg->stats.games,
+               (unsigned long long)lg->stats.turns,
+               (unsigned long long)histogram_percentile(
+                   &lg->stats.turn_latency_us, 99),
+               (unsigned long long)(lg->stats.connect_errors +
+                                    lg->stats.disconnects +
+                                    lg->stats.server_errors));
+      next_report_ms += LOADGEN_REPORT_MS;
+    }
+
+    int nfds = 0;
+    for (int i = 0; i < config->clients; i++) {
+      if (lg->bots[i].fd >= 0) {
+        pfds[nfds].fd = lg->bots[i].fd;
+        pfds[nfds].events = POLLIN;
+        pfd_bot[nfds++] = i;
+      }
+    }
+    int timeout = timer_wheel_timeout(&lg->timers, now_ms);
+    if (timeout < 0 || timeout > next_report_ms - now_ms) {
+      timeout = next_report_ms - now_ms;
+    }
+    if (poll(pfds, nfds, timeout) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    for (int i = 0; i < nfds; i++) {
+      int id = pfd_bot[i];
+      if (lg->bots[id].fd == pfds[i].fd &&
+          (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        handle_readable(lg, id);
+      }
+    }
+    timer_wheel_advance(&lg->timers, loadgen_now_ms());
+  }
+
+  lg->stopping = 1;
+  for (int i = 0; i < config->clients; i++) {
+    bot_drop(lg, i, 0);
+  }
+  print_report(lg, (loadgen_now_ms() - start_ms) / 1000.0);
+
+  free(lg->bots);
+  free(lg);
+  free(pfds);
+  free(pfd_bot);
+  return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef UNO_LOADGEN_H
+#define UNO_LOADGEN_H
+
+#include <stdint.h>
+
+#define DEFAULT_LOADGEN_CLIENTS 100
+#define DEFAULT_LOADGEN_THINK_MS 0
+#define DEFAULT_LOADGEN_DURATION_S 10
+
+struct LoadgenConfig {
+  const char *ip;
+  uint16_t port;
+  int clients;     // connections kept open against the server
+  int think_ms;    // pause between seeing our turn and moving
+  int duration_s;  // how long to run before reporting
+};
+
+// Headless quick match players that speak the wire protocol, play the
+// first legal card (or draw) and rejoin the queue when a game ends. Prints
+// turn latency percentiles, message rates and error counts at the end.
+int run_loadgen(const struct LoadgenConfig *config);
+
+#endif // UNO_LOADGEN_H
@@ -0,0 +1,95 @@
+#include "lobby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// no 0/O or 1/I so codes can be read out loud
+static const char code_alphabet[] = "ABCDEFGHJKLMNPQRSTUVWXYZ23456789";
+
+void lobby_init(struct Lobby *lobby) {
+  lobby->head = 0;
+  lobby->count = 0;
+}
+
+int lobby_enqueue(struct Lobby *lobby, int conn, long long now_ms) {
+  if (lobby->count >= LOBBY_QUEUE_SIZE) {
+    return -1;
+  }
+  int tail = (lobby->head + lobby->count) % LOBBY_QUEUE_SIZE;
+  lobby->queue[tail].conn = conn;
+  lobby->queue[tail].since_ms = now_ms;
+  lobby->count++;
+  return 0;
+}
+
+int lobby_dequeue(struct Lobby *lobby) {
+  if (lobby->count == 0) {
+    return -1;
+  }
+  int conn = lobby->queue[lobby->head].conn;
+  lobby->head = (lobby->head + 1) % LOBBY_QUEUE_SIZE;
+  lobby->count--;
+  return conn;
+}
+
+void lobby_remove(struct Lobby *lobby, int conn) {
+  // leaving the queue is rare next to matching, so shifting is fine here
+  int found = 0;
+  for (int i = 0; i < lobby->count; i++) {
+    int idx = (lobby->head + i) % LOBBY_QUEUE_SIZE;
+    if (!found && lobby->queue[idx].conn == conn) {
+      found = 1;
+    }
+    if (found && i + 1 < lobby->count) {
+      lobby->queue[idx] = lobby->queue[(idx + 1) % LOBBY_QUEUE_SIZE];
+    }
+  }
+  if (found) {
+    lobby->count--;
+  }
+}
+
+int lobby_size(const struct Lobby *lobby) { return lobby->count; }
+
+long long lobby_oldest(const struct Lobby *lobby) {
+  if (lobby->count == 0) {
+    return -1;
+  }
+  return lobby->queue[lobby->head].since_ms;
+}
+
+// fills out from /dev/urandom, -1 if it could not be read
+static int random_bytes(void *out, size_t len) {
+  FILE *urandom = fopen("/dev/urandom", "rb");
+  if (urandom == NULL) {
+    return -1;
+  }
+  size_t got = fread(out, 1, len, urandom);
+  fclose(urandom);
+  return got == len ? 0 : -1;
+}
+
+void lobby_make_code(char code[GAME_CODE_LEN + 1]) {
+  unsigned char bytes[GAME_CODE_LEN];
+  if (random_bytes(bytes, sizeof(bytes)) < 0) {
+    for (int i = 0; i < GAME_CODE_LEN; i++) {
+      bytes[i] = (unsigned char)rand();
+    }
+  }
+  // 32 symbols divide 256, every one is equally likely
+  for (int i = 0; i < GAME_CODE_LEN; i++) {
+    code[i] = code_alphabet[bytes[i] % (sizeof(code_alphabet) - 1)];
+  }
+  code[GAME_CODE_LEN] = '\0';
+}
+
+uint64_t lobby_make_session() {
+  uint64_t session = 0;
+  if (random_bytes(&session, sizeof(session)) < 0) {
+    session = 0;
+  }
+  while (session == 0) {
+    session = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+  }
+  return session;
+}
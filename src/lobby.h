@@ -0,0 +1,44 @@
+#ifndef UNO_LOBBY_H
+#define UNO_LOBBY_H
+
+#include "network.h"
+#include <stdint.h>
+
+#define LOBBY_QUEUE_SIZE 4096
+
+// a connection waiting for a quick match seat
+struct LobbyEntry {
+  int conn;
+  long long since_ms; // when it joined the queue
+};
+
+// FIFO of quick match players, oldest first
+struct Lobby {
+  struct LobbyEntry queue[LOBBY_QUEUE_SIZE];
+  int head;
+  int count;
+};
+
+void lobby_init(struct Lobby *lobby);
+
+int lobby_enqueue(struct Lobby *lobby, int conn, long long now_ms);
+
+// pops the oldest waiting connection, -1 if nobody is queued
+int lobby_dequeue(struct Lobby *lobby);
+
+// drops a connection that left before being seated
+void lobby_remove(struct Lobby *lobby, int conn);
+
+int lobby_size(const struct Lobby *lobby);
+
+// join time of the oldest entry, -1 if the queue is empty
+long long lobby_oldest(const struct Lobby *lobby);
+
+// random code for a private table from /dev/urandom, caller checks it is
+// not in use
+void lobby_make_code(char code[GAME_CODE_LEN + 1]);
+
+// unguessable non-zero token a player resumes their seat with
+uint64_t lobby_make_session();
+
+#endif // UNO_LOBBY_H
@@ -0,0 +1,188 @@
+#include "local.h"
+#include "shm.h" // notifiers
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum { LOCAL_SERVER = 0, LOCAL_CLIENT = 1 };
+
+struct LocalQueue {
+  struct Packet packets[LOCAL_QUEUE_SIZE];
+  int head;
+  int count;
+  int producer_waiting; // sender found the queue full
+};
+
+// both ends live until the second one closes, so a late wake-up never
+// lands on a recycled fd
+struct LocalPair {
+  pthread_mutex_t lock;
+  struct LocalQueue queues[2]; // indexed by the receiving side
+  int wake[2][2];              // notifier per side, see make_notifier
+  int closed[2];
+  int refs;
+};
+
+struct LocalChannel {
+  struct LocalPair *pair;
+  int side;
+};
+
+static struct LocalChannel *channels[LOCAL_MAX_FD];
+
+static void close_notifier(int fds[2]) {
+  if (fds[0] >= 0) {
+    close(fds[0]);
+  }
+  if (fds[1] >= 0 && fds[1] != fds[0]) {
+    close(fds[1]);
+  }
+}
+
+static void free_pair(struct LocalPair *pair) {
+  close_notifier(pair->wake[LOCAL_SERVER]);
+  close_notifier(pair->wake[LOCAL_CLIENT]);
+  pthread_mutex_destroy(&pair->lock);
+  free(pair);
+}
+
+int local_pair(int *client_fd, int *server_fd) {
+  struct LocalPair *pair = calloc(1, sizeof(struct LocalPair));
+  if (!pair) {
+    return -1;
+  }
+  pthread_mutex_init(&pair->lock, NULL);
+  pair->wake[LOCAL_SERVER][0] = pair->wake[LOCAL_SERVER][1] = -1;
+  pair->wake[LOCAL_CLIENT][0] = pair->wake[LOCAL_CLIENT][1] = -1;
+  if (make_notifier(pair->wake[LOCAL_SERVER]) < 0 ||
+      make_notifier(pair->wake[LOCAL_CLIENT]) < 0 ||
+      pair->wake[LOCAL_SERVER][0] >= LOCAL_MAX_FD ||
+      pair->wake[LOCAL_CLIENT][0] >= LOCAL_MAX_FD) {
+    free_pair(pair);
+    return -1;
+  }
+
+  struct LocalChannel *ends = calloc(2, sizeof(struct LocalChannel));
+  if (!ends) {
+    free_pair(pair);
+    return -1;
+  }
+  for (int side = 0; side < 2; side++) {
+    ends[side].pair = pair;
+    ends[side].side = side;
+    channels[pair->wake[side][0]] = &ends[side];
+  }
+  pair->refs = 2;
+  *server_fd = pair->wake[LOCAL_SERVER][0];
+  *client_fd = pair->wake[LOCAL_CLIENT][0];
+  return 0;
+}
+
+struct LocalChannel *local_channel(int fd) {
+  if (fd < 0 || fd >= LOCAL_MAX_FD) {
+    return NULL;
+  }
+  return channels[fd];
+}
+
+int local_send(struct LocalChannel *channel, const struct Packet *packet) {
+  struct LocalPair *pair = channel->pair;
+  int peer = !channel->side;
+  struct LocalQueue *queue = &pair->queues[peer];
+  int result = 1;
+
+  pthread_mutex_lock(&pair->lock);
+  if (pair->closed[peer]) {
+    result = -1;
+  } else if (queue->count == LOCAL_QUEUE_SIZE) {
+    queue->producer_waiting = 1;
+    result = 0;
+  } else {
+    int tail = (queue->head + queue->count) % LOCAL_QUEUE_SIZE;
+    queue->packets[tail] = *packet;
+    queue->count++;
+    notifier_signal(pair->wake[peer][1]);
+  }
+  pthread_mutex_unlock(&pair->lock);
+  return result;
+}
+
+int local_recv(struct LocalChannel *channel, struct Packet **packet) {
+  struct LocalPair *pair = channel->pair;
+  int side = channel->side;
+  struct LocalQueue *queue = &pair->queues[side];
+  int result = 1;
+
+  pthread_mutex_lock(&pair->lock);
+  if (queue->count == 0) {
+    result = pair->closed[!side] ? -1 : 0;
+    if (result == 0) {
+      notifier_drain(pair->wake[side][0]);
+    }
+  } else {
+    *packet = malloc(sizeof(struct Packet));
+    if (*packet == NULL) {
+      result = -1;
+    } else {
+      **packet = queue->packets[queue->head];
+      queue->head = (queue->head + 1) % LOCAL_QUEUE_SIZE;
+      queue->count--;
+      if (queue->producer_waiting) {
+        queue->producer_waiting = 0;
+        notifier_signal(pair->wake[!side][1]);
+      }
+      // stay readable exactly while packets are queued
+      if (queue->count == 0 && !pair->closed[!side]) {
+        notifier_drain(pair->wake[side][0]);
+      }
+    }
+  }
+  pthread_mutex_unlock(&pair->lock);
+  return result;
+}
+
+int local_packet_ready(struct LocalChannel *channel) {
+  struct LocalPair *pair = channel->pair;
+  int side = channel->side;
+
+  pthread_mutex_lock(&pair->lock);
+  int ready = pair->queues[side].count > 0 || pair->closed[!side];
+  if (!ready) {
+    // woken for queue space or a stale signal, clear it so poll() blocks
+    notifier_drain(pair->wake[side][0]);
+  }
+  pthread_mutex_unlock(&pair->lock);
+  return ready;
+}
+
+void local_wait(struct LocalChannel *channel) {
+  struct pollfd pfd = {channel->pair->wake[channel->side][0], POLLIN, 0};
+  while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+  }
+}
+
+void local_close(int fd) {
+  struct LocalChannel *channel = local_channel(fd);
+  if (channel == NULL) {
+    return;
+  }
+  struct LocalPair *pair = channel->pair;
+  int side = channel->side;
+  channels[fd] = NULL;
+
+  pthread_mutex_lock(&pair->lock);
+  pair->closed[side] = 1;
+  pair->queues[side].count = 0;
+  notifier_signal(pair->wake[!side][1]);
+  int refs = --pair->refs;
+  pthread_mutex_unlock(&pair->lock);
+
+  if (refs == 0) {
+    // the server end is first in the block both channels share
+    free(channel - channel->side);
+    free_pair(pair);
+  }
+}
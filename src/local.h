@@ -0,0 +1,39 @@
+#ifndef UNO_LOCAL_H
+#define UNO_LOCAL_H
+
+#include "network.h"
+
+// In-process transport between a client and a server running on another
+// thread of the same process. Each direction is a queue of struct Packet
+// copies, so nothing is serialized. Each side owns a wake fd (an eventfd on
+// Linux, a pipe elsewhere) that stays readable while its queue holds
+// packets, so it can sit in poll()/select() next to sockets. Like shm.h, a
+// channel is looked up by its wake fd.
+
+#define LOCAL_QUEUE_SIZE 256
+#define LOCAL_MAX_FD 65536
+
+struct LocalChannel;
+
+// creates a connected pair, returns 0 and both wake fds or -1
+int local_pair(int *client_fd, int *server_fd);
+
+// channel behind a wake fd, NULL for anything else
+struct LocalChannel *local_channel(int fd);
+
+// 1 when queued, 0 if the peer's queue is full, -1 if the peer closed
+int local_send(struct LocalChannel *channel, const struct Packet *packet);
+
+// 1 with a malloc'd copy in *packet, 0 if nothing is queued, -1 once the
+// peer closed and the queue is drained
+int local_recv(struct LocalChannel *channel, struct Packet **packet);
+
+// 1 if a packet is queued or the peer closed
+int local_packet_ready(struct LocalChannel *channel);
+
+// blocks until the peer signals us
+void local_wait(struct LocalChannel *channel);
+
+void local_close(int fd);
+
+#endif // UNO_LOCAL_H
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE 1 // localtime_r under -std=c99
+#include "log_format.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_MAGIC "UNOLOG1"
+#define LOG_BYTE_ORDER 0x01020304u
+
+static const char *level_names[] = {"ERROR", "WARN ", "INFO ", "DEBUG"};
+
+// one conversion of a format, from its '%' to the conversion character
+struct LogSpec {
+  const char *start;
+  int len;
+  int stars; // '*' widths and precisions, each takes an int first
+  char conv;
+  int kind; // enum LogArg, -1 for "%%" and conversions it cannot copy
+};
+
+static int spec_kind(const char *length, int length_len, char conv) {
+  if (strchr("diouxXc", conv) != NULL) {
+    if (length_len == 2 && length[0] == 'l') {
+      return LOG_ARG_LLONG;
+    }
+    if (length_len == 1) {
+      switch (length[0]) {
+      case 'l':
+        return LOG_ARG_LONG;
+      case 'z':
+        return LOG_ARG_SIZE;
+      case 'j':
+        return LOG_ARG_INTMAX;
+      case 't':
+        return LOG_ARG_PTRDIFF;
+      }
+    }
+    return LOG_ARG_INT; // hh and h are promoted to int
+  }
+  if (strchr("fFeEgGaA", conv) != NULL) {
+    return length_len == 1 && length[0] == 'L' ? LOG_ARG_LDOUBLE
+                                               : LOG_ARG_DOUBLE;
+  }
+  if (conv == 's') {
+    return LOG_ARG_STRING;
+  }
+  if (conv == 'p' || conv == 'n') {
+    return LOG_ARG_POINTER;
+  }
+  return -1;
+}
+
+// the next conversion at or after p, NULL when there is none
+static const char *next_spec(const char *p, struct LogSpec *spec) {
+  p = strchr(p, '%');
+  if (p == NULL) {
+    return NULL;
+  }
+  spec->start = p++;
+  spec->stars = 0;
+  while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+    p++;
+  }
+  // width, then precision
+  for (int part = 0; part < 2; part++) {
+    if (part == 1) {
+      if (*p != '.') {
+        break;
+      }
+      p++;
+    }
+    if (*p == '*') {
+      spec->stars++;
+      p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+      p++;
+    }
+  }
+  const char *length = p;
+  while (*p != '\0' && strchr("hlLzjt", *p) != NULL) {
+    p++;
+  }
+  spec->conv = *p;
+  spec->kind = spec->conv == '%' || spec->conv == '\0'
+                   ? -1
+                   : spec_kind(length, (int)(p - length), spec->conv);
+  if (*p != '\0') {
+    p++;
+  }
+  spec->len = (int)(p - spec->start);
+  return p;
+}
+
+void log_site_parse(struct LogSite *site) {
+  struct LogSpec spec;
+  const char *p = site->fmt;
+  site->arg_count = 0;
+  while ((p = next_spec(p, &spec)) != NULL) {
+    if (spec.conv == '%') {
+      continue;
+    }
+    if (spec.kind < 0 || site->arg_count + spec.stars >= LOG_MAX_ARGS) {
+      break; // the rest of the arguments are not kept
+    }
+    for (int i = 0; i < spec.stars; i++) {
+      site->args[site->arg_count++] = LOG_ARG_INT;
+    }
+    site->args[site->arg_count++] = (unsigned char)spec.kind;
+  }
+}
+
+#define PACK(type)                                                             \
+  do {                                                                         \
+    type value = va_arg(args, type);                                           \
+    if (size - used < sizeof(value)) {                                         \
+      return used;                                                             \
+    }                                                                          \
+    memcpy(buf + used, &value, sizeof(value));                                 \
+    used += sizeof(value);                                                     \
+  } while (0)
+
+size_t log_pack_args(const struct LogSite *site, va_list args,
+                     unsigned char *buf, size_t size) {
+  size_t used = 0;
+  for (int i = 0; i < site->arg_count; i++) {
+    switch (site->args[i]) {
+    case LOG_ARG_INT:
+      PACK(int);
+      break;
+    case LOG_ARG_LONG:
+      PACK(long);
+      break;
+    case LOG_ARG_LLONG:
+      PACK(long long);
+      break;
+    case LOG_ARG_SIZE:
+      PACK(size_t);
+      break;
+    case LOG_ARG_INTMAX:
+      PACK(intmax_t);
+      break;
+    case LOG_ARG_PTRDIFF:
+      PACK(ptrdiff_t);
+      break;
+    case LOG_ARG_DOUBLE:
+      PACK(double);
+      break;
+    case LOG_ARG_LDOUBLE:
+      PACK(long double);
+      break;
+    case LOG_ARG_POINTER:
+      PACK(void *);
+      break;
+    case LOG_ARG_STRING: {
+      const char *text = va_arg(args, const char *);
+      if (text == NULL) {
+        text = "(null)";
+      }
+      if (size - used < sizeof(uint16_t)) {
+        return used;
+      }
+      size_t len = strlen(text);
+      size_t room = size - used - sizeof(uint16_t);
+      uint16_t kept = (uint16_t)(len < room ? len : room);
+      memcpy(buf + used, &kept, sizeof(kept));
+      memcpy(buf + used + sizeof(kept), text, kept);
+      used += sizeof(kept) + kept;
+      break;
+    }
+    }
+  }
+  return used;
+}
+
+// reads one argument of type from the packed ones, or stops formatting
+#define UNPACK(type, value)                                                    \
+  do {                                                                         \
+    if (len - pos < sizeof(value)) {                                           \
+      goto cut_short;                                                          \
+    }                                                                          \
+    memcpy(&value, args + pos, sizeof(value));                                 \
+    pos += sizeof(value);                                                      \
+  } while (0)
+
+#define EMIT(value)                                                            \
+  (spec.stars == 0   ? snprintf(out + n, size - n, conv, value)                \
+   : spec.stars == 1 ? snprintf(out + n, size - n, conv, star[0], value)       \
+                     : snprintf(out + n, size - n, conv, star[0], star[1],     \
+                                value))
+
+void log_format(const char *fmt, const unsigned char *args, size_t len,
+                char *out, size_t size) {
+  size_t n = 0, pos = 0;
+  const char *p = fmt;
+  struct LogSpec spec;
+  const char *next;
+  out[0] = '\0';
+  while (n < size - 1 && (next = next_spec(p, &spec)) != NULL) {
+    // the text before the conversion
+    size_t text = (size_t)(spec.start - p);
+    if (text > size - 1 - n) {
+      text = size - 1 - n;
+    }
+    memcpy(out + n, p, text);
+    n += text;
+    out[n] = '\0';
+    p = next;
+    if (spec.conv == '%') {
+      if (n < size - 1) {
+        out[n++] = '%';
+        out[n] = '\0';
+      }
+      continue;
+    }
+    if (spec.kind < 0) {
+      goto cut_short;
+    }
+    int star[2] = {0, 0};
+    for (int i = 0; i < spec.stars; i++) {
+      UNPACK(int, star[i]);
+    }
+    char conv[32];
+    if (spec.len >= (int)sizeof(conv)) {
+      goto cut_short;
+    }
+    memcpy(conv, spec.start, spec.len);
+    conv[spec.len] = '\0';
+    int is_unsigned = strchr("ouxX", spec.conv) != NULL;
+    int wrote = 0;
+    switch (spec.kind) {
+    case LOG_ARG_INT: {
+      int value;
+      UNPACK(int, value);
+      wrote = is_unsigned ? EMIT((unsigned)value) : EMIT(value);
+      break;
+    }
+    case LOG_ARG_LONG: {
+      long value;
+      UNPACK(long, value);
+      wrote = is_unsigned ? EMIT((unsigned long)value) : EMIT(value);
+      break;
+    }
+    case LOG_ARG_LLONG: {
+      long long value;
+      UNPACK(long long, value);
+      wrote = is_unsigned ? EMIT((unsigned long long)value) : EMIT(value);
+      break;
+    }
+    case LOG_ARG_SIZE: {
+      size_t value;
+      UNPACK(size_t, value);
+      wrote = EMIT(value);
+      break;
+    }
+    case LOG_ARG_INTMAX: {
+      intmax_t value;
+      UNPACK(intmax_t, value);
+      wrote = is_unsigned ? EMIT((uintmax_t)value) : EMIT(value);
+      break;
+    }
+    case LOG_ARG_PTRDIFF: {
+      ptrdiff_t value;
+      UNPACK(ptrdiff_t, value);
+      wrote = EMIT(value);
+      break;
+    }
+    case LOG_ARG_DOUBLE: {
+      double value;
+      UNPACK(double, value);
+      wrote = EMIT(value);
+      break;
+    }
+    case LOG_ARG_LDOUBLE: {
+      long double value;
+      UNPACK(long double, value);
+      wrote = EMIT(value);
+      break;
+    }
+    case LOG_ARG_POINTER: {
+      void *value;
+      UNPACK(void *, value);
+      if (spec.conv == 'p') {
+        wrote = EMIT(value);
+      }
+      break;
+    }
+    case LOG_ARG_STRING: {
+      uint16_t kept;
+      UNPACK(uint16_t, kept);
+      if (len - pos < kept || kept > LOG_ARGS_MAX) {
+        goto cut_short;
+      }
+      // packed without its terminator
+      char copy[LOG_ARGS_MAX + 1];
+      memcpy(copy, args + pos, kept);
+      copy[kept] = '\0';
+      wrote = EMIT(copy);
+      pos += kept;
+      break;
+    }
+    }
+    if (wrote > 0) {
+      n += (size_t)wrote < size - n ? (size_t)wrote : size - n - 1;
+    }
+  }
+  // the text after the last conversion
+  if (n < size - 1) {
+    snprintf(out + n, size - n, "%s", p);
+  }
+  return;
+
+cut_short:
+  snprintf(out + n, size - n, "...");
+}
+
+int log_print_line(FILE *out, const struct timespec *when, int level,
+                   const char *file, int line, const char *text) {
+  char time_str[20];
+  struct tm tm;
+  localtime_r(&when->tv_sec, &tm);
+  strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+  const char *name =
+      level >= 0 && level <= LOG_LEVEL_DEBUG ? level_names[level] : "?    ";
+  return fprintf(out, "[%s.%03ld] [%s] %s:%d: %s\n", time_str,
+                 when->tv_nsec / 1000000, name, file, line, text);
+}
+
+static int put(FILE *out, const void *bytes, size_t len) {
+  return fwrite(bytes, 1, len, out) == len ? (int)len : 0;
+}
+
+static int put_string(FILE *out, const char *text) {
+  size_t len = strlen(text);
+  uint16_t kept = (uint16_t)(len < UINT16_MAX ? len : UINT16_MAX);
+  return put(out, &kept, sizeof(kept)) + put(out, text, kept);
+}
+
+int log_write_header(FILE *out) {
+  uint32_t probe = LOG_BYTE_ORDER;
+  uint8_t sizes[4] = {sizeof(long), sizeof(void *), sizeof(long double),
+                      sizeof(size_t)};
+  return put(out, "H", 1) + put(out, LOG_MAGIC, 7) +
+         put(out, &probe, sizeof(probe)) + put(out, sizes, sizeof(sizes));
+}
+
+int log_write_site(FILE *out, const struct LogSite *site) {
+  uint8_t level = (uint8_t)site->level;
+  uint32_t line = (uint32_t)site->line;
+  return put(out, "S", 1) + put(out, &site->id, sizeof(site->id)) +
+         put(out, &level, sizeof(level)) + put(out, &line, sizeof(line)) +
+         put_string(out, site->file) + put_string(out, site->fmt);
+}
+
+int log_write_record(FILE *out, uint32_t id, const struct timespec *when,
+                     const unsigned char *args, size_t len) {
+  int64_t sec = when->tv_sec;
+  int32_t nsec = (int32_t)when->tv_nsec;
+  uint16_t kept = (uint16_t)len;
+  return put(out, "R", 1) + put(out, &id, sizeof(id)) +
+         put(out, &sec, sizeof(sec)) + put(out, &nsec, sizeof(nsec)) +
+         put(out, &kept, sizeof(kept)) + put(out, args, kept);
+}
+
+// a site as the decoder knows it
+struct DecodedSite {
+  int level;
+  int line;
+  char *file;
+  char *fmt;
+};
+
+static int get(FILE *in, void *bytes, size_t len) {
+  return fread(bytes, 1, len, in) == len ? 0 : -1;
+}
+
+static char *get_string(FILE *in) {
+  uint16_t len;
+  if (get(in, &len, sizeof(len)) < 0) {
+    return NULL;
+  }
+  char *text = malloc(len + 1);
+  if (text == NULL || get(in, text, len) < 0) {
+    free(text);
+    return NULL;
+  }
+  text[len] = '\0';
+  return text;
+}
+
+static void forget_sites(struct DecodedSite *sites, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    free(sites[i].file);
+    free(sites[i].fmt);
+    sites[i].file = sites[i].fmt = NULL;
+  }
+}
+
+int log_decode(FILE *in, FILE *out) {
+  struct DecodedSite *sites = NULL;
+  uint32_t site_cap = 0;
+  int status = 0;
+  int type;
+  while (status == 0 && (type = fgetc(in)) != EOF) {
+    if (type == 'H') {
+      char magic[7];
+      uint32_t probe;
+      uint8_t sizes[4];
+      uint8_t ours[4] = {sizeof(long), sizeof(void *), sizeof(long double),
+                         sizeof(size_t)};
+      if (get(in, magic, sizeof(magic)) < 0 ||
+          memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0 ||
+          get(in, &probe, sizeof(probe)) < 0 ||
+          get(in, sizes, sizeof(sizes)) < 0) {
+        status = -1;
+      } else if (probe != LOG_BYTE_ORDER || memcmp(sizes, ours, 4) != 0) {
+        fprintf(stderr, "log written by a different kind of machine\n");
+        status = -2;
+      }
+      forget_sites(sites, site_cap); // ids start over with each process
+    } else if (type == 'S') {
+      uint32_t id, line;
+      uint8_t level;
+      if (get(in, &id, sizeof(id)) < 0 || get(in, &level, sizeof(level)) < 0 ||
+          get(in, &line, sizeof(line)) < 0) {
+        status = -1;
+        break;
+      }
+      if (id >= site_cap) {
+        uint32_t cap = site_cap ? site_cap : 64;
+        while (cap <= id) {
+          cap *= 2;
+        }
+        struct DecodedSite *grown = realloc(sites, sizeof(*sites) * cap);
+        if (grown == NULL) {
+          status = -1;
+          break;
+        }
+        memset(grown + site_cap, 0, sizeof(*sites) * (cap - site_cap));
+        sites = grown;
+        site_cap = cap;
+      }
+      struct DecodedSite *site = &sites[id];
+      free(site->file);
+      free(site->fmt);
+      site->level = level;
+      site->line = (int)line;
+      site->file = get_string(in);
+      site->fmt = get_string(in);
+      if (site->file == NULL || site->fmt == NULL) {
+        status = -1;
+      }
+    } else if (type == 'R') {
+      uint32_t id;
+      int64_t sec;
+      int32_t nsec;
+      uint16_t len;
+      unsigned char args[UINT16_MAX];
+      if (get(in, &id, sizeof(id)) < 0 || get(in, &sec, sizeof(sec)) < 0 ||
+          get(in, &nsec, sizeof(nsec)) < 0 || get(in, &len, sizeof(len)) < 0 ||
+          get(in, args, len) < 0) {
+        status = -1;
+        break;
+      }
+      if (id >= site_cap || sites[id].fmt == NULL) {
+        fprintf(stderr, "record for unknown site %u\n", id);
+        continue;
+      }
+      char text[1024];
+      log_format(sites[id].fmt, args, len, text, sizeof(text));
+      struct timespec when = {.tv_sec = (time_t)sec, .tv_nsec = nsec};
+      log_print_line(out, &when, sites[id].level, sites[id].file,
+                     sites[id].line, text);
+    } else {
+      status = -1;
+    }
+  }
+  if (status == -1) {
+    fprintf(stderr, "not a log file, or cut off mid record\n");
+  }
+  forget_sites(sites, site_cap);
+  free(sites);
+  return status < 0 ? -1 : 0;
+}
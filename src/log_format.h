@@ -0,0 +1,60 @@
+#ifndef UNO_LOG_FORMAT_H
+#define UNO_LOG_FORMAT_H
+
+#include "logger.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+
+// How a record's arguments are kept and turned back into text. Each
+// argument is copied at its C type's size in the machine's byte order,
+// strings as a 16-bit length and their bytes. A binary log file is a
+// sequence of:
+//   'H' "UNOLOG1" then the byte order probe 0x01020304 and the sizes of
+//       long, void *, long double and size_t; the ids of the sites before
+//       it no longer apply
+//   'S' u32 id, u8 level, u32 line, u16 length + file, u16 length + format
+//   'R' u32 id, i64 seconds, i32 nanoseconds, u16 length + arguments
+// all in the byte order of the machine that wrote it, which is the one
+// that can decode it.
+
+enum LogArg {
+  LOG_ARG_INT,
+  LOG_ARG_LONG,
+  LOG_ARG_LLONG,
+  LOG_ARG_SIZE,
+  LOG_ARG_INTMAX,
+  LOG_ARG_PTRDIFF,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_LDOUBLE,
+  LOG_ARG_STRING,
+  LOG_ARG_POINTER,
+};
+
+// fills in site->args from site->fmt
+void log_site_parse(struct LogSite *site);
+
+// copies the arguments into buf, returns the bytes used. Those that do
+// not fit are left out
+size_t log_pack_args(const struct LogSite *site, va_list args,
+                     unsigned char *buf, size_t size);
+
+// formats packed arguments with fmt, like snprintf
+void log_format(const char *fmt, const unsigned char *args, size_t len,
+                char *out, size_t size);
+
+// "[2024-01-31 12:00:00.000] [INFO ] file.c:12: text"
+int log_print_line(FILE *out, const struct timespec *when, int level,
+                   const char *file, int line, const char *text);
+
+// binary records, each returns the bytes written
+int log_write_header(FILE *out);
+int log_write_site(FILE *out, const struct LogSite *site);
+int log_write_record(FILE *out, uint32_t id, const struct timespec *when,
+                     const unsigned char *args, size_t len);
+
+// prints a binary log as text, -1 if it is not one or was written by a
+// different kind of machine
+int log_decode(FILE *in, FILE *out);
+
+#endif // UNO_LOG_FORMAT_H
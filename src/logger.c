@@ -0,0 +1,284 @@
+#define _GNU_SOURCE 1 // pthread_sigmask and clock_gettime under -std=c99
+#include "logger.h"
+#include "log_format.h"
+#include "shm.h" // notifiers
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct LogSlot {
+  uint64_t seq; // position it can be written at, or that plus one once full
+  struct LogSite *site;
+  struct timespec when;
+  uint16_t len;
+  unsigned char args[LOG_ARGS_MAX]; // see log_pack_args
+};
+
+enum SiteState {
+  SITE_NEW,
+  SITE_PARSING, // one thread is filling in its argument types
+  SITE_READY,
+};
+
+static struct {
+  struct LogSlot slots[LOG_RING_SLOTS];
+  uint64_t tail;     // next position a producer claims
+  uint64_t head;     // next position the writer takes, only it moves this
+  int running;       // records go to the ring, not stderr
+  int stopping;      // the writer drains the ring and exits
+  int sleeping;      // the writer waits on wake_fds, producers signal it
+  int wake_fds[2]; // left open after log_stop, a late producer may signal
+  int have_wake_fds;
+  unsigned long long dropped;
+  pthread_t thread;
+  uint32_t next_site_id;
+  const char *path; // NULL for stderr
+  FILE *out;
+  unsigned file_gen; // bumped per file, each one names the sites it uses
+  long written;      // bytes in the current file, for rotation
+} logger;
+
+// the only place arguments are formatted, on the writer thread. A binary
+// file gets a site's format the first time the site shows up in it
+static int write_record(FILE *out, const struct LogSlot *slot) {
+  struct LogSite *site = slot->site;
+  if (logger.path == NULL) {
+    char text[1024];
+    log_format(site->fmt, slot->args, slot->len, text, sizeof(text));
+    return log_print_line(out, &slot->when, site->level, site->file,
+                          site->line, text);
+  }
+  int n = 0;
+  if (site->file_gen != logger.file_gen) {
+    site->file_gen = logger.file_gen;
+    n += log_write_site(out, site);
+  }
+  return n + log_write_record(out, site->id, &slot->when, slot->args,
+                              slot->len);
+}
+
+static int ring_empty() {
+  struct LogSlot *slot = &logger.slots[logger.head & (LOG_RING_SLOTS - 1)];
+  return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != logger.head + 1;
+}
+
+// writes every record in the ring, returns how many
+static int drain_ring() {
+  int count = 0;
+  while (!ring_empty()) {
+    struct LogSlot *slot = &logger.slots[logger.head & (LOG_RING_SLOTS - 1)];
+    // with no file left after a failed rotation the records are lost
+    int n = logger.out != NULL ? write_record(logger.out, slot) : 0;
+    logger.written += n > 0 ? n : 0;
+    // free for the producer that laps the ring to this slot
+    __atomic_store_n(&slot->seq, logger.head + LOG_RING_SLOTS,
+                     __ATOMIC_RELEASE);
+    logger.head++;
+    count++;
+  }
+  return count;
+}
+
+static void rotate() {
+  char old_path[512];
+  snprintf(old_path, sizeof(old_path), "%s.1", logger.path);
+  fclose(logger.out);
+  rename(logger.path, old_path);
+  FILE *out = fopen(logger.path, "a");
+  if (out == NULL) {
+    out = fopen(old_path, "a"); // keep going in the file just moved
+  }
+  logger.out = out;
+  logger.file_gen++;
+  logger.written = out != NULL ? log_write_header(out) : 0;
+}
+
+static long long monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *writer_main(void *arg) {
+  (void)arg;
+  long long flush_at_ms = 0; // 0 while everything written is flushed
+  for (;;) {
+    if (drain_ring() > 0 && flush_at_ms == 0) {
+      flush_at_ms = monotonic_ms() + LOG_FLUSH_MS;
+    }
+    if (__atomic_load_n(&logger.stopping, __ATOMIC_ACQUIRE) && ring_empty()) {
+      break;
+    }
+    // a steady stream of records is still flushed every LOG_FLUSH_MS
+    if (flush_at_ms != 0 && monotonic_ms() >= flush_at_ms) {
+      if (logger.out != NULL) {
+        fflush(logger.out);
+      }
+      flush_at_ms = 0;
+      if (logger.path != NULL && logger.written > LOG_ROTATE_BYTES) {
+        rotate();
+      }
+    }
+    // tell producers to wake us, then look once more so a record that
+    // landed before they could see the flag is not left waiting
+    __atomic_store_n(&logger.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!ring_empty()) {
+      __atomic_store_n(&logger.sleeping, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    // with nothing to flush the thread sleeps until the next record
+    int timeout = -1;
+    if (flush_at_ms != 0) {
+      long long left = flush_at_ms - monotonic_ms();
+      timeout = left > 0 ? (int)left : 0;
+    }
+    struct pollfd pfd = {logger.wake_fds[0], POLLIN, 0};
+    if (poll(&pfd, 1, timeout) > 0) {
+      notifier_drain(logger.wake_fds[0]);
+    }
+    __atomic_store_n(&logger.sleeping, 0, __ATOMIC_SEQ_CST);
+  }
+  if (logger.out != NULL) {
+    fflush(logger.out);
+  }
+  return NULL;
+}
+
+int log_start(const char *path) {
+  if (logger.running) {
+    return 0;
+  }
+  // a stream of our own for stderr, so it can be fully buffered
+  logger.out = path != NULL ? fopen(path, "a") : fdopen(dup(STDERR_FILENO), "w");
+  if (logger.out == NULL) {
+    perror(path != NULL ? path : "stderr");
+    return -1;
+  }
+  if (!logger.have_wake_fds) {
+    if (make_notifier(logger.wake_fds) < 0) {
+      fclose(logger.out);
+      return -1;
+    }
+    logger.have_wake_fds = 1;
+  }
+  logger.path = path;
+  logger.file_gen++; // 0 is no file, for sites that never logged
+  logger.written = 0;
+  if (path != NULL) {
+    // appended to the last run's records, whose site ids are not ours
+    fseek(logger.out, 0, SEEK_END);
+    logger.written = ftell(logger.out) + log_write_header(logger.out);
+  }
+  for (uint64_t i = 0; i < LOG_RING_SLOTS; i++) {
+    logger.slots[i].seq = i;
+  }
+  logger.head = logger.tail = 0;
+  logger.stopping = 0;
+
+  // the writer takes no signals, the client counts on seeing SIGWINCH
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int created = pthread_create(&logger.thread, NULL, writer_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (created != 0) {
+    fclose(logger.out);
+    return -1;
+  }
+  __atomic_store_n(&logger.running, 1, __ATOMIC_RELEASE);
+  atexit(log_stop);
+  return 0;
+}
+
+void log_stop(void) {
+  if (!__atomic_exchange_n(&logger.running, 0, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  __atomic_store_n(&logger.stopping, 1, __ATOMIC_RELEASE);
+  notifier_signal(logger.wake_fds[1]);
+  pthread_join(logger.thread, NULL);
+  if (logger.out != NULL) {
+    fclose(logger.out);
+  }
+  logger.out = NULL;
+  if (logger.dropped > 0) {
+    fprintf(stderr, "logger: %llu records dropped\n", logger.dropped);
+  }
+}
+
+// gives the site its id and argument types the first time it logs.
+// Threads that get there meanwhile wait, it is done once per site
+static void register_site(struct LogSite *site) {
+  int state = SITE_NEW;
+  if (__atomic_compare_exchange_n(&site->state, &state, SITE_PARSING, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    log_site_parse(site);
+    site->id = __atomic_fetch_add(&logger.next_site_id, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->state, SITE_READY, __ATOMIC_RELEASE);
+    return;
+  }
+  while (__atomic_load_n(&site->state, __ATOMIC_ACQUIRE) != SITE_READY) {
+  }
+}
+
+void log_record(struct LogSite *site, ...) {
+  va_list args;
+  va_start(args, site);
+  if (!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+    char text[1024];
+    vsnprintf(text, sizeof(text), site->fmt, args);
+    va_end(args);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_print_line(stderr, &now, site->level, site->file, site->line, text);
+    return;
+  }
+  if (__atomic_load_n(&site->state, __ATOMIC_ACQUIRE) != SITE_READY) {
+    register_site(site);
+  }
+
+  // claim a position, a bounded MPSC queue in the style of Vyukov's
+  uint64_t pos = __atomic_load_n(&logger.tail, __ATOMIC_RELAXED);
+  struct LogSlot *slot;
+  for (;;) {
+    slot = &logger.slots[pos & (LOG_RING_SLOTS - 1)];
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)(seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&logger.tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // the writer is a full ring behind, losing the record beats waiting
+      __atomic_fetch_add(&logger.dropped, 1, __ATOMIC_RELAXED);
+      va_end(args);
+      return;
+    } else {
+      pos = __atomic_load_n(&logger.tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->site = site;
+  clock_gettime(CLOCK_REALTIME, &slot->when);
+  slot->len = (uint16_t)log_pack_args(site, args, slot->args,
+                                      sizeof(slot->args));
+  va_end(args);
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+  // one write to the notifier per sleep of the writer, not per record
+  if (__atomic_load_n(&logger.sleeping, __ATOMIC_SEQ_CST) &&
+      __atomic_exchange_n(&logger.sleeping, 0, __ATOMIC_SEQ_CST)) {
+    notifier_signal(logger.wake_fds[1]);
+  }
+}
+
+unsigned long long log_dropped(void) {
+  return __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+}
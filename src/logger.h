@@ -1,7 +1,7 @@
-
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #define LOG_LEVEL_ERROR 0
@@ -13,27 +13,71 @@
 #define LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
-#define LOG_BASE(level, fmt, ...) \
+// A record is the id of the LOG_* call it came from plus its arguments as
+// raw bytes, nothing is formatted where it is logged. Records are queued in
+// a lock-free ring; a background thread started by log_start writes them
+// out in batches, as binary to a log file (read it with --decode-log) or as
+// text to stderr. A full ring drops the record rather than wait, see
+// log_dropped. Before log_start, or after log_stop, records are formatted
+// and go straight to stderr.
+
+#define LOG_RING_SLOTS 1024        // power of two
+#define LOG_ARGS_MAX 200           // argument bytes kept, strings are cut short
+#define LOG_MAX_ARGS 16            // conversions in one format
+#define LOG_FLUSH_MS 200           // written records reach the file by then
+#define LOG_ROTATE_BYTES (4 << 20) // the file moves to <path>.1 past this
+
+// one per LOG_* call, static so it lives as long as the format it points at
+struct LogSite {
+    int level;
+    const char* file;
+    int line;
+    const char* fmt;
+    // filled in the first time the site logs, see log_record
+    int state;
+    uint32_t id;
+    int arg_count;
+    unsigned char args[LOG_MAX_ARGS]; // enum LogArg, see log_format.h
+    unsigned file_gen; // log file whose header the writer put it in
+};
+
+// never called, it only lets the compiler check the arguments against fmt
+static inline void log_check_format(const char* fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+static inline void log_check_format(const char* fmt, ...) { (void)fmt; }
+
+#define LOG_BASE(lvl, format, ...) \
     do { \
-        if (level <= LOG_LEVEL) { \
-            fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
+        if (lvl <= LOG_LEVEL) { \
+            static struct LogSite log_site_ = { \
+                .level = lvl, .file = __FILE__, .line = __LINE__, .fmt = format}; \
+            if (0) \
+                log_check_format(format, ##__VA_ARGS__); \
+            log_record(&log_site_, ##__VA_ARGS__); \
         } \
     } while (0)
 
-#define LOG_ERROR(fmt, ...) \
-    LOG_BASE(LOG_LEVEL_ERROR, "[ERROR] %s:%d: " fmt, \
-             __FILE__, __LINE__, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_BASE(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+#define LOG_WARN(fmt, ...) LOG_BASE(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+
+#define LOG_INFO(fmt, ...) LOG_BASE(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+
+#define LOG_DEBUG(fmt, ...) LOG_BASE(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// starts the writer thread, appending binary records to path or text to
+// stderr when path is NULL. Everything queued is written at exit. -1 on
+// failure
+int log_start(const char* path);
 
-#define LOG_WARN(fmt, ...) \
-    LOG_BASE(LOG_LEVEL_WARN, "[WARN ] %s:%d: " fmt, \
-             __FILE__, __LINE__, ##__VA_ARGS__)
+// writes out what is queued and stops the writer thread
+void log_stop(void);
 
-#define LOG_INFO(fmt, ...) \
-    LOG_BASE(LOG_LEVEL_INFO, "[INFO ] %s:%d: " fmt, \
-             __FILE__, __LINE__, ##__VA_ARGS__)
+// queues one record with the arguments site->fmt asks for. Never blocks on
+// the writer
+void log_record(struct LogSite* site, ...);
 
-#define LOG_DEBUG(fmt, ...) \
-    LOG_BASE(LOG_LEVEL_DEBUG, "[DEBUG] %s:%d: " fmt, \
-             __FILE__, __LINE__, ##__VA_ARGS__)
+// records lost to a full ring since startup
+unsigned long long log_dropped(void);
 
 #endif
@@ -1,6 +1,14 @@
+#define _GNU_SOURCE 1 // struct timespec in log_format.h under -std=c99
 
 #include "client.h" // client functions
+#include "debug.h"  // log file name
+#include "loadgen.h" // synthetic load
+#include "log_format.h" // log decoder
+#include "logger.h" // log writer thread
+#include "metrics.h" // metrics socket
+#include "network.h" // join modes
 #include "server.h" // server functions
+#include "trace.h"  // turn tracing
 #include "uno.h"    // game logic header
 #include <fcntl.h>  // for non-blocking input
 #include <stdio.h>
@@ -13,7 +21,7 @@
 
 static int get_real_player_count(int argc, char *argv[]) {
   int real_players = 4;
-  if (argc > 2) {
+  if (argc > 2 && argv[2][0] != '-') {
     real_players = atoi(argv[2]);
     if (real_players < 1 || real_players > 4) {
       fprintf(stderr, "Invalid real player count: %d (expected 1-4)\n",
@@ -33,28 +41,166 @@ static int get_real_player_count(int argc, char *argv[]) {
   return real_players;
 }
 
+static int has_flag(int argc, char *argv[], const char *name) {
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// value of "--name N" anywhere after the mode flag, or fallback
+static int get_int_option(int argc, char *argv[], const char *name,
+                          int fallback) {
+  for (int i = 2; i < argc - 1; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return atoi(argv[i + 1]);
+    }
+  }
+  return fallback;
+}
+
+// value of "--name TEXT" anywhere after the mode flag, or NULL
+static const char *get_str_option(int argc, char *argv[], const char *name) {
+  for (int i = 2; i < argc - 1; i++) {
+    if (strcmp(argv[i], name) == 0) {
+      return argv[i + 1];
+    }
+  }
+  return NULL;
+}
+
 int main(int argc, char *argv[]) {
+  char shm_path[64];
+  snprintf(shm_path, sizeof(shm_path), SHM_SOCKET_PATH, 5050);
+  char metrics_path[64];
+  snprintf(metrics_path, sizeof(metrics_path), METRICS_SOCKET_PATH, 5050);
+
   if (argc > 1) {
     if (strcmp(argv[1], "--debug") == 0) {
     }
     if (strcmp(argv[1], "--server") == 0) {
-      int clients[4] = {0, 0, 0, 0};
-      int real_players = get_real_player_count(argc, argv);
-      if (real_players < 0) {
+      struct ServerConfig config = {0};
+      config.port = 5050;
+      config.table_players = get_real_player_count(argc, argv);
+      if (config.table_players < 0) {
+        return 1;
+      }
+      config.bot_wait_ms =
+          get_int_option(argc, argv, "--bot-wait", DEFAULT_BOT_WAIT_MS);
+      config.private_wait_ms = get_int_option(argc, argv, "--private-wait",
+                                              DEFAULT_PRIVATE_WAIT_MS);
+      config.turn_timeout_ms = get_int_option(argc, argv, "--turn-timeout",
+                                              DEFAULT_TURN_TIMEOUT_MS);
+      config.bot_delay_ms =
+          get_int_option(argc, argv, "--bot-delay", DEFAULT_BOT_DELAY_MS);
+      config.resume_grace_ms = get_int_option(argc, argv, "--resume-grace",
+                                              DEFAULT_RESUME_GRACE_MS);
+      config.ping_interval_ms = get_int_option(argc, argv, "--ping-interval",
+                                               DEFAULT_PING_INTERVAL_MS);
+      config.shm_path = shm_path;
+      config.metrics_path = metrics_path;
+      config.local_fd = -1;
+      log_start(NULL); // no screen to draw over, the console gets the log
+      const char *trace_path = get_str_option(argc, argv, "--trace");
+      if (trace_path != NULL &&
+          trace_open(trace_path,
+                     get_int_option(argc, argv, "--trace-sample", 1)) < 0) {
         return 1;
       }
-      int server_fd = start_game_server(5050, clients, real_players);
-      if (server_fd < 0) {
+      int status = run_lobby_server(&config);
+      trace_close();
+      if (status < 0) {
         fprintf(stderr, "Failed to start server\n");
         return 1;
       }
-      run_server(clients, server_fd, real_players);
-      close_game_server(clients, 0, server_fd);
       return 0;
     }
-    if (strcmp(argv[1], "--client") == 0) {
-      ClientGameDetails *details = connect_to_server("127.0.0.1", 5050);
+    if (strcmp(argv[1], "--solo") == 0) {
+      // one player against bots, the server runs on a thread of this process
+      struct ServerConfig config = {0};
+      config.table_players = 1;
+      config.private_wait_ms = DEFAULT_PRIVATE_WAIT_MS;
+      config.turn_timeout_ms = get_int_option(argc, argv, "--turn-timeout",
+                                              DEFAULT_TURN_TIMEOUT_MS);
+      config.bot_delay_ms =
+          get_int_option(argc, argv, "--bot-delay", DEFAULT_BOT_DELAY_MS);
+      config.resume_grace_ms = DEFAULT_RESUME_GRACE_MS;
+      config.ping_interval_ms = DEFAULT_PING_INTERVAL_MS;
+      config.local_fd = -1;
+      log_start(LOG_FILE_NAME); // stderr would land on the game screen
+      ClientGameDetails *details = connect_in_process(
+          start_embedded_server(&config), JOIN_QUICK_MATCH, NULL);
+      if (details->server_sock < 0) {
+        free(details);
+        return 1;
+      }
+      details->record_path = get_str_option(argc, argv, "--record");
+      run_client(*details);
+      free(details);
+      return 0;
+    }
+    if (strcmp(argv[1], "--decode-log") == 0) {
+      // the binary log the client commands write, as text
+      const char *path = argc > 2 ? argv[2] : LOG_FILE_NAME;
+      FILE *in = fopen(path, "rb");
+      if (in == NULL) {
+        perror(path);
+        return 1;
+      }
+      int status = log_decode(in, stdout);
+      fclose(in);
+      return status < 0 ? 1 : 0;
+    }
+    if (strcmp(argv[1], "--metrics") == 0) {
+      // a running server's counters and latency percentiles
+      return metrics_fetch(metrics_path, STDOUT_FILENO) < 0 ? 1 : 0;
+    }
+    if (strcmp(argv[1], "--loadgen") == 0) {
+      // headless bots hammering a running server's quick match queue
+      struct LoadgenConfig config = {0};
+      config.ip = "127.0.0.1";
+      config.port = 5050;
+      config.clients = argc > 2 && argv[2][0] != '-' ? atoi(argv[2])
+                                                     : DEFAULT_LOADGEN_CLIENTS;
+      if (config.clients <= 0) {
+        fprintf(stderr, "Invalid client count: %s\n", argv[2]);
+        return 1;
+      }
+      config.think_ms =
+          get_int_option(argc, argv, "--think", DEFAULT_LOADGEN_THINK_MS);
+      config.duration_s = get_int_option(argc, argv, "--duration",
+                                         DEFAULT_LOADGEN_DURATION_S);
+      log_start(NULL);
+      return run_loadgen(&config) < 0 ? 1 : 0;
+    }
+    if (strcmp(argv[1], "--client") == 0 || strcmp(argv[1], "--watch") == 0) {
+      // no code joins the quick match queue, "new" opens a private table
+      const char *game_code = argc > 2 && argv[2][0] != '-' ? argv[2] : NULL;
+      uint8_t join_mode = JOIN_QUICK_MATCH;
+      if (strcmp(argv[1], "--watch") == 0) {
+        join_mode = JOIN_SPECTATE;
+      } else if (game_code != NULL && strcmp(game_code, "new") == 0) {
+        join_mode = JOIN_CREATE_PRIVATE;
+        game_code = NULL;
+      } else if (game_code != NULL) {
+        join_mode = JOIN_PRIVATE;
+      }
+      log_start(LOG_FILE_NAME);
+      ClientGameDetails *details;
+      if (has_flag(argc, argv, "--shm")) {
+        details = connect_to_local_server(shm_path, join_mode, game_code);
+      } else {
+        details = connect_to_server("127.0.0.1", 5050, join_mode, game_code);
+      }
+      if (details->server_sock < 0) {
+        free(details);
+        return 1;
+      }
+      details->record_path = get_str_option(argc, argv, "--record");
       run_client(*details);
+      free(details);
       return 0;
     }
   }
@@ -0,0 +1,299 @@
+#include "metrics.h"
+#include "histogram.h"
+#include "network.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// only the owning thread writes a shard, with relaxed stores so a reader
+// summing it sees whole values. Shards outlive their threads, what a
+// finished thread counted stays in the totals
+struct MetricShard {
+  uint64_t counters[METRIC_COUNTER_COUNT];
+  int64_t gauges[METRIC_GAUGE_COUNT];
+  struct Histogram histograms[METRIC_HISTOGRAM_COUNT];
+  struct MetricShard *next;
+};
+
+static const char *counter_names[METRIC_COUNTER_COUNT] = {
+    [METRIC_CONNECTIONS_ACCEPTED] = "uno_connections_accepted_total",
+    [METRIC_TABLES_OPENED] = "uno_tables_opened_total",
+    [METRIC_GAMES_FINISHED] = "uno_games_finished_total",
+    [METRIC_TURNS] = "uno_turns_total",
+    [METRIC_PACKETS_IN] = "uno_packets_in_total",
+    [METRIC_PACKETS_OUT] = "uno_packets_out_total",
+    [METRIC_BYTES_IN] = "uno_bytes_in_total",
+    [METRIC_BYTES_OUT] = "uno_bytes_out_total",
+    [METRIC_ERRORS_SENT] = "uno_errors_sent_total",
+    [METRIC_READ_ERROR_RECV_LEN] = "uno_read_errors_total{error=\"recv_len\"}",
+    [METRIC_READ_ERROR_INVALID_PAYLOAD_SIZE] =
+        "uno_read_errors_total{error=\"invalid_payload_size\"}",
+    [METRIC_READ_ERROR_MALLOC] = "uno_read_errors_total{error=\"malloc\"}",
+    [METRIC_READ_ERROR_RECV_PAYLOAD] =
+        "uno_read_errors_total{error=\"recv_payload\"}",
+    [METRIC_READ_ERROR_DESERIALIZE] =
+        "uno_read_errors_total{error=\"deserialize\"}",
+};
+
+static const char *gauge_names[METRIC_GAUGE_COUNT] = {
+    [METRIC_CONNECTIONS_ACTIVE] = "uno_connections_active",
+    [METRIC_TABLES_ACTIVE] = "uno_tables_active",
+};
+
+static const char *histogram_names[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_TURN_US] = "uno_turn_us",
+    [METRIC_ACTION_TO_BROADCAST_US] = "uno_action_to_broadcast_us",
+    [METRIC_PACKET_IN_BYTES] = "uno_packet_in_bytes",
+    [METRIC_PACKET_OUT_BYTES] = "uno_packet_out_bytes",
+};
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct MetricShard *shards;
+static __thread struct MetricShard *local_shard;
+
+static struct MetricShard *shard() {
+  if (local_shard == NULL) {
+    struct MetricShard *created = calloc(1, sizeof(struct MetricShard));
+    if (created == NULL) {
+      return NULL; // this thread goes uncounted
+    }
+    pthread_mutex_lock(&shards_lock);
+    created->next = shards;
+    shards = created;
+    pthread_mutex_unlock(&shards_lock);
+    local_shard = created;
+  }
+  return local_shard;
+}
+
+// the owner is the only writer, its own plain reads are never stale
+static void bump32(uint32_t *slot, uint32_t value) {
+  __atomic_store_n(slot, *slot + value, __ATOMIC_RELAXED);
+}
+
+static void bump64(uint64_t *slot, uint64_t value) {
+  __atomic_store_n(slot, *slot + value, __ATOMIC_RELAXED);
+}
+
+void metric_add(enum MetricCounter counter, uint64_t value) {
+  struct MetricShard *own = shard();
+  if (own != NULL) {
+    bump64(&own->counters[counter], value);
+  }
+}
+
+void metric_gauge_add(enum MetricGauge gauge, int64_t delta) {
+  struct MetricShard *own = shard();
+  if (own != NULL) {
+    __atomic_store_n(&own->gauges[gauge], own->gauges[gauge] + delta,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+void metric_record(enum MetricHistogram histogram, uint64_t value) {
+  struct MetricShard *own = shard();
+  if (own == NULL) {
+    return;
+  }
+  struct Histogram *hist = &own->histograms[histogram];
+  bump32(&hist->buckets[histogram_bucket(value)], 1);
+  bump64(&hist->count, 1);
+  bump64(&hist->sum, value);
+  if (value > hist->max) {
+    __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+  }
+}
+
+void metric_read_error(int result) {
+  switch (result) {
+  case READ_ERROR_RECV_LEN:
+    metric_add(METRIC_READ_ERROR_RECV_LEN, 1);
+    break;
+  case READ_ERROR_INVALID_PAYLOAD_SIZE:
+    metric_add(METRIC_READ_ERROR_INVALID_PAYLOAD_SIZE, 1);
+    break;
+  case READ_ERROR_MALLOC:
+    metric_add(METRIC_READ_ERROR_MALLOC, 1);
+    break;
+  case READ_ERROR_RECV_PAYLOAD:
+    metric_add(METRIC_READ_ERROR_RECV_PAYLOAD, 1);
+    break;
+  case READ_ERROR_DESERIALIZE:
+    metric_add(METRIC_READ_ERROR_DESERIALIZE, 1);
+    break;
+  }
+}
+
+// adds a shard another thread may be writing to into a private copy
+static void merge_histogram(struct Histogram *into,
+                            const struct Histogram *from) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    into->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+  }
+  into->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+  into->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+  if (max > into->max) {
+    into->max = max;
+  }
+}
+
+// snprintf that stops appending once out is full
+static size_t append(char *out, size_t size, size_t len, const char *format,
+                     ...) __attribute__((format(printf, 4, 5)));
+
+static size_t append(char *out, size_t size, size_t len, const char *format,
+                     ...) {
+  if (len >= size) {
+    return len;
+  }
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(out + len, size - len, format, args);
+  va_end(args);
+  if (n < 0) {
+    return len;
+  }
+  return len + (size_t)n < size ? len + (size_t)n : size - 1;
+}
+
+size_t metrics_format(char *out, size_t size) {
+  static const double quantiles[] = {50, 90, 99};
+  uint64_t counters[METRIC_COUNTER_COUNT] = {0};
+  int64_t gauges[METRIC_GAUGE_COUNT] = {0};
+  struct Histogram *histograms =
+      calloc(METRIC_HISTOGRAM_COUNT, sizeof(struct Histogram));
+  if (histograms == NULL || size == 0) {
+    free(histograms);
+    return 0;
+  }
+  int threads = 0;
+  pthread_mutex_lock(&shards_lock);
+  for (struct MetricShard *s = shards; s != NULL; s = s->next) {
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+      counters[i] += __atomic_load_n(&s->counters[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+      gauges[i] += __atomic_load_n(&s->gauges[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+      merge_histogram(&histograms[i], &s->histograms[i]);
+    }
+    threads++;
+  }
+  pthread_mutex_unlock(&shards_lock);
+
+  size_t len = 0;
+  out[0] = '\0';
+  len = append(out, size, len, "# summed over %d threads\n", threads);
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    len = append(out, size, len, "%s %llu\n", counter_names[i],
+                 (unsigned long long)counters[i]);
+  }
+  for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+    len = append(out, size, len, "%s %lld\n", gauge_names[i],
+                 (long long)gauges[i]);
+  }
+  for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+    const struct Histogram *hist = &histograms[i];
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+      len = append(out, size, len, "%s{quantile=\"%g\"} %llu\n",
+                   histogram_names[i], quantiles[q] / 100,
+                   (unsigned long long)histogram_percentile(hist,
+                                                            quantiles[q]));
+    }
+    len = append(out, size, len, "%s_max %llu\n%s_sum %llu\n%s_count %llu\n",
+                 histogram_names[i], (unsigned long long)hist->max,
+                 histogram_names[i], (unsigned long long)hist->sum,
+                 histogram_names[i], (unsigned long long)hist->count);
+  }
+  free(histograms);
+  return len;
+}
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+int metrics_listen(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) < 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  unlink(path); // stale socket from an earlier run
+  // a scraper that gives up between poll() and accept() must not stall us
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void metrics_serve(int listen_fd) {
+  int sock = accept(listen_fd, NULL, NULL);
+  if (sock < 0) {
+    return;
+  }
+  char *text = malloc(METRICS_TEXT_SIZE);
+  if (text != NULL) {
+    size_t len = metrics_format(text, METRICS_TEXT_SIZE);
+    // far less than a unix socket buffers, what does not fit is dropped
+    ssize_t sent = send(sock, text, len, MSG_DONTWAIT);
+    (void)sent;
+    free(text);
+  }
+  close(sock);
+}
+
+int metrics_fetch(const char *path, int out_fd) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) < 0) {
+    return -1;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror(path);
+    close(sock);
+    return -1;
+  }
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(sock, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (write(out_fd, buf, n) != n) {
+      break;
+    }
+  }
+  close(sock);
+  return n == 0 ? 0 : -1;
+}
@@ -0,0 +1,72 @@
+#ifndef UNO_METRICS_H
+#define UNO_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Process-wide counters, gauges and histograms. Every thread updates its
+// own shard with plain single-writer stores, nothing is shared on the hot
+// path; metrics_format sums the shards of every thread that ever recorded
+// something when it is asked. The server serves that text on a unix socket
+// at METRICS_SOCKET_PATH, one snapshot per connection.
+
+#define METRICS_SOCKET_PATH "/tmp/uno-%d-metrics.sock" // with the TCP port
+#define METRICS_TEXT_SIZE (16 * 1024) // fits every metric with room to spare
+
+enum MetricCounter {
+  METRIC_CONNECTIONS_ACCEPTED,
+  METRIC_TABLES_OPENED,
+  METRIC_GAMES_FINISHED,
+  METRIC_TURNS,
+  METRIC_PACKETS_IN,
+  METRIC_PACKETS_OUT,
+  METRIC_BYTES_IN,
+  METRIC_BYTES_OUT,
+  METRIC_ERRORS_SENT, // MSG_ERROR packets queued to clients
+  // read_packet failures by enum PacketReadError, see metric_read_error
+  METRIC_READ_ERROR_RECV_LEN,
+  METRIC_READ_ERROR_INVALID_PAYLOAD_SIZE,
+  METRIC_READ_ERROR_MALLOC,
+  METRIC_READ_ERROR_RECV_PAYLOAD,
+  METRIC_READ_ERROR_DESERIALIZE,
+  METRIC_COUNTER_COUNT
+};
+
+// gauges go up and down, each thread keeps its share of the change
+enum MetricGauge {
+  METRIC_CONNECTIONS_ACTIVE,
+  METRIC_TABLES_ACTIVE,
+  METRIC_GAUGE_COUNT
+};
+
+enum MetricHistogram {
+  METRIC_TURN_US,               // a move, bot move or timeout handled
+  METRIC_ACTION_TO_BROADCAST_US, // a player's action read to its broadcast
+  METRIC_PACKET_IN_BYTES,
+  METRIC_PACKET_OUT_BYTES,
+  METRIC_HISTOGRAM_COUNT
+};
+
+void metric_add(enum MetricCounter counter, uint64_t value);
+
+void metric_gauge_add(enum MetricGauge gauge, int64_t delta);
+
+void metric_record(enum MetricHistogram histogram, uint64_t value);
+
+// counts a read_packet result other than READ_OK
+void metric_read_error(int result);
+
+// every metric as "name value" lines, returns the length written
+size_t metrics_format(char *out, size_t size);
+
+// unix socket at path for metrics_serve, -1 if it cannot be bound
+int metrics_listen(const char *path);
+
+// answers one connection waiting on listen_fd with metrics_format's text
+// and hangs up, never blocks on a reader that does not read
+void metrics_serve(int listen_fd);
+
+// connects to a server's metrics socket and copies what it sends to out
+int metrics_fetch(const char *path, int out_fd);
+
+#endif // UNO_METRICS_H
@@ -1,5 +1,9 @@
 
 #include "network.h"
+#include "local.h"
+#include "metrics.h"
+#include "shm.h"
+#include "trace.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -8,6 +12,8 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/resource.h>
 
 int set_socket_timeout(int fd, int seconds) {
     struct timeval tv;
@@ -83,12 +89,16 @@ int serialize_packet(struct Packet* packet, void* buffer) {
 
     switch (packet->type) {
         case MSG_WELCOME:
-            offset += write_bytes(&packet->data.player_id, buffer + offset, sizeof(packet->data.player_id));
+            offset += write_bytes(&packet->data.welcome.player_id, buffer + offset, sizeof(packet->data.welcome.player_id));
+            offset += write_bytes(&packet->data.welcome.session, buffer + offset, sizeof(packet->data.welcome.session));
             break;
         case MSG_WAITING_FOR_PLAYERS:
-            offset += write_bytes(&packet->data.num_players, buffer + offset, sizeof(packet->data.num_players));
+            offset += write_bytes(&packet->data.lobby.num_players, buffer + offset, sizeof(packet->data.lobby.num_players));
+            offset += write_bytes(&packet->data.lobby.seats, buffer + offset, sizeof(packet->data.lobby.seats));
+            offset += write_bytes(packet->data.lobby.code, buffer + offset, sizeof(packet->data.lobby.code));
             break;
         case MSG_STATE:
+            offset += write_bytes(&packet->data.game_state.seq, buffer + offset, sizeof(packet->data.game_state.seq));
             offset += write_bytes(&packet->data.game_state.current_player_id, buffer + offset, sizeof(packet->data.game_state.current_player_id));
             offset += write_bytes(packet->data.game_state.player_hand_sizes, buffer + offset, sizeof(packet->data.game_state.player_hand_sizes));
             offset += write_bytes(&packet->data.game_state.direction, buffer + offset, sizeof(packet->data.game_state.direction));
@@ -111,6 +121,18 @@ int serialize_packet(struct Packet* packet, void* buffer) {
         case MSG_ERROR:
             offset += write_bytes(&packet->data.error_code, buffer + offset, sizeof(packet->data.error_code));
             break;
+        case MSG_JOIN:
+            offset += write_bytes(&packet->data.join.mode, buffer + offset, sizeof(packet->data.join.mode));
+            offset += write_bytes(packet->data.join.code, buffer + offset, sizeof(packet->data.join.code));
+            offset += write_bytes(&packet->data.join.session, buffer + offset, sizeof(packet->data.join.session));
+            offset += write_bytes(&packet->data.join.last_seq, buffer + offset, sizeof(packet->data.join.last_seq));
+            break;
+        case MSG_PING:
+        case MSG_PONG:
+            offset += write_bytes(&packet->data.ping.id, buffer + offset, sizeof(packet->data.ping.id));
+            offset += write_bytes(&packet->data.ping.sent_us, buffer + offset, sizeof(packet->data.ping.sent_us));
+            offset += write_bytes(&packet->data.ping.interval_ms, buffer + offset, sizeof(packet->data.ping.interval_ms));
+            break;
     }
 
     return offset;
@@ -126,12 +148,17 @@ struct Packet* deserialize_packet(char* buffer, size_t buffer_size) {
 
     switch (packet->type) {
         case MSG_WELCOME:
-            offset += read_bytes(buffer + offset, &packet->data.player_id, sizeof(packet->data.player_id));
+            offset += read_bytes(buffer + offset, &packet->data.welcome.player_id, sizeof(packet->data.welcome.player_id));
+            offset += read_bytes(buffer + offset, &packet->data.welcome.session, sizeof(packet->data.welcome.session));
             break;
         case MSG_WAITING_FOR_PLAYERS:
-            offset += read_bytes(buffer + offset, &packet->data.num_players, sizeof(packet->data.num_players));
+            offset += read_bytes(buffer + offset, &packet->data.lobby.num_players, sizeof(packet->data.lobby.num_players));
+            offset += read_bytes(buffer + offset, &packet->data.lobby.seats, sizeof(packet->data.lobby.seats));
+            offset += read_bytes(buffer + offset, packet->data.lobby.code, sizeof(packet->data.lobby.code));
+            packet->data.lobby.code[GAME_CODE_LEN] = '\0';
             break;
         case MSG_STATE:
+            offset += read_bytes(buffer + offset, &packet->data.game_state.seq, sizeof(packet->data.game_state.seq));
             offset += read_bytes(buffer + offset, &packet->data.game_state.current_player_id, sizeof(packet->data.game_state.current_player_id));
             offset += read_bytes(buffer + offset, packet->data.game_state.player_hand_sizes, sizeof(packet->data.game_state.player_hand_sizes));
             offset += read_bytes(buffer + offset, &packet->data.game_state.direction, sizeof(packet->data.game_state.direction));
@@ -141,6 +168,9 @@ struct Packet* deserialize_packet(char* buffer, size_t buffer_size) {
         case MSG_HAND:
             offset += read_bytes(buffer + offset, &packet->data.player_hand.player_id, sizeof(packet->data.player_hand.player_id));
             offset += read_bytes(buffer + offset, &packet->data.player_hand.num_cards, sizeof(packet->data.player_hand.num_cards));
+            if (packet->data.player_hand.num_cards > MAX_HAND_SIZE) {
+                packet->data.player_hand.num_cards = MAX_HAND_SIZE;
+            }
             for (int i = 0; i < packet->data.player_hand.num_cards; i++) {
                 offset += deserialize_card_details(buffer + offset, &packet->data.player_hand.cards[i]);
             }
@@ -154,6 +184,19 @@ struct Packet* deserialize_packet(char* buffer, size_t buffer_size) {
         case MSG_ERROR:
             offset += read_bytes(buffer + offset, &packet->data.error_code, sizeof(packet->data.error_code));
             break;
+        case MSG_JOIN:
+            offset += read_bytes(buffer + offset, &packet->data.join.mode, sizeof(packet->data.join.mode));
+            offset += read_bytes(buffer + offset, packet->data.join.code, sizeof(packet->data.join.code));
+            packet->data.join.code[GAME_CODE_LEN] = '\0';
+            offset += read_bytes(buffer + offset, &packet->data.join.session, sizeof(packet->data.join.session));
+            offset += read_bytes(buffer + offset, &packet->data.join.last_seq, sizeof(packet->data.join.last_seq));
+            break;
+        case MSG_PING:
+        case MSG_PONG:
+            offset += read_bytes(buffer + offset, &packet->data.ping.id, sizeof(packet->data.ping.id));
+            offset += read_bytes(buffer + offset, &packet->data.ping.sent_us, sizeof(packet->data.ping.sent_us));
+            offset += read_bytes(buffer + offset, &packet->data.ping.interval_ms, sizeof(packet->data.ping.interval_ms));
+            break;
     }
 
     return packet;
@@ -185,7 +228,7 @@ int setup_server(uint16_t port){
         return -1;
     }
 
-    if (listen(server_fd, 4)) {
+    if (listen(server_fd, SOMAXCONN)) {
         perror("listen");
         return -1;
     }
@@ -210,6 +253,19 @@ int send_all(int fd, const void* buffer, size_t length) {
     size_t total = 0;
     const char* buf = buffer;
 
+    struct ShmChannel* channel = shm_channel(fd);
+    if (channel) {
+        // rings take whole frames, wait for the reader to make room
+        for (;;) {
+            ssize_t n = shm_send(channel, buffer, length);
+            if (n < 0)
+                return -1;
+            if (n > 0)
+                return 0;
+            shm_wait(channel, length);
+        }
+    }
+
     while (total < length) {
         ssize_t n = send(fd, buf + total, length - total, 0);
         if (n <= 0)
@@ -223,6 +279,19 @@ int recv_all(int fd, void* buffer, size_t length) {
     size_t total = 0;
     char* buf = buffer;
 
+    struct ShmChannel* channel = shm_channel(fd);
+    if (channel) {
+        while (total < length) {
+            ssize_t n = shm_recv(channel, buf + total, length - total);
+            if (n < 0)
+                return -1;
+            if (n == 0)
+                shm_wait(channel, 0);
+            total += n;
+        }
+        return 0;
+    }
+
     while (total < length) {
         ssize_t n = recv(fd, buf + total, length - total, 0);
         if (n <= 0)
@@ -233,22 +302,176 @@ int recv_all(int fd, void* buffer, size_t length) {
 }
 
 int send_packet(int client_fd, struct Packet* packet) {
-    uint8_t payload[MAX_PACKET_SIZE];
-    size_t payload_size = serialize_packet(packet, payload);
+    struct LocalChannel* local = local_channel(client_fd);
+    if (local) {
+        // in-process peers take the struct as is
+        for (;;) {
+            int n = local_send(local, packet);
+            if (n != 0)
+                return n < 0 ? -1 : 0;
+            local_wait(local);
+        }
+    }
+
+    // length and payload go out in one send so Nagle never holds the payload
+    uint8_t frame[sizeof(uint32_t) + MAX_PACKET_SIZE];
+    size_t payload_size = serialize_packet(packet, frame + sizeof(uint32_t));
 
     uint32_t len = htonl(payload_size);
+    memcpy(frame, &len, sizeof(len));
+
+    return send_all(client_fd, frame, sizeof(len) + payload_size);
+}
+
+struct SharedBuf* share_packet(struct Packet* packet) {
+    struct SharedBuf* buf = malloc(sizeof(struct SharedBuf));
+    if (!buf)
+        return NULL;
+    buf->refs = 1;
+    buf->packet = *packet;
+    buf->len = 0;
+    buf->data = NULL;
+    return buf;
+}
+
+int shared_buf_encode(struct SharedBuf* buf) {
+    if (buf->data)
+        return 0;
+    long long span = trace_begin();
+    uint8_t payload[MAX_PACKET_SIZE];
+    size_t payload_size = serialize_packet(&buf->packet, payload);
 
-    if (send_all(client_fd, &len, sizeof(len)) < 0)
+    buf->data = malloc(sizeof(uint32_t) + payload_size);
+    if (!buf->data)
         return -1;
+    buf->len = sizeof(uint32_t) + payload_size;
 
-    if (send_all(client_fd, payload, payload_size) < 0)
+    uint32_t len = htonl(payload_size);
+    memcpy(buf->data, &len, sizeof(len));
+    memcpy(buf->data + sizeof(len), payload, payload_size);
+    trace_end("serialize", span);
+    return 0;
+}
+
+struct SharedBuf* shared_buf_ref(struct SharedBuf* buf) {
+    buf->refs++;
+    return buf;
+}
+
+void shared_buf_unref(struct SharedBuf* buf) {
+    if (buf && --buf->refs == 0) {
+        free(buf->data);
+        free(buf);
+    }
+}
+
+// state, hand and lobby updates each carry the whole picture, a newer one
+// makes an older one nobody has read yet pointless
+static int is_snapshot(uint8_t type) {
+    return type == MSG_STATE || type == MSG_HAND || type == MSG_WAITING_FOR_PLAYERS;
+}
+
+int out_queue_push(struct OutQueue* queue, struct SharedBuf* buf) {
+    if (buf == NULL) {
         return -1;
+    }
+    if (is_snapshot(buf->packet.type)) {
+        // a client that is behind gets the newest snapshot in the place of
+        // the stale one, the head frame may already be partly written
+        int first = queue->offset > 0 ? 1 : 0;
+        for (int i = first; i < queue->count; i++) {
+            int index = (queue->head + i) % OUT_QUEUE_SIZE;
+            if (queue->bufs[index]->packet.type == buf->packet.type) {
+                shared_buf_unref(queue->bufs[index]);
+                queue->bufs[index] = shared_buf_ref(buf);
+                queue->coalesced++;
+                return 0;
+            }
+        }
+    }
+    if (queue->count >= OUT_QUEUE_SIZE) {
+        return -1;
+    }
+    int tail = (queue->head + queue->count) % OUT_QUEUE_SIZE;
+    queue->bufs[tail] = shared_buf_ref(buf);
+    queue->count++;
+    return 0;
+}
 
+int out_queue_flush(int fd, struct OutQueue* queue) {
+    struct ShmChannel* channel = shm_channel(fd);
+    struct LocalChannel* local = local_channel(fd);
+    while (queue->count > 0) {
+        struct SharedBuf* buf = queue->bufs[queue->head];
+        ssize_t n;
+        if (local) {
+            n = local_send(local, &buf->packet);
+            if (n == 0)
+                return 1; // queue full, the reader wakes us when it drains
+            if (n < 0)
+                return -1;
+            shared_buf_unref(buf);
+            queue->head = (queue->head + 1) % OUT_QUEUE_SIZE;
+            queue->count--;
+            metric_add(METRIC_PACKETS_OUT, 1); // never serialized, no bytes
+            continue;
+        }
+        if (shared_buf_encode(buf) < 0)
+            return -1;
+        if (channel) {
+            n = shm_send(channel, buf->data, buf->len);
+            if (n == 0)
+                return 1; // ring full, the reader wakes us when it drains
+        } else {
+            // never block the server on one slow reader
+            n = send(fd, buf->data + queue->offset, buf->len - queue->offset, MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 1;
+        }
+        if (n <= 0)
+            return -1;
+        queue->offset += n;
+        if (queue->offset < buf->len)
+            continue;
+
+        metric_add(METRIC_PACKETS_OUT, 1);
+        metric_add(METRIC_BYTES_OUT, buf->len);
+        metric_record(METRIC_PACKET_OUT_BYTES, buf->len);
+        shared_buf_unref(buf);
+        queue->head = (queue->head + 1) % OUT_QUEUE_SIZE;
+        queue->count--;
+        queue->offset = 0;
+    }
     return 0;
 }
 
+void out_queue_clear(struct OutQueue* queue) {
+    while (queue->count > 0) {
+        shared_buf_unref(queue->bufs[queue->head]);
+        queue->head = (queue->head + 1) % OUT_QUEUE_SIZE;
+        queue->count--;
+    }
+    queue->head = 0;
+    queue->offset = 0;
+    queue->coalesced = 0;
+}
+
 int read_packet(int client_fd, struct Packet** packet) {
     uint32_t net_len;
+
+    struct LocalChannel* local = local_channel(client_fd);
+    if (local) {
+        for (;;) {
+            int n = local_recv(local, packet);
+            if (n > 0) {
+                metric_add(METRIC_PACKETS_IN, 1);
+                return READ_OK;
+            }
+            if (n < 0)
+                return READ_ERROR_RECV_LEN;
+            local_wait(local);
+        }
+    }
     
     // Step 1: Read length
     if (recv_all(client_fd, &net_len, sizeof(net_len)) < 0)
@@ -259,7 +482,9 @@ int read_packet(int client_fd, struct Packet** packet) {
     if (payload_size > MAX_PACKET_SIZE)   // sanity check
         return READ_ERROR_INVALID_PAYLOAD_SIZE;
 
-    char* buffer = malloc(payload_size);
+    // sized for the largest packet so a short payload reads as zeros
+    // instead of past the end
+    char* buffer = calloc(1, MAX_PACKET_SIZE);
     if (!buffer)
         return READ_ERROR_MALLOC;
 
@@ -269,6 +494,10 @@ int read_packet(int client_fd, struct Packet** packet) {
         return READ_ERROR_RECV_PAYLOAD;
     }
 
+    metric_add(METRIC_PACKETS_IN, 1);
+    metric_add(METRIC_BYTES_IN, sizeof(net_len) + payload_size);
+    metric_record(METRIC_PACKET_IN_BYTES, sizeof(net_len) + payload_size);
+
     // Step 3: Deserialize
     *packet = deserialize_packet(buffer, payload_size);
 
@@ -276,6 +505,60 @@ int read_packet(int client_fd, struct Packet** packet) {
     return *packet ? READ_OK : READ_ERROR_DESERIALIZE;
 }
 
+int in_buf_fill(int fd, struct InBuf* in) {
+    size_t room = sizeof(in->data) - in->len;
+    if (room == 0)
+        return 0; // in_buf_next has a frame to hand out first
+    ssize_t n = recv(fd, in->data + in->len, room, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (n <= 0)
+        return -1;
+    in->len += n;
+    return n;
+}
+
+int in_buf_next(struct InBuf* in, struct Packet** packet) {
+    uint32_t net_len;
+    if (in->len < sizeof(net_len))
+        return 0;
+    memcpy(&net_len, in->data, sizeof(net_len));
+    uint32_t payload_size = ntohl(net_len);
+    if (payload_size > MAX_PACKET_SIZE)
+        return READ_ERROR_INVALID_PAYLOAD_SIZE;
+    uint32_t frame_size = sizeof(net_len) + payload_size;
+    if (in->len < frame_size)
+        return 0;
+
+    // same zero padding as read_packet
+    char* buffer = calloc(1, MAX_PACKET_SIZE);
+    if (!buffer)
+        return READ_ERROR_MALLOC;
+    memcpy(buffer, in->data + sizeof(net_len), payload_size);
+    *packet = deserialize_packet(buffer, payload_size);
+    free(buffer);
+
+    metric_add(METRIC_PACKETS_IN, 1);
+    metric_add(METRIC_BYTES_IN, frame_size);
+    metric_record(METRIC_PACKET_IN_BYTES, frame_size);
+
+    memmove(in->data, in->data + frame_size, in->len - frame_size);
+    in->len -= frame_size;
+    return *packet ? 1 : READ_ERROR_DESERIALIZE;
+}
+
+int raise_fd_limit(int wanted) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return -1;
+    if (limit.rlim_cur < (rlim_t)wanted) {
+        limit.rlim_cur = (rlim_t)wanted < limit.rlim_max ? (rlim_t)wanted : limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return (int)limit.rlim_cur;
+}
+
 int send_player_hand(int client_fd, uint8_t player_id){
 
     Hand* hand = get_player_hand(player_id);
@@ -285,7 +568,7 @@ int send_player_hand(int client_fd, uint8_t player_id){
         return -1;
     }
 
-    int count = hand->card_count;
+    int count = hand->card_count < MAX_HAND_SIZE ? hand->card_count : MAX_HAND_SIZE;
 
     struct Packet packet = {0};
 
@@ -302,3 +585,29 @@ int send_player_hand(int client_fd, uint8_t player_id){
 void close_server(int server_fd) {
     close(server_fd);
 }
+
+int packet_ready(int fd) {
+    struct LocalChannel* local = local_channel(fd);
+    if (local)
+        return local_packet_ready(local);
+    struct ShmChannel* channel = shm_channel(fd);
+    if (channel)
+        return shm_frame_ready(channel);
+    return 1;
+}
+
+short connection_poll_events(int fd, int has_output) {
+    // channels signal free space on their wake fd, only sockets need POLLOUT
+    if (has_output && !local_channel(fd) && !shm_channel(fd))
+        return POLLIN | POLLOUT;
+    return POLLIN;
+}
+
+void close_connection(int fd) {
+    if (local_channel(fd))
+        local_close(fd);
+    else if (shm_channel(fd))
+        shm_close(fd);
+    else
+        close(fd);
+}
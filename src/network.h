@@ -7,7 +7,10 @@
 
 #define MAX_HAND_SIZE 50
 #define MAX_PLAYERS 4
-#define MAX_PACKET_SIZE 1024
+#define MAX_PACKET_SIZE 2048 // fits a MSG_HAND with MAX_HAND_SIZE cards
+#define GAME_CODE_LEN 6
+#define SPECTATOR_ID 0xFF // player_id in MSG_WELCOME for watchers
+#define PING_MISSES 3 // silent ping intervals before a peer counts as dead
 
 typedef enum {
     MSG_WELCOME,
@@ -16,9 +19,20 @@ typedef enum {
     MSG_HAND,
     MSG_ACTION,
     MSG_GAME_OVER,
-    MSG_ERROR
+    MSG_ERROR,
+    MSG_JOIN,
+    MSG_PING,
+    MSG_PONG
 } MsgType;
 
+enum JoinMode {
+    JOIN_QUICK_MATCH = 0, // take the next free seat from the lobby queue
+    JOIN_CREATE_PRIVATE = 1, // open a private table, server replies with its code
+    JOIN_PRIVATE = 2, // join a private table by code
+    JOIN_SPECTATE = 3, // watch a table by code, any running table if empty
+    JOIN_RESUME = 4 // take back a seat after a dropped connection
+};
+
 enum ActionType {
     ACTION_PLAY_CARD = 0,
     ACTION_DRAW_CARD = 1,
@@ -29,7 +43,38 @@ enum ErrorCode {
     ERROR_INVALID_ACTION = 0,
     ERROR_NOT_YOUR_TURN = 1,
     ERROR_INVALID_CARD_INDEX = 2,
-    ERROR_INVALID_COLOR_CHOICE = 3
+    ERROR_INVALID_COLOR_CHOICE = 3,
+    ERROR_UNKNOWN_GAME_CODE = 4,
+    ERROR_SERVER_FULL = 5,
+    ERROR_UNKNOWN_SESSION = 6
+};
+
+// first packet a client sends, decides where the lobby seats it
+struct JoinRequest {
+    uint8_t mode; // JoinMode
+    char code[GAME_CODE_LEN + 1]; // for JOIN_PRIVATE
+    uint64_t session; // for JOIN_RESUME, from MSG_WELCOME
+    uint32_t last_seq; // for JOIN_RESUME, last MSG_STATE the client applied
+};
+
+// tells a client its seat, session is what it resumes the seat with
+struct Welcome {
+    uint8_t player_id; // SPECTATOR_ID for watchers
+    uint64_t session; // 0 for watchers
+};
+
+// sent while a client waits in the lobby
+struct LobbyStatus {
+    uint8_t num_players; // players seated or queued so far
+    uint8_t seats; // players needed before the table starts without bots
+    char code[GAME_CODE_LEN + 1]; // private table code, empty for quick match
+};
+
+// server heartbeat, the client echoes it back unchanged as MSG_PONG
+struct Ping {
+    uint32_t id;
+    uint64_t sent_us; // server clock
+    uint32_t interval_ms; // until the next ping, lets the client spot a dead server
 };
 
 struct Action {
@@ -41,6 +86,7 @@ struct Action {
 
 // info sent from server to every client every time a new turn starts
 struct GameState {
+    uint32_t seq; // counts turns at the table, 1 for the deal
     uint8_t current_player_id;
     uint8_t player_hand_sizes[MAX_PLAYERS]; // number of cards in each player's hand
     uint8_t direction; // 0 for clockwise, 1 for counterclockwise
@@ -67,21 +113,45 @@ enum PacketReadError {
 struct Packet {
     uint8_t type; // MsgType
     union {
-        uint8_t player_id; // for MSG_WELCOME
-        //client sends FFFFFFFF to indicate they are ready, server responds with bitmask of which players are connected
-        uint8_t num_players; // bit 0 = player 1 etc. for MSG_WAITING_FOR_PLAYERS 
+        struct Welcome welcome; // for MSG_WELCOME
+        struct LobbyStatus lobby; // for MSG_WAITING_FOR_PLAYERS
         struct GameState game_state; // for MSG_STATE
         struct PlayerHand player_hand; // for MSG_HAND
         struct Action action; // for MSG_ACTION
         uint8_t winner_id; // for MSG_GAME_OVER
         uint8_t error_code; // for MSG_ERROR
+        struct JoinRequest join; // for MSG_JOIN
+        struct Ping ping; // for MSG_PING and MSG_PONG
     } data;
 };
 
+// packet <-> payload without the length prefix; serialize_packet returns
+// the payload size, deserialize_packet a malloc'd packet
+int serialize_packet(struct Packet* packet, void* buffer);
+
+struct Packet* deserialize_packet(char* buffer, size_t buffer_size);
+
 int setup_server(uint16_t port);
 
 void close_server(int server_fd);
 
+// Connections are plain fds: a TCP socket, the wake fd of a same-host
+// shared memory channel (see shm.h) or of an in-process channel (see
+// local.h). send_packet, read_packet and the out queues work the same on
+// all of them.
+#define SHM_SOCKET_PATH "/tmp/uno-%d.sock" // formatted with the TCP port
+
+// after poll() reports fd readable: 1 if read_packet has a packet to read
+// (or an error to report) without blocking, 0 if the wake-up was for
+// something else
+int packet_ready(int fd);
+
+// closes a TCP socket or tears down a shared memory channel
+void close_connection(int fd);
+
+// poll() events for a connection, has_output when its out queue is not empty
+short connection_poll_events(int fd, int has_output);
+
 
 int set_socket_timeout(int fd, int timeout_sec);
 
@@ -92,6 +162,63 @@ int accept_client(int server_fd);
 
 int send_packet(int client_fd, struct Packet* packet);
 
+// a packet shared by every connection that has it queued, freed when the
+// last one is done with it. The length-prefixed frame is encoded once, the
+// first time a socket needs it; in-process connections take the struct.
+struct SharedBuf {
+    int refs;
+    struct Packet packet;
+    uint32_t len; // bytes in data, length prefix included
+    uint8_t* data; // NULL until encoded
+};
+
+struct SharedBuf* share_packet(struct Packet* packet);
+
+// fills in data and len, -1 if out of memory
+int shared_buf_encode(struct SharedBuf* buf);
+
+struct SharedBuf* shared_buf_ref(struct SharedBuf* buf);
+
+void shared_buf_unref(struct SharedBuf* buf);
+
+#define OUT_QUEUE_SIZE 64
+
+// frames waiting to be written to one connection
+struct OutQueue {
+    struct SharedBuf* bufs[OUT_QUEUE_SIZE];
+    int head;
+    int count;
+    uint32_t offset; // bytes of the head frame already written
+    int coalesced; // stale snapshots replaced before they were sent
+};
+
+// queues a reference to buf, replacing an unsent snapshot of the same type
+// (state, hand, lobby status) if there is one, -1 if the queue is full
+int out_queue_push(struct OutQueue* queue, struct SharedBuf* buf);
+
+// writes what the connection accepts without blocking, returns 0 when
+// drained, 1 if frames are still queued, -1 on a socket error
+int out_queue_flush(int fd, struct OutQueue* queue);
+
+void out_queue_clear(struct OutQueue* queue);
+
+// bytes from a non-blocking socket that do not make a whole frame yet
+struct InBuf {
+    uint32_t len;
+    uint8_t data[sizeof(uint32_t) + MAX_PACKET_SIZE];
+};
+
+// reads what the socket has without blocking: bytes read, 0 if nothing
+// was ready, -1 once the peer closed or on an error
+int in_buf_fill(int fd, struct InBuf* in);
+
+// decodes the next whole frame: 1 with a malloc'd packet, 0 if more bytes
+// are needed, a PacketReadError for a bad length
+int in_buf_next(struct InBuf* in, struct Packet** packet);
+
+// raises the open file limit towards wanted, returns the limit in force
+int raise_fd_limit(int wanted);
+
 int send_player_hand(int client_fd, uint8_t player_id);
 
 #endif
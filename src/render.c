@@ -0,0 +1,311 @@
+#include "render.h"
+#include "vterm.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TERM_FG_UNKNOWN -2
+#define MAX_REPRINT_GAP 4 // unchanged cells rewritten rather than skipped
+
+#define SYNC_BEGIN "\033[?2026h" // terminals without the mode ignore it
+#define SYNC_END "\033[?2026l"
+
+static const struct Cell blank = {{' '}, 1, COLOR_DEFAULT};
+
+void frame_buf_append(struct FrameBuf *buf, const void *bytes, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  if (buf->len + len > buf->cap) {
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + len) {
+      cap *= 2;
+    }
+    char *data = realloc(buf->data, cap);
+    if (data == NULL) {
+      return; // the frame comes out short, the next full redraw repairs it
+    }
+    buf->data = data;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, bytes, len);
+  buf->len += len;
+}
+
+void frame_buf_printf(struct FrameBuf *buf, const char *fmt, ...) {
+  char text[64];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+  if (len >= (int)sizeof(text)) {
+    len = sizeof(text) - 1;
+  }
+  if (len > 0) {
+    frame_buf_append(buf, text, len);
+  }
+}
+
+int frame_buf_flush(struct FrameBuf *buf, int fd) {
+  size_t sent = 0;
+  while (sent < buf->len) {
+    ssize_t n = write(fd, buf->data + sent, buf->len - sent);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // stdin was made non-blocking and a tty shares it with stdout
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        poll(&pfd, 1, -1);
+      } else if (errno != EINTR) {
+        buf->len = 0;
+        return -1;
+      }
+      continue;
+    }
+    sent += n;
+  }
+  buf->len = 0;
+  return 0;
+}
+
+static int utf8_length(unsigned char lead) {
+  if (lead < 0x80) {
+    return 1;
+  }
+  if (lead >= 0xF0) {
+    return 4;
+  }
+  if (lead >= 0xE0) {
+    return 3;
+  }
+  return 2;
+}
+
+static int cell_equal(const struct Cell *a, const struct Cell *b) {
+  return a->fg == b->fg && a->len == b->len &&
+         memcmp(a->glyph, b->glyph, a->len) == 0;
+}
+
+int screen_init(struct Screen *screen, int rows, int cols) {
+  memset(screen, 0, sizeof(*screen));
+  if (rows < 1) {
+    rows = 1;
+  }
+  if (cols < 1) {
+    cols = 1;
+  }
+  screen->front = malloc(sizeof(struct Cell) * rows * cols);
+  screen->back = malloc(sizeof(struct Cell) * rows * cols);
+  if (!screen->front || !screen->back) {
+    screen_free(screen);
+    return -1;
+  }
+  for (int i = 0; i < rows * cols; i++) {
+    screen->front[i] = blank;
+    screen->back[i] = blank;
+  }
+  screen->rows = rows;
+  screen->cols = cols;
+  screen->pen_x = 1;
+  screen->pen_y = 1;
+  screen->pen_fg = COLOR_DEFAULT;
+  screen->term_fg = TERM_FG_UNKNOWN;
+  return 0;
+}
+
+void screen_free(struct Screen *screen) {
+  free(screen->front);
+  free(screen->back);
+  free(screen->frame.data);
+  free(screen->raw.data);
+  screen->front = NULL;
+  screen->back = NULL;
+  memset(&screen->frame, 0, sizeof(screen->frame));
+  memset(&screen->raw, 0, sizeof(screen->raw));
+}
+
+int screen_resize(struct Screen *screen, int rows, int cols) {
+  struct Screen resized;
+  if (screen_init(&resized, rows, cols) < 0) {
+    return -1;
+  }
+  free(screen->front);
+  free(screen->back);
+  screen->front = resized.front;
+  screen->back = resized.back;
+  screen->rows = resized.rows;
+  screen->cols = resized.cols;
+  screen->term_fg = TERM_FG_UNKNOWN;
+  screen_raw(screen, "\033[0m\033[2J");
+  screen->dirty = 1;
+  return 0;
+}
+
+void screen_move(struct Screen *screen, int x, int y) {
+  screen->pen_x = x;
+  screen->pen_y = y;
+}
+
+void screen_color(struct Screen *screen, short fg) { screen->pen_fg = fg; }
+
+void screen_print(struct Screen *screen, const char *text) {
+  int row = screen->pen_y - 1;
+  const unsigned char *p = (const unsigned char *)text;
+  while (*p) {
+    int len = utf8_length(*p);
+    int col = screen->pen_x - 1;
+    if (row >= 0 && row < screen->rows && col >= 0 && col < screen->cols) {
+      struct Cell *cell = &screen->back[row * screen->cols + col];
+      int n = 0;
+      while (n < len && p[n]) {
+        cell->glyph[n] = p[n];
+        n++;
+      }
+      cell->len = n;
+      cell->fg = screen->pen_fg;
+      screen->dirty = 1;
+    }
+    while (len-- > 0 && *p) {
+      p++;
+    }
+    screen->pen_x++;
+  }
+}
+
+void screen_printf(struct Screen *screen, const char *fmt, ...) {
+  char text[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+  screen_print(screen, text);
+}
+
+void screen_fill(struct Screen *screen, int x, int y, int width, int height) {
+  int x0 = x < 1 ? 1 : x;
+  int y0 = y < 1 ? 1 : y;
+  int x1 = x + width - 1 > screen->cols ? screen->cols : x + width - 1;
+  int y1 = y + height - 1 > screen->rows ? screen->rows : y + height - 1;
+  for (int row = y0; row <= y1; row++) {
+    for (int col = x0; col <= x1; col++) {
+      screen->back[(row - 1) * screen->cols + col - 1] = blank;
+    }
+  }
+  if (x0 <= x1 && y0 <= y1) {
+    screen->dirty = 1;
+  }
+}
+
+void screen_blit(struct Screen *screen, const struct Screen *sprite, int x,
+                 int y) {
+  int first_col = x < 1 ? 1 - x : 0; // sprite columns left of the screen
+  int width = sprite->cols - first_col;
+  if (x + sprite->cols - 1 > screen->cols) {
+    width -= x + sprite->cols - 1 - screen->cols;
+  }
+  if (width <= 0) {
+    return;
+  }
+  for (int row = 0; row < sprite->rows; row++) {
+    int screen_row = y + row;
+    if (screen_row < 1 || screen_row > screen->rows) {
+      continue;
+    }
+    memcpy(&screen->back[(screen_row - 1) * screen->cols + x + first_col - 1],
+           &sprite->back[row * sprite->cols + first_col],
+           sizeof(struct Cell) * width);
+    screen->dirty = 1;
+  }
+}
+
+static void emit_color(struct Screen *screen, short fg) {
+  if (fg == screen->term_fg) {
+    return;
+  }
+  if (fg == COLOR_DEFAULT) {
+    frame_buf_append(&screen->frame, "\033[39m", 5);
+  } else {
+    frame_buf_printf(&screen->frame, "\033[38;5;%dm", fg);
+  }
+  screen->term_fg = fg;
+}
+
+// true if the cells between the cursor and the next change can simply be
+// written again in the current colour, which is shorter than an escape
+static int can_reprint(const struct Screen *screen, const struct Cell *row,
+                       int from, int to) {
+  if (to - from > MAX_REPRINT_GAP) {
+    return 0;
+  }
+  for (int col = from; col < to; col++) {
+    if (row[col].fg != screen->term_fg) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void screen_raw(struct Screen *screen, const char *sequence) {
+  frame_buf_append(&screen->raw, sequence, strlen(sequence));
+}
+
+int screen_present(struct Screen *screen, int fd) {
+  struct FrameBuf *frame = &screen->frame;
+  if (!screen->dirty && screen->raw.len == 0) {
+    return 0;
+  }
+  if (screen->sync_output) {
+    frame_buf_append(frame, SYNC_BEGIN, strlen(SYNC_BEGIN));
+  }
+  size_t raw_len = screen->raw.len;
+  frame_buf_append(frame, screen->raw.data, screen->raw.len);
+  screen->raw.len = 0;
+  size_t header_len = frame->len;
+  // cursor position after the last write, -1 when unknown
+  int cursor_x = -1, cursor_y = -1;
+
+  for (int y = 0; y < screen->rows; y++) {
+    struct Cell *front = &screen->front[y * screen->cols];
+    struct Cell *back = &screen->back[y * screen->cols];
+    for (int x = 0; x < screen->cols; x++) {
+      if (cell_equal(&front[x], &back[x])) {
+        continue;
+      }
+      if (cursor_y == y && cursor_x <= x) {
+        if (can_reprint(screen, back, cursor_x, x)) {
+          for (int col = cursor_x; col < x; col++) {
+            frame_buf_append(frame, back[col].glyph, back[col].len);
+          }
+        } else {
+          frame_buf_printf(frame, "\033[%dC", x - cursor_x);
+        }
+      } else {
+        frame_buf_printf(frame, "\033[%d;%dH", y + 1, x + 1);
+      }
+      emit_color(screen, back[x].fg);
+      frame_buf_append(frame, back[x].glyph, back[x].len);
+      front[x] = back[x];
+      // the last column leaves the cursor in a pending wrap
+      cursor_x = x + 1 < screen->cols ? x + 1 : -1;
+      cursor_y = cursor_x < 0 ? -1 : y;
+    }
+  }
+  screen->dirty = 0;
+  if (frame->len == header_len && raw_len == 0) {
+    frame->len = 0; // drawn over with the same cells, nothing to send
+    return 0;
+  }
+  if (screen->sync_output) {
+    frame_buf_append(frame, SYNC_END, strlen(SYNC_END));
+  }
+  int bytes = (int)frame->len;
+  if (screen->vterm != NULL) {
+    vterm_write(screen->vterm, frame->data, frame->len);
+    frame->len = 0;
+    return bytes;
+  }
+  return frame_buf_flush(frame, fd) < 0 ? -1 : bytes;
+}
@@ -0,0 +1,89 @@
+#ifndef UNO_RENDER_H
+#define UNO_RENDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Double-buffered cell grid for the client. Drawing only touches the back
+// buffer; screen_present compares it with the front buffer (what the
+// terminal shows) and writes just the cells that changed, so redrawing an
+// unchanged area costs no output at all.
+
+#define COLOR_DEFAULT -1 // the terminal's own foreground colour
+
+// growable byte buffer holding one frame of terminal output
+struct FrameBuf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+void frame_buf_append(struct FrameBuf *buf, const void *bytes, size_t len);
+
+void frame_buf_printf(struct FrameBuf *buf, const char *fmt, ...);
+
+// writes everything with as few write() calls as the fd allows, waiting
+// out EAGAIN on a non-blocking terminal. Empties buf, -1 on error
+int frame_buf_flush(struct FrameBuf *buf, int fd);
+
+struct VTerm;
+
+struct Cell {
+  char glyph[4]; // one UTF-8 code point, not terminated
+  uint8_t len;
+  short fg; // 256-colour index or COLOR_DEFAULT
+};
+
+struct Screen {
+  int rows;
+  int cols;
+  struct Cell *front;
+  struct Cell *back;
+  int pen_x; // 1-based like the terminal, where screen_print goes next
+  int pen_y;
+  short pen_fg;
+  int dirty;     // the back buffer was drawn on since the last present
+  short term_fg; // colour the terminal is set to, -2 when unknown
+  int sync_output; // wrap frames in synchronized update mode (DEC 2026)
+  struct FrameBuf frame; // output of the frame being built
+  struct FrameBuf raw;   // screen_raw sequences for the next frame
+  struct VTerm *vterm;   // when set, frames go here instead of to the fd
+};
+
+// both buffers blank, matching a terminal just cleared with ESC[2J
+int screen_init(struct Screen *screen, int rows, int cols);
+
+void screen_free(struct Screen *screen);
+
+// new blank buffers for a terminal that changed size; the next present
+// clears the terminal first since its contents are unknown. Keeps the old
+// buffers and returns -1 when out of memory
+int screen_resize(struct Screen *screen, int rows, int cols);
+
+void screen_move(struct Screen *screen, int x, int y);
+
+void screen_color(struct Screen *screen, short fg);
+
+// UTF-8 text at the pen in the pen colour, one cell per code point. Text
+// past the right edge is dropped, the pen moves to the end of the text
+void screen_print(struct Screen *screen, const char *text);
+
+void screen_printf(struct Screen *screen, const char *fmt, ...);
+
+// blanks a rectangle, clipped to the screen
+void screen_fill(struct Screen *screen, int x, int y, int width, int height);
+
+// copies the back buffer of sprite, a screen used as an off-screen image,
+// with its top left corner at x, y. One memcpy per row, clipped
+void screen_blit(struct Screen *screen, const struct Screen *sprite, int x,
+                 int y);
+
+// queues raw escape sequences to go out at the start of the next frame
+void screen_raw(struct Screen *screen, const char *sequence);
+
+// writes the difference between back and front, plus anything queued by
+// screen_raw, to fd as a single frame. Returns the bytes written, 0 when
+// nothing changed, -1 if the terminal went away
+int screen_present(struct Screen *screen, int fd);
+
+#endif // UNO_RENDER_H
@@ -1,278 +1,680 @@
-
+#define _GNU_SOURCE 1 // clock_gettime and pthread_sigmask under -std=c99
 #include "server.h"
+#include "local.h"
 #include "logger.h"
+#include "metrics.h"
 #include "network.h"
-#include "uno.h"
+#include "shm.h"
+#include "table.h"
+#include "trace.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_PLAYERS 4
-extern struct GameDetails
-    game_details; // Declare the global game_details from uno.c
+long long server_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-static int is_real_player_slot(int player_id, int real_players,
-                               int clients[4]) {
-  return player_id >= 0 && player_id < real_players && clients[player_id] != -1;
+long long server_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-struct GameState get_game_state_for_client() {
-  struct GameState state;
-  state.current_player_id = game_details.current_player;
-  for (int i = 0; i < MAX_PLAYERS; i++) {
-    state.player_hand_sizes[i] = game_details.hands[i].card_count;
+static void link_stats_init(struct LinkStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->last_rtt_us = -1;
+}
+
+void link_stats_format(const struct LinkStats *stats, char *out, size_t size) {
+  snprintf(out, size,
+           "rtt p50 %llu us p99 %llu us max %llu us, jitter p50 %llu us p99 "
+           "%llu us, %u/%u pongs, %u lost",
+           (unsigned long long)histogram_percentile(&stats->rtt_us, 50),
+           (unsigned long long)histogram_percentile(&stats->rtt_us, 99),
+           (unsigned long long)stats->rtt_us.max,
+           (unsigned long long)histogram_percentile(&stats->jitter_us, 50),
+           (unsigned long long)histogram_percentile(&stats->jitter_us, 99),
+           stats->pongs_received, stats->pings_sent, stats->pings_lost);
+}
+
+static int add_connection(struct Server *server, int fd) {
+  for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    struct Connection *conn = &server->conns[i];
+    if (conn->fd == -1) {
+      conn->fd = fd;
+      conn->joined = 0;
+      conn->table_id = -1;
+      conn->seat = -1;
+      conn->spectator = 0;
+      conn->ping_id = 0;
+      conn->in.len = 0;
+      conn->last_heard_ms = server_now_ms();
+      link_stats_init(&conn->link);
+      metric_add(METRIC_CONNECTIONS_ACCEPTED, 1);
+      metric_gauge_add(METRIC_CONNECTIONS_ACTIVE, 1);
+      if (server->config.ping_interval_ms > 0) {
+        timer_schedule(&server->timers, &conn->ping_timer,
+                       conn->last_heard_ms + server->config.ping_interval_ms);
+      }
+      return i;
+    }
   }
-  memcpy(&state.top_card, get_top_discard(), sizeof(CardDetails));
+  return -1;
+}
 
-  // Placeholder for direction and last_action.
-  // last_action also needs to be managed when actions are processed.
-  state.direction =
-      (get_direction() > 0) ? 0 : 1; // 0 for clockwise, 1 for counter-clockwise
-  memset(&state.last_action, 0,
-         sizeof(struct Action)); // Clear last action for now
+// writes what the connection takes and keeps its stall deadline in step,
+// a failed write shows up as a hangup on the next poll
+static void flush_connection(struct Server *server, int conn) {
+  struct Connection *c = &server->conns[conn];
+  int count = c->out.count;
+  uint32_t offset = c->out.offset;
+  int result = out_queue_flush(c->fd, &c->out);
+  if (result == 0) {
+    timer_cancel(&server->timers, &c->stall_timer);
+  } else if (result > 0 &&
+             (c->out.count != count || c->out.offset != offset ||
+              !timer_pending(&c->stall_timer))) {
+    timer_schedule(&server->timers, &c->stall_timer,
+                   server_now_ms() + SLOW_CLIENT_TIMEOUT_MS);
+  }
+}
 
-  return state;
+// flush_connection from the poll loop, where a finished table may close
+// once its last frame is out. Not for sends in the middle of a broadcast
+static void drain_connection(struct Server *server, int conn) {
+  struct Connection *c = &server->conns[conn];
+  flush_connection(server, conn);
+  if (c->fd != -1 && c->out.count == 0 && c->table_id >= 0) {
+    table_output_drained(server, c->table_id);
+  }
 }
 
-// This function needs to be declared in server.h and implemented here
-int send_player_hand_to_client(int client_fd, uint8_t player_id) {
-  struct Packet packet;
-  packet.type = MSG_HAND;
+void server_send_buf(struct Server *server, int conn, struct SharedBuf *buf) {
+  struct Connection *c = &server->conns[conn];
+  if (c->fd == -1) {
+    return;
+  }
+  if (buf->packet.type == MSG_ERROR) {
+    metric_add(METRIC_ERRORS_SENT, 1);
+  }
+  if (out_queue_push(&c->out, buf) < 0) {
+    // even coalesced the backlog does not fit, drop the client from the
+    // loop rather than from the middle of a broadcast
+    timer_schedule(&server->timers, &c->stall_timer, server_now_ms());
+    return;
+  }
+  flush_connection(server, conn);
+}
 
-  packet.data.player_hand.player_id = player_id;
-  packet.data.player_hand.num_cards = game_details.hands[player_id].card_count;
-  // Copy card details from game_details.hands[player_id] to
-  // packet.data.player_hand.cards Ensure MAX_HAND_SIZE is respected
-  for (int i = 0;
-       i < game_details.hands[player_id].card_count && i < MAX_HAND_SIZE; i++) {
-    packet.data.player_hand.cards[i] = game_details.hands[player_id].cards[i];
+void server_send_packet(struct Server *server, int conn,
+                        struct Packet *packet) {
+  struct SharedBuf *buf = share_packet(packet);
+  server_send_buf(server, conn, buf);
+  shared_buf_unref(buf);
+}
+
+void server_close_connection(struct Server *server, int conn) {
+  if (server->conns[conn].fd != -1) {
+    close_connection(server->conns[conn].fd);
+    metric_gauge_add(METRIC_CONNECTIONS_ACTIVE, -1);
+    if (server->conns[conn].link.pings_sent > 0) {
+      char line[256];
+      link_stats_format(&server->conns[conn].link, line, sizeof(line));
+      LOG_INFO("Connection %d link: %s", conn, line);
+    }
   }
+  out_queue_clear(&server->conns[conn].out);
+  timer_cancel(&server->timers, &server->conns[conn].stall_timer);
+  timer_cancel(&server->timers, &server->conns[conn].ping_timer);
+  timer_cancel(&server->timers, &server->conns[conn].read_timer);
+  server->conns[conn].fd = -1;
+  server->conns[conn].table_id = -1;
+  server->conns[conn].spectator = 0;
+}
 
-  return send_packet(client_fd, &packet);
+static void send_error(struct Server *server, int conn, uint8_t error_code) {
+  struct Packet packet = {MSG_ERROR, .data.error_code = error_code};
+  server_send_packet(server, conn, &packet);
 }
 
-int start_game_server(uint16_t port, int clients[4], int real_players) {
-  if (real_players < 1 || real_players > MAX_PLAYERS) {
-    return -1;
+// seats quick match players, bots take the seats nobody claimed in time
+static void match_lobby(struct Server *server, long long now_ms) {
+  int wanted = server->config.table_players;
+  while (lobby_size(&server->lobby) >= wanted ||
+         (lobby_size(&server->lobby) > 0 &&
+          now_ms - lobby_oldest(&server->lobby) >=
+              server->config.bot_wait_ms)) {
+    int table_id = table_open(server, 0, now_ms);
+    if (table_id < 0) {
+      // every table is busy, the queue keeps waiting
+      timer_schedule(&server->timers, &server->lobby_timer,
+                     now_ms + server->config.bot_wait_ms);
+      return;
+    }
+    for (int i = 0; i < wanted && lobby_size(&server->lobby) > 0; i++) {
+      table_seat(server, table_id, lobby_dequeue(&server->lobby), now_ms);
+    }
+    table_start(server, table_id, now_ms);
   }
 
-  init_game();
-  int socket = setup_server(port);
-  if (socket < 0) {
-    return socket;
+  // wake up when the player now at the front of the queue runs out of patience
+  if (lobby_size(&server->lobby) > 0) {
+    timer_schedule(&server->timers, &server->lobby_timer,
+                   lobby_oldest(&server->lobby) + server->config.bot_wait_ms);
+  } else {
+    timer_cancel(&server->timers, &server->lobby_timer);
   }
-  clients[0] = clients[1] = clients[2] = clients[3] = -1;
+}
+
+static void lobby_timer_fired(struct Timer *timer, long long now_ms) {
+  match_lobby(timer->ctx, now_ms);
+}
+
+static void handle_join(struct Server *server, int conn, struct Packet *packet,
+                        long long now_ms) {
+  struct Connection *c = &server->conns[conn];
+  struct JoinRequest *join = &packet->data.join;
+  c->joined = 1;
 
-  // now that server is open, wait for players
-  for (int i = 0; i < real_players; i++) {
-    // accept player
-    // update clinets to tell everyone a player joined
-    // tell clients there id
-    int new_client_sock = accept_client(socket);
-    if (new_client_sock < 0) {
-      return -1;
+  switch (join->mode) {
+  case JOIN_QUICK_MATCH: {
+    if (lobby_enqueue(&server->lobby, conn, now_ms) < 0) {
+      send_error(server, conn, ERROR_SERVER_FULL);
+      server_close_connection(server, conn);
+      return;
+    }
+    struct Packet status = {0};
+    status.type = MSG_WAITING_FOR_PLAYERS;
+    status.data.lobby.num_players = lobby_size(&server->lobby);
+    status.data.lobby.seats = server->config.table_players;
+    server_send_packet(server, conn, &status);
+    match_lobby(server, now_ms);
+    break;
+  }
+  case JOIN_CREATE_PRIVATE: {
+    int table_id = table_open(server, 1, now_ms);
+    if (table_id < 0) {
+      send_error(server, conn, ERROR_SERVER_FULL);
+      server_close_connection(server, conn);
+      return;
     }
-    clients[i] = new_client_sock;
-    struct Packet packet = {0};
-    packet.type = MSG_WELCOME;
-    packet.data.player_id = i;
-    send_packet(new_client_sock, &packet);
-  }
-
-  // turn off blocking as we wait for clients to ready up in no specific order
-  /* for (int i = 0; i < MAX_PLAYERS; i++) { */
-  /*     fcntl(clients[i], F_SETFL, O_NONBLOCK); */
-  /* } */
-  /* uint8_t waiting_for_ready = 0; */
-  /**/
-  /* while (waiting_for_ready != 0x0F) { */
-  /**/
-  /*     // listen for ready packets from clients */
-  /*     for (int i = 0; i < MAX_PLAYERS; i++) { */
-  /*         struct Packet* packet; */
-  /*         int result = read_packet(clients[i], &packet); */
-  /*         if (result == READ_OK) { */
-  /*             if (packet->type == MSG_WAITING_FOR_PLAYERS) { */
-  /*                 waiting_for_ready = 0x0F; */
-  /*                 waiting_for_ready |= (1 << i); */
-  /*                 struct Packet return_data = { */
-  /*                     MSG_WAITING_FOR_PLAYERS, */
-  /*                     { waiting_for_ready } */
-  /*                 }; */
-  /*                 send_packet(clients[i], &return_data); */
-  /*             } */
-  /*             free(packet); */
-  /*         } */
-  /*     } */
-  /**/
-  /*     usleep(100000); // sleep for 100ms to avoid busy waiting */
-  /* } */
-  /**/
-
-  // turn blocking back on for game play
-  for (int i = 0; i < real_players; i++) {
-    fcntl(clients[i], F_SETFL, fcntl(clients[i], F_GETFL) & ~O_NONBLOCK);
-  }
-
-  return socket;
+    table_seat(server, table_id, conn, now_ms);
+    LOG_INFO("Table %d: private game %s created", table_id,
+             server->tables[table_id].code);
+    table_send_lobby_status(server, table_id);
+    break;
+  }
+  case JOIN_PRIVATE: {
+    int table_id = table_find_code(server, join->code);
+    if (table_id < 0 || table_seat(server, table_id, conn, now_ms) < 0) {
+      send_error(server, conn, ERROR_UNKNOWN_GAME_CODE);
+      server_close_connection(server, conn);
+      return;
+    }
+    if (server->tables[table_id].humans == MAX_PLAYERS) {
+      table_start(server, table_id, now_ms);
+    } else {
+      table_send_lobby_status(server, table_id);
+    }
+    break;
+  }
+  case JOIN_SPECTATE: {
+    int table_id = table_find_watchable(server, join->code);
+    if (table_id < 0) {
+      send_error(server, conn, ERROR_UNKNOWN_GAME_CODE);
+      server_close_connection(server, conn);
+      return;
+    }
+    if (table_add_spectator(server, table_id, conn) < 0) {
+      send_error(server, conn, ERROR_SERVER_FULL);
+      server_close_connection(server, conn);
+    }
+    break;
+  }
+  case JOIN_RESUME:
+    if (table_resume(server, conn, join->session, join->last_seq, now_ms) <
+        0) {
+      send_error(server, conn, ERROR_UNKNOWN_SESSION);
+      server_close_connection(server, conn);
+    }
+    break;
+  default:
+    send_error(server, conn, ERROR_INVALID_ACTION);
+    server_close_connection(server, conn);
+    break;
+  }
 }
 
-void run_server(int clients[4], int server_fd, int real_players) {
-  // get current player from gameDetails
-  // make their socket the active one
-  // wait for a action from them
-  // handle the action
-  // move onto next player
-  //
-  //
-  // after game end
-  // tell everyone winner
-  // ask for replay from everyone
-  // if yes:
-  //    clear out game state
-  //
-  int running = 1;
-  int current_player = 0;
-  int current_player_sock = clients[0];
-
-  while (running) {
-    // game loop
-    // Broadcast game state and hands to all players at the start of each turn
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-      if (!is_real_player_slot(i, real_players, clients)) {
-        continue;
-      }
-      struct GameState current_state = get_game_state_for_client();
-      struct Packet state_packet = {MSG_STATE,
-                                    .data.game_state = current_state};
-      send_packet(clients[i], &state_packet);
-      send_player_hand_to_client(clients[i], i);
-      LOG_INFO("Sent game state and hand to player %d", i);
+static void disconnect(struct Server *server, int conn) {
+  struct Connection *c = &server->conns[conn];
+  if (c->spectator) {
+    table_spectator_left(server, c->table_id, conn);
+  } else if (c->table_id >= 0) {
+    table_player_left(server, c->table_id, c->seat);
+  } else if (c->joined) {
+    lobby_remove(&server->lobby, conn);
+    match_lobby(server, server_now_ms());
+  }
+  server_close_connection(server, conn);
+}
+
+static void stall_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  struct Connection *c = &server->conns[timer->arg];
+  (void)now_ms;
+  LOG_WARN("Connection %d stopped reading (%d frames queued, %d coalesced), "
+           "disconnecting",
+           timer->arg, c->out.count, c->out.coalesced);
+  disconnect(server, timer->arg);
+}
+
+static void ping_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  int conn = timer->arg;
+  struct Connection *c = &server->conns[conn];
+  int interval = server->config.ping_interval_ms;
+
+  if (now_ms - c->last_heard_ms >= (long long)interval * PING_MISSES) {
+    LOG_WARN("Connection %d silent for %lld ms, disconnecting", conn,
+             now_ms - c->last_heard_ms);
+    disconnect(server, conn);
+    return;
+  }
+  if (c->ping_id != 0) {
+    c->link.pings_lost++;
+    server->link_totals.pings_lost++;
+  }
+  if (++server->next_ping_id == 0) {
+    server->next_ping_id = 1; // 0 means no ping in flight
+  }
+  c->ping_id = server->next_ping_id;
+
+  struct Packet ping = {0};
+  ping.type = MSG_PING;
+  ping.data.ping.id = c->ping_id;
+  ping.data.ping.sent_us = server_now_us();
+  ping.data.ping.interval_ms = interval;
+  server_send_packet(server, conn, &ping);
+  c->link.pings_sent++;
+  server->link_totals.pings_sent++;
+  timer_schedule(&server->timers, timer, now_ms + interval);
+}
+
+static void record_pong(struct Server *server, int conn, struct Ping *pong) {
+  struct Connection *c = &server->conns[conn];
+  if (pong->id != c->ping_id) {
+    return; // answers a ping we already counted as lost
+  }
+  c->ping_id = 0;
+  long long rtt_us = server_now_us() - (long long)pong->sent_us;
+  if (rtt_us < 0) {
+    return;
+  }
+  long long jitter_us = -1;
+  if (c->link.last_rtt_us >= 0) {
+    jitter_us = rtt_us > c->link.last_rtt_us ? rtt_us - c->link.last_rtt_us
+                                             : c->link.last_rtt_us - rtt_us;
+  }
+  c->link.last_rtt_us = rtt_us;
+
+  struct LinkStats *stats[] = {&c->link, &server->link_totals};
+  for (int i = 0; i < 2; i++) {
+    histogram_record(&stats[i]->rtt_us, rtt_us);
+    if (jitter_us >= 0) {
+      histogram_record(&stats[i]->jitter_us, jitter_us);
     }
+    stats[i]->pongs_received++;
+  }
+}
 
-    // Get the current player
-    current_player = get_current_player();
-    if (current_player >= real_players) {
-      int bot_result = bot_play(current_player);
-      if (bot_result < 0) {
-        LOG_ERROR("Bot turn failed for player %d", current_player);
-        running = 0;
-        break;
-      }
+static void stats_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  if (server->link_totals.pongs_received > 0) {
+    char line[256];
+    link_stats_format(&server->link_totals, line, sizeof(line));
+    LOG_INFO("Links since startup: %s", line);
+  }
+  timer_schedule(&server->timers, timer, now_ms + STATS_LOG_INTERVAL_MS);
+}
+
+static void trace_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  trace_flush();
+  timer_schedule(&server->timers, timer, now_ms + TRACE_FLUSH_MS);
+}
+
+// a whole packet from the connection, freed here. read_ns is when reading
+// it began by trace_clock
+static void handle_packet(struct Server *server, int conn,
+                          struct Packet *packet, long long read_ns,
+                          long long now_ms) {
+  struct Connection *c = &server->conns[conn];
+  c->last_heard_ms = now_ms;
+  if (packet->type == MSG_PONG) {
+    record_pong(server, conn, &packet->data.ping);
+  } else if (!c->joined) {
+    if (packet->type == MSG_JOIN) {
+      handle_join(server, conn, packet, now_ms);
+    } else {
+      disconnect(server, conn);
+    }
+  } else if (c->table_id >= 0 && !c->spectator) {
+    LOG_INFO("Received packet from player %d: type %d", c->seat, packet->type);
+    // a move is a turn worth tracing, heartbeats and the rest are not. A
+    // sampled one starts where reading its packet did
+    long long turn = packet->type == MSG_ACTION
+                         ? trace_turn_begin(c->table_id)
+                         : 0;
+    if (turn != 0 && read_ns != 0) {
+      trace_end("read_packet", read_ns);
+      turn = read_ns;
+    }
+    table_handle_packet(server, c->table_id, c->seat, packet, now_ms);
+    trace_turn_end("action", turn);
+  }
+  free(packet);
+}
+
+static void read_failed(struct Server *server, int conn, int result) {
+  metric_read_error(result);
+  LOG_INFO("Connection %d closed (read error %d)", conn, result);
+  disconnect(server, conn);
+}
 
-      next_player();
-      if (game_details.hands[current_player].card_count == 0) {
-        LOG_INFO("Player %d has won the game!", current_player);
-        running = 0; // End game loop
-        // Send game over message to all clients
-        for (int j = 0; j < MAX_PLAYERS; j++) {
-          if (!is_real_player_slot(j, real_players, clients)) {
-            continue;
-          }
-          struct Packet game_over_packet = {MSG_GAME_OVER,
-                                            .data.winner_id = current_player};
-          send_packet(clients[j], &game_over_packet);
+static void read_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  (void)now_ms;
+  LOG_WARN("Connection %d sent part of a frame and went quiet, "
+           "disconnecting",
+           timer->arg);
+  disconnect(server, timer->arg);
+}
+
+// takes what a socket has without waiting for the rest of a frame, so a
+// peer that stalls mid-frame holds up nobody else. It gets
+// PARTIAL_FRAME_TIMEOUT_MS to finish the frame
+static void read_socket(struct Server *server, int conn, long long now_ms) {
+  struct Connection *c = &server->conns[conn];
+  long long read_ns = trace_clock();
+  if (in_buf_fill(c->fd, &c->in) < 0) {
+    // whole frames are always taken out, what is left is part of one
+    read_failed(server, conn,
+                c->in.len > 0 ? READ_ERROR_RECV_PAYLOAD : READ_ERROR_RECV_LEN);
+    return;
+  }
+  int frames = 0;
+  struct Packet *packet;
+  int result;
+  while (c->fd != -1 && (result = in_buf_next(&c->in, &packet)) != 0) {
+    if (result < 0) {
+      read_failed(server, conn, result);
+      return;
+    }
+    handle_packet(server, conn, packet, read_ns, now_ms);
+    frames++;
+    read_ns = trace_clock();
+  }
+  if (c->fd == -1) {
+    return;
+  }
+  if (c->in.len == 0) {
+    timer_cancel(&server->timers, &c->read_timer);
+  } else if (frames > 0 || !timer_pending(&c->read_timer)) {
+    timer_schedule(&server->timers, &c->read_timer,
+                   now_ms + PARTIAL_FRAME_TIMEOUT_MS);
+  }
+}
+
+static void handle_readable(struct Server *server, int conn, long long now_ms) {
+  struct Connection *c = &server->conns[conn];
+  server->action_start_us = server_now_us();
+  if (local_channel(c->fd) == NULL && shm_channel(c->fd) == NULL) {
+    read_socket(server, conn, now_ms);
+  } else if (packet_ready(c->fd)) {
+    // channels only ever hold whole frames, this does not block
+    long long read_ns = trace_clock();
+    struct Packet *packet;
+    int result = read_packet(c->fd, &packet);
+    if (result != READ_OK) {
+      read_failed(server, conn, result);
+    } else {
+      handle_packet(server, conn, packet, read_ns, now_ms);
+    }
+  }
+
+  // reading may have consumed a shared memory wake-up meant for writing,
+  // or the wake-up was the client freeing ring space for queued frames
+  if (c->fd != -1 && c->out.count > 0) {
+    drain_connection(server, conn);
+  }
+}
+
+int run_lobby_server(const struct ServerConfig *config) {
+  struct Server *server = calloc(1, sizeof(struct Server));
+  // listeners, then every connection with a second entry for the handoff
+  // socket of a shared memory one
+  struct pollfd *pfds =
+      calloc(2 * MAX_CONNECTIONS + 3, sizeof(struct pollfd));
+  int *pfd_conn = calloc(2 * MAX_CONNECTIONS + 3, sizeof(int));
+  if (!server || !pfds || !pfd_conn) {
+    free(server);
+    free(pfds);
+    free(pfd_conn);
+    return -1;
+  }
+
+  server->config = *config;
+  for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    server->conns[i].fd = -1;
+    timer_init(&server->conns[i].stall_timer, stall_timer_fired, server, i);
+    timer_init(&server->conns[i].ping_timer, ping_timer_fired, server, i);
+    timer_init(&server->conns[i].read_timer, read_timer_fired, server, i);
+  }
+  lobby_init(&server->lobby);
+  timer_wheel_init(&server->timers, server_now_ms());
+  timer_init(&server->lobby_timer, lobby_timer_fired, server, 0);
+  timer_init(&server->stats_timer, stats_timer_fired, server, 0);
+  timer_init(&server->trace_timer, trace_timer_fired, server, 0);
+  link_stats_init(&server->link_totals);
+  if (config->ping_interval_ms > 0) {
+    timer_schedule(&server->timers, &server->stats_timer,
+                   server_now_ms() + STATS_LOG_INTERVAL_MS);
+  }
+  if (trace_enabled()) {
+    timer_schedule(&server->timers, &server->trace_timer,
+                   server_now_ms() + TRACE_FLUSH_MS);
+  }
+  srand(time(NULL) ^ getpid());
+  // a client vanishing mid-send must not take the whole lobby down
+  signal(SIGPIPE, SIG_IGN);
+  // every connection slot may hold a socket, plus listeners and notifiers
+  raise_fd_limit(MAX_CONNECTIONS + 64);
+
+  server->listen_fd = config->port != 0 ? setup_server(config->port) : -1;
+  if (config->port != 0 && server->listen_fd < 0) {
+    free(server);
+    free(pfds);
+    free(pfd_conn);
+    return -1;
+  }
+  server->shm_listen_fd = -1;
+  if (config->shm_path != NULL) {
+    server->shm_listen_fd = shm_listen(config->shm_path);
+    if (server->shm_listen_fd < 0) {
+      LOG_WARN("Shared memory endpoint %s unavailable, serving TCP only",
+               config->shm_path);
+    }
+  }
+  server->metrics_fd = -1;
+  if (config->metrics_path != NULL) {
+    server->metrics_fd = metrics_listen(config->metrics_path);
+    if (server->metrics_fd < 0) {
+      LOG_WARN("Metrics socket %s unavailable", config->metrics_path);
+    }
+  }
+  int local_conn = -1;
+  if (config->local_fd >= 0) {
+    local_conn = add_connection(server, config->local_fd);
+  }
+  LOG_INFO("Lobby listening on port %d (%d players per table, bots after %d "
+           "ms)",
+           config->port, config->table_players, config->bot_wait_ms);
+
+  for (;;) {
+    if (local_conn >= 0 && server->conns[local_conn].fd == -1) {
+      break; // the in-process client hung up
+    }
+    int nfds = 0;
+    pfds[nfds].fd = server->listen_fd; // -1 without a TCP listener
+    pfds[nfds].events = POLLIN;
+    pfd_conn[nfds++] = -1;
+    pfds[nfds].fd = server->shm_listen_fd; // ignored by poll when -1
+    pfds[nfds].events = POLLIN;
+    pfd_conn[nfds++] = -1;
+    pfds[nfds].fd = server->metrics_fd;
+    pfds[nfds].events = POLLIN;
+    pfd_conn[nfds++] = -1;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+      if (server->conns[i].fd != -1) {
+        pfds[nfds].fd = server->conns[i].fd;
+        pfds[nfds].events = connection_poll_events(
+            server->conns[i].fd, server->conns[i].out.count > 0);
+        pfd_conn[nfds++] = i;
+        if (shm_hangup_fd(server->conns[i].fd) >= 0) {
+          pfds[nfds].fd = shm_hangup_fd(server->conns[i].fd);
+          pfds[nfds].events = POLLIN;
+          pfd_conn[nfds++] = i;
         }
       }
-      usleep(3000000);
-      continue;
     }
-    current_player_sock = clients[current_player];
-    if (current_player_sock < 0) {
-      LOG_ERROR("Current player %d is disconnected", current_player);
-      running = 0;
+
+    int ready =
+        poll(pfds, nfds, timer_wheel_timeout(&server->timers, server_now_ms()));
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
       break;
     }
+    long long now_ms = server_now_ms();
 
-  // Set current player's socket to blocking to wait for their action
-  get_packet:;
+    if (pfds[0].revents & POLLIN) {
+      int client_fd = accept_client(server->listen_fd);
+      if (client_fd >= 0 && add_connection(server, client_fd) < 0) {
+        struct Packet packet = {MSG_ERROR, .data.error_code = ERROR_SERVER_FULL};
+        send_packet(client_fd, &packet);
+        close(client_fd);
+      } else if (client_fd >= 0) {
+        // read_socket never waits for the rest of a frame
+        fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+      }
+    }
+    if (pfds[1].revents & POLLIN) {
+      int client_fd = shm_accept(server->shm_listen_fd);
+      if (client_fd >= 0 && add_connection(server, client_fd) < 0) {
+        close_connection(client_fd);
+      }
+    }
 
-    struct Packet *packet;
-    int result = read_packet(current_player_sock, &packet);
-
-    if (result == READ_OK) {
-      LOG_INFO("Received packet from player %d: type %d", current_player,
-               packet->type);
-      if (packet->type == MSG_ACTION) {
-        struct Action action = packet->data.action;
-        int result;
-
-        switch (action.type) {
-        case ACTION_PLAY_CARD:
-          LOG_INFO("\tPlayer %d attempts to play card at index %d",
-                   current_player, action.card_index);
-          result = play_card(current_player, action.card_index);
-          if (result == -1) {
-            // Invalid play, ask for action again
-            LOG_WARN("\tInvalid play by player %d: card index %d",
-                     current_player, action.card_index);
-            struct Packet error_packet = {MSG_ERROR, .data.error_code =
-                                                         ERROR_INVALID_ACTION};
-            result = send_packet(current_player_sock, &error_packet);
-            if (result < 0) {
-              // Handle send error (e.g., client disconnected)
-              LOG_ERROR("Failed to send error packet to player %d, closing "
-                        "connection",
-                        current_player);
-              clients[current_player] = -1; // Mark client as disconnected
-              close_game_server(clients, 1,
-                                server_fd); // Close server due to error
-              running = 0;
-              free(packet);
-              return;
-            }
-            goto get_packet;
-          }
-          if (result == 4 || result == 5) { // wild card
-            change_color(action.chosen_color);
-          }
-          next_player();
-          break;
-        case ACTION_DRAW_CARD:
-          pickup_card(current_player);
-          // TODO: Implement logic for playing after drawing or skipping after
-          // drawing.
-          next_player(); // Advance turn after drawing
-          break;
-        case ACTION_SKIPPED:
-          // Player explicitly skipped their turn.
-          next_player(); // Advance turn
-          break;
-        }
+    if (pfds[2].revents & POLLIN) {
+      metrics_serve(server->metrics_fd);
+    }
 
-        // Check for win condition
-        if (game_details.hands[current_player].card_count == 0) {
-          LOG_INFO("Player %d has won the game!", current_player);
-          running = 0; // End game loop
-          // Send game over message to all clients
-          for (int j = 0; j < MAX_PLAYERS; j++) {
-            if (!is_real_player_slot(j, real_players, clients)) {
-              continue;
-            }
-            struct Packet game_over_packet = {MSG_GAME_OVER,
-                                              .data.winner_id = current_player};
-            send_packet(clients[j], &game_over_packet);
-          }
+    for (int i = 3; i < nfds; i++) {
+      int conn = pfd_conn[i];
+      int fd = server->conns[conn].fd;
+      if (fd != -1 && pfds[i].fd == shm_hangup_fd(fd)) {
+        // nothing is sent on it, readable means the client process died
+        // without closing its channel
+        if (pfds[i].revents != 0) {
+          shm_peer_gone(shm_channel(fd));
+          handle_readable(server, conn, now_ms);
         }
+        continue;
+      }
+      // an earlier packet may have closed this connection's table
+      if (fd != pfds[i].fd) {
+        continue;
+      }
+      if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        handle_readable(server, conn, now_ms);
+      } else if (pfds[i].revents & POLLOUT) {
+        drain_connection(server, conn);
       }
-      free(packet);
     }
-    usleep(100000); // sleep for 100ms to let everyone else process the turn and
-                    // avoid busy waiting
+
+    timer_wheel_advance(&server->timers, server_now_ms());
+  }
+
+  for (int i = 0; i < MAX_TABLES; i++) {
+    table_close(server, i);
+  }
+  for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    server_close_connection(server, i);
+  }
+  trace_flush();
+  if (server->listen_fd >= 0) {
+    close_server(server->listen_fd);
+  }
+  if (server->shm_listen_fd >= 0) {
+    close_server(server->shm_listen_fd);
+    unlink(config->shm_path);
   }
+  if (server->metrics_fd >= 0) {
+    close(server->metrics_fd);
+    unlink(config->metrics_path);
+  }
+  free(server);
+  free(pfds);
+  free(pfd_conn);
+  return 0;
+}
 
-  // After game ends, ask for replay (TODO)
+static void *embedded_server_main(void *arg) {
+  struct ServerConfig *config = arg;
+  if (run_lobby_server(config) < 0) {
+    close_connection(config->local_fd); // the client sees a hangup
+  }
+  free(config);
+  return NULL;
 }
 
-void close_game_server(int clients[4], int reason, int server_fd) {
-  printf("Closing server: %s\n",
-         (reason == 0) ? "Normal shutdown" : "Error occurred");
-  for (int i = 0; i < MAX_PLAYERS; i++) {
-    if (clients[i] != -1) {
-      close(clients[i]);
-    }
+int start_embedded_server(const struct ServerConfig *config) {
+  struct ServerConfig *copy = malloc(sizeof(struct ServerConfig));
+  int client_fd, server_fd;
+  if (!copy || local_pair(&client_fd, &server_fd) < 0) {
+    free(copy);
+    return -1;
+  }
+  *copy = *config;
+  copy->local_fd = server_fd;
+
+  // the thread inherits our mask. With everything blocked a SIGWINCH is
+  // never taken by it, so it reaches the client's signalfd
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_t thread;
+  int created = pthread_create(&thread, NULL, embedded_server_main, copy);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (created != 0) {
+    local_close(server_fd);
+    local_close(client_fd);
+    free(copy);
+    return -1;
   }
-  close_server(server_fd);
+  pthread_detach(thread);
+  return client_fd;
 }
@@ -2,13 +2,137 @@
 #ifndef UNO_SERVER_H
 #define UNO_SERVER_H
 
+#include "histogram.h"
+#include "lobby.h"
+#include "network.h"
+#include "timer.h"
+#include "uno.h"
 #include <stdint.h>
 
-void close_game_server(int clients[4], int reason, int server_fd);
+#define MAX_CONNECTIONS LOBBY_QUEUE_SIZE
+#define MAX_TABLES 1024
+#define MAX_SPECTATORS 256 // per table
+#define DEFAULT_BOT_WAIT_MS 5000
+#define DEFAULT_PRIVATE_WAIT_MS 60000
+#define DEFAULT_TURN_TIMEOUT_MS 60000
+#define DEFAULT_BOT_DELAY_MS 3000
+#define DEFAULT_RESUME_GRACE_MS 60000
+#define DEFAULT_PING_INTERVAL_MS 5000
+#define STATS_LOG_INTERVAL_MS 60000
+#define SLOW_CLIENT_TIMEOUT_MS 10000 // queued output with no progress
+#define PARTIAL_FRAME_TIMEOUT_MS 5000 // a frame started but not finished
+#define GAME_OVER_GRACE_MS 5000 // a finished table waits this long at most
+                                // for the result to reach everyone
 
-void run_server(int clients[4], int server_fd, int real_players);
+struct ServerConfig {
+  uint16_t port;
+  int table_players;   // humans wanted at a quick match table before bots
+  int bot_wait_ms;     // how long the lobby queue waits before seating bots
+  int private_wait_ms; // idle time after the last join before a private
+                       // table starts with bots
+  int turn_timeout_ms; // a human who does not move in time draws a card
+  int bot_delay_ms;    // pause before each bot move so humans can follow
+  int resume_grace_ms; // how long a table whose humans all dropped waits
+                       // for one of them to resume
+  int ping_interval_ms; // heartbeat period, 0 disables pings; a connection
+                        // silent for PING_MISSES periods is dropped
+  const char *shm_path; // unix socket for same-host shared memory clients,
+                        // NULL to only serve TCP
+  const char *metrics_path; // unix socket serving metrics_format, NULL for
+                            // none
+  int local_fd; // server end of an in-process client, -1 for none. The
+                // server stops once that client is gone
+};
 
-int start_game_server(uint16_t port, int clients[4], int real_players);
+// what a connection's heartbeats measured
+struct LinkStats {
+  struct Histogram rtt_us;
+  struct Histogram jitter_us; // change in RTT between consecutive pongs
+  long long last_rtt_us;      // -1 before the first pong
+  uint32_t pings_sent;
+  uint32_t pongs_received;
+  uint32_t pings_lost; // no pong before the next ping went out
+};
 
+struct Connection {
+  int fd;       // -1 when the slot is free
+  int joined;   // MSG_JOIN received
+  int table_id; // -1 while in the lobby
+  int seat;
+  int spectator; // watching table_id without a seat
+  struct OutQueue out;
+  struct InBuf in;          // part of a frame from a socket
+  struct Timer stall_timer; // drops a client that stopped reading
+  struct Timer read_timer;  // drops a client that stopped mid-frame
+  struct Timer ping_timer;
+  uint32_t ping_id; // ping waiting for its pong, 0 when none
+  long long last_heard_ms;
+  struct LinkStats link;
+};
+
+struct Table {
+  int in_use;
+  int started;
+  int finished; // MSG_GAME_OVER is queued, closes once it has gone out
+  int is_private;
+  char code[GAME_CODE_LEN + 1];
+  int seats[MAX_PLAYERS]; // connection index, -1 for a bot or empty seat
+  uint64_t sessions[MAX_PLAYERS]; // resume tokens of human seats, 0 for bots;
+                                  // a bot covers a seat whose player dropped
+  int humans;
+  int spectators[MAX_SPECTATORS]; // connection indexes
+  int num_spectators;
+  struct Timer start_timer; // private tables: starts with bots when idle
+  struct Timer bot_timer;   // paces the next bot move
+  struct Timer turn_timer;  // deadline for the human whose turn it is
+  struct Timer abandon_timer; // closes the table once every human dropped
+  struct Timer close_timer;   // closes a finished table whose frames are stuck
+  uint32_t seq;               // seq of the last MSG_STATE
+  struct SharedBuf *last_state; // the MSG_STATE at seq, resent on resume
+  struct GameDetails game;
+};
+
+struct Server {
+  struct ServerConfig config;
+  int listen_fd;
+  int shm_listen_fd; // -1 without a shared memory endpoint
+  int metrics_fd;    // -1 without a metrics socket
+  int num_tables;
+  struct Connection conns[MAX_CONNECTIONS];
+  struct Table tables[MAX_TABLES];
+  struct Lobby lobby;
+  struct Timer lobby_timer; // seats bots once the oldest player waited enough
+  struct Timer stats_timer; // logs link_totals every STATS_LOG_INTERVAL_MS
+  struct Timer trace_timer; // writes out traced turns every TRACE_FLUSH_MS
+  struct LinkStats link_totals; // every connection since startup
+  uint32_t next_ping_id;
+  long long action_start_us; // when the packet being handled was polled
+  struct TimerWheel timers;
+};
+
+long long server_now_ms();
+
+long long server_now_us();
+
+// one line of RTT, jitter and loss figures, for logs and operators
+void link_stats_format(const struct LinkStats *stats, char *out, size_t size);
+
+// queues a frame for a connection and writes what the socket accepts, a
+// client that falls behind gets its stale snapshots coalesced and is
+// dropped once it makes no progress for SLOW_CLIENT_TIMEOUT_MS
+void server_send_buf(struct Server *server, int conn, struct SharedBuf *buf);
+
+// queues a packet for a single connection
+void server_send_packet(struct Server *server, int conn, struct Packet *packet);
+
+// closes the socket and frees the slot, no lobby or table bookkeeping
+void server_close_connection(struct Server *server, int conn);
+
+int run_lobby_server(const struct ServerConfig *config);
+
+// runs a lobby on its own thread for a client in this process, returns the
+// client end of the in-process channel or -1. config->port may be 0 to skip
+// the TCP listener
+int start_embedded_server(const struct ServerConfig *config);
 
 #endif // UNO_SERVER_H
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE 1 // memfd_create
+#include "shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#define SHM_HANDOFF_FDS 4 // segment, client wake read/write, server wake write
+
+struct ShmEndpoint {
+  struct ShmChannel channel;
+  int wake_write_fd; // our own wake fd's write side, to re-arm ourselves
+};
+
+static struct ShmEndpoint *channels[SHM_MAX_FD];
+
+int make_notifier(int fds[2]) {
+#ifdef __linux__
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  fds[0] = fds[1] = fd;
+  return 0;
+#else
+  if (pipe(fds) < 0) {
+    return -1;
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  return 0;
+#endif
+}
+
+void notifier_signal(int fd) {
+#ifdef __linux__
+  uint64_t one = 1;
+  ssize_t n = write(fd, &one, sizeof(one));
+#else
+  char one = 1;
+  ssize_t n = write(fd, &one, 1); // a full pipe is already signalled
+#endif
+  (void)n;
+}
+
+void notifier_drain(int fd) {
+#ifdef __linux__
+  uint64_t count;
+  ssize_t n = read(fd, &count, sizeof(count));
+  (void)n;
+#else
+  char buf[64];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+#endif
+}
+
+static int make_segment_fd() {
+#ifdef __linux__
+  return memfd_create("uno-shm", MFD_CLOEXEC);
+#else
+  char name[64];
+  static int counter = 0;
+  snprintf(name, sizeof(name), "/uno-%d-%d", (int)getpid(), counter++);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd >= 0) {
+    shm_unlink(name); // lives on through the mappings
+  }
+  return fd;
+#endif
+}
+
+static int register_channel(struct ShmSegment *segment, int is_server,
+                            int wake_fd, int wake_write_fd, int peer_fd,
+                            int hangup_fd) {
+  if (wake_fd < 0 || wake_fd >= SHM_MAX_FD) {
+    return -1;
+  }
+  struct ShmEndpoint *endpoint = calloc(1, sizeof(struct ShmEndpoint));
+  if (!endpoint) {
+    return -1;
+  }
+  endpoint->channel.segment = segment;
+  endpoint->channel.rx = is_server ? &segment->to_server : &segment->to_client;
+  endpoint->channel.tx = is_server ? &segment->to_client : &segment->to_server;
+  endpoint->channel.wake_fd = wake_fd;
+  endpoint->channel.peer_wake_fd = peer_fd;
+  endpoint->channel.hangup_fd = hangup_fd;
+  endpoint->wake_write_fd = wake_write_fd;
+  channels[wake_fd] = endpoint;
+  return wake_fd;
+}
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+int shm_listen(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) < 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  unlink(path); // stale socket from an earlier run
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int shm_accept(int listen_fd) {
+  int sock = accept(listen_fd, NULL, NULL);
+  if (sock < 0) {
+    perror("accept");
+    return -1;
+  }
+
+  int segment_fd = make_segment_fd();
+  int server_wake[2] = {-1, -1};
+  int client_wake[2] = {-1, -1};
+  struct ShmSegment *segment = MAP_FAILED;
+  if (segment_fd < 0 || ftruncate(segment_fd, sizeof(struct ShmSegment)) < 0 ||
+      make_notifier(server_wake) < 0 || make_notifier(client_wake) < 0) {
+    goto fail;
+  }
+  segment = mmap(NULL, sizeof(struct ShmSegment), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, segment_fd, 0);
+  if (segment == MAP_FAILED) {
+    goto fail;
+  }
+  // both readers start out empty and waiting for their first frame
+  segment->to_server.consumer_waiting = 1;
+  segment->to_client.consumer_waiting = 1;
+
+  // hand the client its end of everything, the socket stays open only to
+  // tell us when the client is gone
+  int handoff[SHM_HANDOFF_FDS] = {segment_fd, client_wake[0], client_wake[1],
+                                  server_wake[1]};
+  char byte = 0;
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(handoff))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(handoff));
+  memcpy(CMSG_DATA(cmsg), handoff, sizeof(handoff));
+  if (sendmsg(sock, &msg, 0) < 0) {
+    goto fail;
+  }
+
+  close(segment_fd);
+  if (client_wake[0] != client_wake[1]) {
+    close(client_wake[0]);
+  }
+  int fd = register_channel(segment, 1, server_wake[0], server_wake[1],
+                            client_wake[1], sock);
+  if (fd < 0) {
+    close(sock);
+    munmap(segment, sizeof(struct ShmSegment));
+    close(server_wake[0]);
+    if (server_wake[1] != server_wake[0]) {
+      close(server_wake[1]);
+    }
+    close(client_wake[1]);
+  }
+  return fd;
+
+fail:
+  perror("shm_accept");
+  if (segment != MAP_FAILED) {
+    munmap(segment, sizeof(struct ShmSegment));
+  }
+  for (int i = 0; i < 2; i++) {
+    if (server_wake[i] >= 0 && (i == 0 || server_wake[1] != server_wake[0])) {
+      close(server_wake[i]);
+    }
+    if (client_wake[i] >= 0 && (i == 0 || client_wake[1] != client_wake[0])) {
+      close(client_wake[i]);
+    }
+  }
+  if (segment_fd >= 0) {
+    close(segment_fd);
+  }
+  close(sock);
+  return -1;
+}
+
+int shm_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) < 0) {
+    return -1;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    printf("failed to connect to local server at %s\n", path);
+    perror("connect");
+    close(sock);
+    return -1;
+  }
+
+  int handoff[SHM_HANDOFF_FDS];
+  char byte;
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(handoff))];
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n = recvmsg(sock, &msg, 0);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (n <= 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(handoff))) {
+    fprintf(stderr, "local server did not hand over a segment\n");
+    close(sock);
+    return -1;
+  }
+  memcpy(handoff, CMSG_DATA(cmsg), sizeof(handoff));
+
+  struct ShmSegment *segment =
+      mmap(NULL, sizeof(struct ShmSegment), PROT_READ | PROT_WRITE,
+           MAP_SHARED, handoff[0], 0);
+  close(handoff[0]);
+  int fd = -1;
+  if (segment != MAP_FAILED) {
+    // the server watches our end of the socket to notice if we crash
+    fd = register_channel(segment, 0, handoff[1], handoff[2], handoff[3],
+                          sock);
+  }
+  if (fd < 0) {
+    close(sock);
+    if (segment != MAP_FAILED) {
+      munmap(segment, sizeof(struct ShmSegment));
+    }
+    for (int i = 1; i < SHM_HANDOFF_FDS; i++) {
+      close(handoff[i]);
+    }
+  }
+  return fd;
+}
+
+struct ShmChannel *shm_channel(int fd) {
+  if (fd < 0 || fd >= SHM_MAX_FD || channels[fd] == NULL) {
+    return NULL;
+  }
+  return &channels[fd]->channel;
+}
+
+int shm_hangup_fd(int fd) {
+  struct ShmChannel *channel = shm_channel(fd);
+  return channel != NULL ? channel->hangup_fd : -1;
+}
+
+void shm_peer_gone(struct ShmChannel *channel) {
+  // the flag the peer would have set in shm_close
+  __atomic_store_n(&channel->rx->closed, 1, __ATOMIC_RELEASE);
+  notifier_signal(channels[channel->wake_fd]->wake_write_fd);
+}
+
+static uint32_t ring_used(struct ShmRing *ring) {
+  return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+ssize_t shm_send(struct ShmChannel *channel, const void *buf, size_t len) {
+  struct ShmRing *tx = channel->tx;
+  if (__atomic_load_n(&channel->rx->closed, __ATOMIC_ACQUIRE)) {
+    return -1;
+  }
+  if (len > SHM_RING_SIZE) {
+    return -1;
+  }
+
+  uint32_t tail = tx->tail; // only we move it
+  uint32_t head = __atomic_load_n(&tx->head, __ATOMIC_ACQUIRE);
+  if (SHM_RING_SIZE - (tail - head) < len) {
+    // ask for a wake-up, then look again in case space freed meanwhile
+    __atomic_store_n(&tx->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&tx->head, __ATOMIC_SEQ_CST);
+    if (SHM_RING_SIZE - (tail - head) < len) {
+      return 0;
+    }
+    __atomic_store_n(&tx->producer_waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  // frames are written whole so a reader never sees half of one
+  uint32_t offset = tail & (SHM_RING_SIZE - 1);
+  size_t first = SHM_RING_SIZE - offset < len ? SHM_RING_SIZE - offset : len;
+  memcpy(tx->data + offset, buf, first);
+  memcpy(tx->data, (const uint8_t *)buf + first, len - first);
+  __atomic_store_n(&tx->tail, tail + (uint32_t)len, __ATOMIC_SEQ_CST);
+
+  // a reader with data left has not slept, only one that asked is woken
+  if (__atomic_load_n(&tx->consumer_waiting, __ATOMIC_SEQ_CST) &&
+      __atomic_exchange_n(&tx->consumer_waiting, 0, __ATOMIC_SEQ_CST)) {
+    notifier_signal(channel->peer_wake_fd);
+  }
+  return len;
+}
+
+// keeps the wake fd readable exactly while the ring holds data: asks the
+// writer for a wake-up before clearing the fd, then looks again so a frame
+// published in between is not slept through
+static void rearm(struct ShmChannel *channel) {
+  struct ShmEndpoint *endpoint = channels[channel->wake_fd];
+  __atomic_store_n(&channel->rx->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+  notifier_drain(channel->wake_fd);
+  if (__atomic_load_n(&channel->rx->tail, __ATOMIC_SEQ_CST) !=
+      channel->rx->head) {
+    notifier_signal(endpoint->wake_write_fd);
+  }
+}
+
+ssize_t shm_recv(struct ShmChannel *channel, void *buf, size_t len) {
+  struct ShmRing *rx = channel->rx;
+  uint32_t head = rx->head; // only we move it
+  uint32_t used = __atomic_load_n(&rx->tail, __ATOMIC_ACQUIRE) - head;
+  if (used == 0) {
+    if (__atomic_load_n(&rx->closed, __ATOMIC_ACQUIRE)) {
+      return -1;
+    }
+    rearm(channel);
+    return 0;
+  }
+
+  size_t n = used < len ? used : len;
+  uint32_t offset = head & (SHM_RING_SIZE - 1);
+  size_t first = SHM_RING_SIZE - offset < n ? SHM_RING_SIZE - offset : n;
+  memcpy(buf, rx->data + offset, first);
+  memcpy((uint8_t *)buf + first, rx->data, n - first);
+  __atomic_store_n(&rx->head, head + (uint32_t)n, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&rx->producer_waiting, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&rx->producer_waiting, 0, __ATOMIC_RELAXED);
+    notifier_signal(channel->peer_wake_fd);
+  }
+  if (n == used) {
+    rearm(channel);
+  }
+  return n;
+}
+
+int shm_frame_ready(struct ShmChannel *channel) {
+  if (ring_used(channel->rx) >= sizeof(uint32_t) ||
+      __atomic_load_n(&channel->rx->closed, __ATOMIC_ACQUIRE)) {
+    return 1;
+  }
+  // woken for space or a stale signal, clear it so poll() blocks again
+  rearm(channel);
+  return ring_used(channel->rx) >= sizeof(uint32_t);
+}
+
+// what shm_wait waits for, loads ordered after the waiting flag's store
+static int wait_done(struct ShmChannel *channel, size_t space) {
+  if (__atomic_load_n(&channel->rx->closed, __ATOMIC_SEQ_CST)) {
+    return 1;
+  }
+  struct ShmRing *ring = space > 0 ? channel->tx : channel->rx;
+  uint32_t used = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) -
+                  __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+  return space > 0 ? SHM_RING_SIZE - used >= space : used > 0;
+}
+
+void shm_wait(struct ShmChannel *channel, size_t space) {
+  struct ShmEndpoint *endpoint = channels[channel->wake_fd];
+  uint32_t *waiting = space > 0 ? &channel->tx->producer_waiting
+                                : &channel->rx->consumer_waiting;
+  // the wake fd is also readable while rx holds data, clear it before each
+  // poll so that waiting for space does not spin on unread frames
+  for (;;) {
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    notifier_drain(channel->wake_fd);
+    if (wait_done(channel, space)) {
+      break;
+    }
+    struct pollfd pfd = {channel->wake_fd, POLLIN, 0};
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+    }
+  }
+  if (ring_used(channel->rx) > 0) {
+    notifier_signal(endpoint->wake_write_fd);
+  }
+}
+
+void shm_close(int fd) {
+  struct ShmEndpoint *endpoint =
+      (fd >= 0 && fd < SHM_MAX_FD) ? channels[fd] : NULL;
+  if (endpoint == NULL) {
+    return;
+  }
+  struct ShmChannel *channel = &endpoint->channel;
+  __atomic_store_n(&channel->tx->closed, 1, __ATOMIC_RELEASE);
+  notifier_signal(channel->peer_wake_fd);
+
+  munmap(channel->segment, sizeof(struct ShmSegment));
+  close(channel->wake_fd);
+  if (endpoint->wake_write_fd != channel->wake_fd) {
+    close(endpoint->wake_write_fd);
+  }
+  close(channel->peer_wake_fd);
+  close(channel->hangup_fd);
+  channels[fd] = NULL;
+  free(endpoint);
+}
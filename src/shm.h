@@ -0,0 +1,92 @@
+#ifndef UNO_SHM_H
+#define UNO_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Same-host transport: a shared memory segment holding one single-producer
+// single-consumer byte ring per direction. Each side owns a wake fd (an
+// eventfd on Linux, a pipe elsewhere) that the peer signals when it
+// publishes data or frees space the owner is waiting for, so the wake fd can
+// sit in poll()/select() next to TCP sockets. A channel is looked up by its
+// wake fd, which is what send_packet()/read_packet() get passed.
+
+#define SHM_RING_SIZE (64 * 1024) // power of two
+#define SHM_MAX_FD 65536
+#define SHM_CACHE_LINE 64
+
+struct ShmRing {
+  uint32_t head; // consumer position, free running
+  char pad_head[SHM_CACHE_LINE - sizeof(uint32_t)];
+  uint32_t tail; // producer position, free running
+  char pad_tail[SHM_CACHE_LINE - sizeof(uint32_t)];
+  uint32_t producer_waiting; // producer found the ring full
+  uint32_t consumer_waiting; // consumer found the ring empty
+  uint32_t closed;           // producer hung up
+  char pad_flags[SHM_CACHE_LINE - 3 * sizeof(uint32_t)];
+  uint8_t data[SHM_RING_SIZE];
+};
+
+struct ShmSegment {
+  struct ShmRing to_server;
+  struct ShmRing to_client;
+};
+
+struct ShmChannel {
+  struct ShmSegment *segment;
+  struct ShmRing *rx;
+  struct ShmRing *tx;
+  int wake_fd;      // ours, readable when the peer signalled us
+  int peer_wake_fd; // written to signal the peer
+  int hangup_fd;    // the handoff socket, kept open so that a peer that
+                    // exits without closing the channel shows as a hangup
+};
+
+// eventfd where we have one, otherwise a non-blocking pipe: fds[0] is
+// polled, fds[1] written (the same fd for an eventfd)
+int make_notifier(int fds[2]);
+
+// makes a notifier readable
+void notifier_signal(int fd);
+
+// clears a notifier so poll() blocks on it again
+void notifier_drain(int fd);
+
+// unix socket the server hands segments out on
+int shm_listen(const char *path);
+
+// creates a segment for a client waiting on listen_fd, returns the wake fd
+int shm_accept(int listen_fd);
+
+// client side of shm_accept, returns the wake fd
+int shm_connect(const char *path);
+
+// channel behind a wake fd, NULL for ordinary sockets
+struct ShmChannel *shm_channel(int fd);
+
+// the channel's handoff socket, to poll next to the wake fd: it turns
+// readable once the peer process is gone. -1 for ordinary sockets
+int shm_hangup_fd(int fd);
+
+// marks the channel closed by a peer that died without saying so, reads
+// then fail once the ring is drained
+void shm_peer_gone(struct ShmChannel *channel);
+
+// all or nothing: len when written, 0 if the ring is full, -1 if closed
+ssize_t shm_send(struct ShmChannel *channel, const void *buf, size_t len);
+
+// bytes copied, 0 if nothing is buffered, -1 once the peer closed and the
+// ring is drained
+ssize_t shm_recv(struct ShmChannel *channel, void *buf, size_t len);
+
+// 1 if a whole frame is buffered or the peer closed
+int shm_frame_ready(struct ShmChannel *channel);
+
+// blocks until the ring holds data, or with space > 0 until there is room
+// to send that many bytes, or until the peer closed
+void shm_wait(struct ShmChannel *channel, size_t space);
+
+void shm_close(int fd);
+
+#endif // UNO_SHM_H
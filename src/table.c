@@ -0,0 +1,599 @@
+#include "table.h"
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+#include <string.h>
+
+static struct GameState get_game_state_for_client(struct Table *table) {
+  struct GameState state;
+  state.seq = table->seq;
+  state.current_player_id = table->game.current_player;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    state.player_hand_sizes[i] = table->game.hands[i].card_count;
+  }
+  memcpy(&state.top_card, get_top_discard(), sizeof(CardDetails));
+
+  // last_action also needs to be managed when actions are processed.
+  state.direction = (get_direction() > 0) ? 0 : 1; // 0 for clockwise
+  memset(&state.last_action, 0, sizeof(struct Action));
+
+  return state;
+}
+
+static void send_player_hand_to_client(struct Server *server,
+                                       struct Table *table, int conn,
+                                       uint8_t player_id) {
+  struct Packet packet;
+  packet.type = MSG_HAND;
+
+  // finish_turn ends a game before any hand outgrows the packet
+  Hand *hand = &table->game.hands[player_id];
+  packet.data.player_hand.player_id = player_id;
+  packet.data.player_hand.num_cards =
+      hand->card_count < MAX_HAND_SIZE ? hand->card_count : MAX_HAND_SIZE;
+  for (int i = 0; i < packet.data.player_hand.num_cards; i++) {
+    packet.data.player_hand.cards[i] = hand->cards[i];
+  }
+
+  server_send_packet(server, conn, &packet);
+}
+
+// queues one shared frame to every player and spectator at the table
+static void broadcast_buf(struct Server *server, struct Table *table,
+                          struct SharedBuf *buf) {
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (table->seats[i] >= 0) {
+      server_send_buf(server, table->seats[i], buf);
+    }
+  }
+  for (int i = 0; i < table->num_spectators; i++) {
+    server_send_buf(server, table->spectators[i], buf);
+  }
+}
+
+static void broadcast_turn(struct Server *server, struct Table *table) {
+  long long span = trace_begin();
+  // the public state is identical for everyone, share one copy
+  table->seq++;
+  struct Packet state_packet = {MSG_STATE,
+                                .data.game_state =
+                                    get_game_state_for_client(table)};
+  struct SharedBuf *state = share_packet(&state_packet);
+  broadcast_buf(server, table, state);
+
+  // kept for players who drop and resume
+  shared_buf_unref(table->last_state);
+  table->last_state = state;
+
+  // only the hands are private
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (table->seats[i] >= 0) {
+      send_player_hand_to_client(server, table, table->seats[i], i);
+    }
+  }
+  trace_end("broadcast", span);
+}
+
+static void broadcast_game_over(struct Server *server, struct Table *table,
+                                int winner) {
+  long long span = trace_begin();
+  struct Packet game_over_packet = {MSG_GAME_OVER, .data.winner_id = winner};
+  struct SharedBuf *game_over = share_packet(&game_over_packet);
+  broadcast_buf(server, table, game_over);
+  shared_buf_unref(game_over);
+  trace_end("broadcast", span);
+}
+
+static void start_timer_fired(struct Timer *timer, long long now_ms);
+static void bot_timer_fired(struct Timer *timer, long long now_ms);
+static void turn_timer_fired(struct Timer *timer, long long now_ms);
+static void abandon_timer_fired(struct Timer *timer, long long now_ms);
+static void close_timer_fired(struct Timer *timer, long long now_ms);
+
+static int connected_humans(struct Table *table) {
+  int count = 0;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (table->seats[i] >= 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// arms the bot move or the human's deadline for the turn that just began,
+// the game pauses while nobody is connected
+static void schedule_turn(struct Server *server, struct Table *table,
+                          long long now_ms) {
+  timer_cancel(&server->timers, &table->bot_timer);
+  timer_cancel(&server->timers, &table->turn_timer);
+  if (connected_humans(table) == 0) {
+    return;
+  }
+  if (table->seats[get_current_player()] < 0) {
+    timer_schedule(&server->timers, &table->bot_timer,
+                   now_ms + server->config.bot_delay_ms);
+  } else {
+    timer_schedule(&server->timers, &table->turn_timer,
+                   now_ms + server->config.turn_timeout_ms);
+  }
+}
+
+// the result goes out before the connections are closed: the table stops
+// taking moves and closes once every queue has drained, or after
+// GAME_OVER_GRACE_MS for a client that is not reading
+static void finish_game(struct Server *server, int table_id, int winner,
+                        long long now_ms) {
+  struct Table *table = &server->tables[table_id];
+  table->finished = 1;
+  timer_cancel(&server->timers, &table->bot_timer);
+  timer_cancel(&server->timers, &table->turn_timer);
+  timer_cancel(&server->timers, &table->abandon_timer);
+  broadcast_game_over(server, table, winner);
+  timer_schedule(&server->timers, &table->close_timer,
+                 now_ms + GAME_OVER_GRACE_MS);
+  table_output_drained(server, table_id);
+}
+
+// a MSG_HAND holds MAX_HAND_SIZE cards. Past that the server can no longer
+// show a player their hand, so the game ends there: -1 while every hand
+// fits, otherwise the seat with the fewest cards, which wins
+static int hand_overflow_winner(struct Table *table) {
+  int winner = 0, overflow = 0;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    int count = table->game.hands[i].card_count;
+    if (count > MAX_HAND_SIZE) {
+      overflow = 1;
+    }
+    if (count < table->game.hands[winner].card_count) {
+      winner = i;
+    }
+  }
+  return overflow ? winner : -1;
+}
+
+// returns 1 if the game ended, normally because the player who just moved
+// emptied their hand. start_us is when handling the turn began, for the
+// turn time metric
+static int finish_turn(struct Server *server, int table_id, int player,
+                       long long now_ms, long long start_us) {
+  struct Table *table = &server->tables[table_id];
+  metric_add(METRIC_TURNS, 1);
+  int winner = -1;
+  if (table->game.hands[player].card_count == 0) {
+    LOG_INFO("Table %d: player %d has won the game!", table_id, player);
+    winner = player;
+  } else if ((winner = hand_overflow_winner(table)) >= 0) {
+    LOG_WARN("Table %d: a hand grew past %d cards, ending the game with "
+             "player %d ahead",
+             table_id, MAX_HAND_SIZE, winner);
+  }
+  if (winner >= 0) {
+    finish_game(server, table_id, winner, now_ms);
+    metric_add(METRIC_GAMES_FINISHED, 1);
+    metric_record(METRIC_TURN_US, server_now_us() - start_us);
+    return 1;
+  }
+
+  broadcast_turn(server, table);
+  schedule_turn(server, table, now_ms);
+  metric_record(METRIC_TURN_US, server_now_us() - start_us);
+  return 0;
+}
+
+int table_open(struct Server *server, int is_private, long long now_ms) {
+  for (int i = 0; i < MAX_TABLES; i++) {
+    struct Table *table = &server->tables[i];
+    if (table->in_use) {
+      continue;
+    }
+    // every table gets a code so spectators can find it, only private
+    // tables can be joined with it
+    char code[GAME_CODE_LEN + 1] = {0};
+    do {
+      lobby_make_code(code);
+    } while (table_find_watchable(server, code) >= 0);
+    memset(table, 0, sizeof(*table));
+    table->in_use = 1;
+    table->is_private = is_private;
+    memcpy(table->code, code, sizeof(table->code));
+    for (int s = 0; s < MAX_PLAYERS; s++) {
+      table->seats[s] = -1;
+    }
+    timer_init(&table->start_timer, start_timer_fired, server, i);
+    timer_init(&table->bot_timer, bot_timer_fired, server, i);
+    timer_init(&table->turn_timer, turn_timer_fired, server, i);
+    timer_init(&table->abandon_timer, abandon_timer_fired, server, i);
+    timer_init(&table->close_timer, close_timer_fired, server, i);
+    if (is_private) {
+      timer_schedule(&server->timers, &table->start_timer,
+                     now_ms + server->config.private_wait_ms);
+    }
+    server->num_tables++;
+    metric_add(METRIC_TABLES_OPENED, 1);
+    metric_gauge_add(METRIC_TABLES_ACTIVE, 1);
+    return i;
+  }
+  return -1;
+}
+
+int table_seat(struct Server *server, int table_id, int conn,
+               long long now_ms) {
+  struct Table *table = &server->tables[table_id];
+  if (table->started || table->humans >= MAX_PLAYERS) {
+    return -1;
+  }
+  int seat = table->humans++;
+  table->seats[seat] = conn;
+  if (table->is_private) {
+    timer_schedule(&server->timers, &table->start_timer,
+                   now_ms + server->config.private_wait_ms);
+  }
+  server->conns[conn].table_id = table_id;
+  server->conns[conn].seat = seat;
+  return seat;
+}
+
+void table_start(struct Server *server, int table_id, long long now_ms) {
+  struct Table *table = &server->tables[table_id];
+  table->started = 1;
+  timer_cancel(&server->timers, &table->start_timer);
+
+  set_active_game(&table->game);
+  init_game();
+
+  LOG_INFO("Table %d (%s): starting with %d players and %d bots", table_id,
+           table->code, table->humans, MAX_PLAYERS - table->humans);
+
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (table->seats[i] < 0) {
+      continue;
+    }
+    table->sessions[i] = lobby_make_session();
+    struct Packet packet = {0};
+    packet.type = MSG_WELCOME;
+    packet.data.welcome.player_id = i;
+    packet.data.welcome.session = table->sessions[i];
+    server_send_packet(server, table->seats[i], &packet);
+  }
+
+  broadcast_turn(server, table);
+  schedule_turn(server, table, now_ms);
+}
+
+static void start_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  LOG_INFO("Table %d: nobody joined in time, filling with bots", timer->arg);
+  table_start(server, timer->arg, now_ms);
+}
+
+static void bot_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  int table_id = timer->arg;
+  struct Table *table = &server->tables[table_id];
+  long long start_us = server_now_us();
+  long long turn = trace_turn_begin(table_id);
+
+  set_active_game(&table->game);
+  int current_player = get_current_player();
+  long long span = trace_begin();
+  int bot_result = bot_play(current_player);
+  trace_end("bot_play", span);
+  if (bot_result < 0) {
+    LOG_ERROR("Table %d: bot turn failed for player %d", table_id,
+              current_player);
+    table_close(server, table_id);
+    trace_turn_end("bot_turn", turn);
+    return;
+  }
+
+  next_player();
+  finish_turn(server, table_id, current_player, now_ms, start_us);
+  trace_turn_end("bot_turn", turn);
+}
+
+static void abandon_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  (void)now_ms;
+  LOG_INFO("Table %d: nobody came back, closing", timer->arg);
+  table_close(server, timer->arg);
+}
+
+static void close_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  (void)now_ms;
+  LOG_WARN("Table %d: game over not delivered to everyone in time, closing",
+           timer->arg);
+  table_close(server, timer->arg);
+}
+
+static void turn_timer_fired(struct Timer *timer, long long now_ms) {
+  struct Server *server = timer->ctx;
+  int table_id = timer->arg;
+  struct Table *table = &server->tables[table_id];
+  long long start_us = server_now_us();
+  long long turn = trace_turn_begin(table_id);
+
+  set_active_game(&table->game);
+  int current_player = get_current_player();
+  LOG_WARN("Table %d: player %d ran out of time, drawing for them", table_id,
+           current_player);
+  pickup_card(current_player);
+  next_player();
+  finish_turn(server, table_id, current_player, now_ms, start_us);
+  trace_turn_end("timeout_turn", turn);
+}
+
+void table_handle_packet(struct Server *server, int table_id, int seat,
+                         struct Packet *packet, long long now_ms) {
+  struct Table *table = &server->tables[table_id];
+  int conn = table->seats[seat];
+  if (!table->started || table->finished || packet->type != MSG_ACTION) {
+    return;
+  }
+  long long start_us = server_now_us();
+
+  set_active_game(&table->game);
+  int current_player = get_current_player();
+  if (seat != current_player) {
+    struct Packet error_packet = {MSG_ERROR,
+                                  .data.error_code = ERROR_NOT_YOUR_TURN};
+    server_send_packet(server, conn, &error_packet);
+    return;
+  }
+
+  struct Action action = packet->data.action;
+  int result;
+
+  long long span = trace_begin();
+  switch (action.type) {
+  case ACTION_PLAY_CARD:
+    LOG_INFO("\tPlayer %d attempts to play card at index %d", current_player,
+             action.card_index);
+    result = play_card(current_player, action.card_index);
+    if (result == -1) {
+      // Invalid play, the player keeps the turn
+      LOG_WARN("\tInvalid play by player %d: card index %d", current_player,
+               action.card_index);
+      trace_end("play_card", span);
+      struct Packet error_packet = {MSG_ERROR,
+                                    .data.error_code = ERROR_INVALID_ACTION};
+      server_send_packet(server, conn, &error_packet);
+      return;
+    }
+    if (result == 4 || result == 5) { // wild card
+      change_color(action.chosen_color);
+    }
+    next_player();
+    break;
+  case ACTION_DRAW_CARD:
+    pickup_card(current_player);
+    // TODO: Implement logic for playing after drawing or skipping after
+    // drawing.
+    next_player(); // Advance turn after drawing
+    break;
+  case ACTION_SKIPPED:
+    next_player();
+    break;
+  default:
+    return;
+  }
+  trace_end("play_card", span);
+
+  finish_turn(server, table_id, current_player, now_ms, start_us);
+  // from the packet being polled to every frame of the turn queued
+  metric_record(METRIC_ACTION_TO_BROADCAST_US,
+                server_now_us() - server->action_start_us);
+}
+
+void table_player_left(struct Server *server, int table_id, int seat) {
+  struct Table *table = &server->tables[table_id];
+  if (table->finished) {
+    table->seats[seat] = -1;
+    table_output_drained(server, table_id);
+    return;
+  }
+  if (table->started) {
+    // keep the session so the player can come back to this seat
+    table->seats[seat] = -1;
+    long long now_ms = server_now_ms();
+    if (connected_humans(table) == 0) {
+      LOG_INFO("Table %d: every player dropped, waiting %d ms for one to "
+               "resume",
+               table_id, server->config.resume_grace_ms);
+      timer_schedule(&server->timers, &table->abandon_timer,
+                     now_ms + server->config.resume_grace_ms);
+    } else {
+      LOG_INFO("Table %d: player %d dropped, a bot covers the seat", table_id,
+               seat);
+    }
+    set_active_game(&table->game);
+    if (get_current_player() == seat || connected_humans(table) == 0) {
+      schedule_turn(server, table, now_ms);
+    }
+    return;
+  }
+
+  // still waiting for players, close the gap so seats stay contiguous
+  for (int i = seat; i < table->humans - 1; i++) {
+    table->seats[i] = table->seats[i + 1];
+    server->conns[table->seats[i]].seat = i;
+  }
+  table->humans--;
+  table->seats[table->humans] = -1;
+  if (table->humans == 0) {
+    table_close(server, table_id);
+    return;
+  }
+  table_send_lobby_status(server, table_id);
+}
+
+void table_close(struct Server *server, int table_id) {
+  struct Table *table = &server->tables[table_id];
+  if (!table->in_use) {
+    return;
+  }
+  if (table->started) {
+    set_active_game(&table->game);
+    cleanup();
+    set_active_game(NULL);
+  }
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (table->seats[i] >= 0) {
+      server_close_connection(server, table->seats[i]);
+    }
+  }
+  for (int i = 0; i < table->num_spectators; i++) {
+    server_close_connection(server, table->spectators[i]);
+  }
+  table->num_spectators = 0;
+  timer_cancel(&server->timers, &table->start_timer);
+  timer_cancel(&server->timers, &table->bot_timer);
+  timer_cancel(&server->timers, &table->turn_timer);
+  timer_cancel(&server->timers, &table->abandon_timer);
+  timer_cancel(&server->timers, &table->close_timer);
+  shared_buf_unref(table->last_state);
+  table->last_state = NULL;
+  table->in_use = 0;
+  server->num_tables--;
+  metric_gauge_add(METRIC_TABLES_ACTIVE, -1);
+}
+
+void table_output_drained(struct Server *server, int table_id) {
+  struct Table *table = &server->tables[table_id];
+  if (!table->in_use || !table->finished) {
+    return;
+  }
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (table->seats[i] >= 0 && server->conns[table->seats[i]].out.count > 0) {
+      return;
+    }
+  }
+  for (int i = 0; i < table->num_spectators; i++) {
+    if (server->conns[table->spectators[i]].out.count > 0) {
+      return;
+    }
+  }
+  table_close(server, table_id);
+}
+
+void table_send_lobby_status(struct Server *server, int table_id) {
+  struct Table *table = &server->tables[table_id];
+  struct Packet packet = {0};
+  packet.type = MSG_WAITING_FOR_PLAYERS;
+  packet.data.lobby.num_players = table->humans;
+  packet.data.lobby.seats = MAX_PLAYERS;
+  memcpy(packet.data.lobby.code, table->code, sizeof(packet.data.lobby.code));
+  struct SharedBuf *status = share_packet(&packet);
+  broadcast_buf(server, table, status);
+  shared_buf_unref(status);
+}
+
+int table_find_code(struct Server *server, const char *code) {
+  for (int i = 0; i < MAX_TABLES; i++) {
+    struct Table *table = &server->tables[i];
+    if (table->in_use && table->is_private && !table->started &&
+        strncmp(table->code, code, GAME_CODE_LEN) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int table_find_watchable(struct Server *server, const char *code) {
+  for (int i = 0; i < MAX_TABLES; i++) {
+    struct Table *table = &server->tables[i];
+    if (!table->in_use || table->finished) {
+      continue;
+    }
+    // no code picks whatever game is already running
+    if (code[0] == '\0' ? table->started
+                        : strncmp(table->code, code, GAME_CODE_LEN) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int table_add_spectator(struct Server *server, int table_id, int conn) {
+  struct Table *table = &server->tables[table_id];
+  if (table->num_spectators >= MAX_SPECTATORS) {
+    return -1;
+  }
+  table->spectators[table->num_spectators++] = conn;
+  server->conns[conn].table_id = table_id;
+  server->conns[conn].seat = -1;
+  server->conns[conn].spectator = 1;
+
+  struct Packet welcome = {0};
+  welcome.type = MSG_WELCOME;
+  welcome.data.welcome.player_id = SPECTATOR_ID;
+  server_send_packet(server, conn, &welcome);
+
+  // late watchers start from the current turn
+  if (table->started) {
+    set_active_game(&table->game);
+    struct Packet state_packet = {MSG_STATE,
+                                  .data.game_state =
+                                      get_game_state_for_client(table)};
+    server_send_packet(server, conn, &state_packet);
+  }
+  return 0;
+}
+
+void table_spectator_left(struct Server *server, int table_id, int conn) {
+  struct Table *table = &server->tables[table_id];
+  for (int i = 0; i < table->num_spectators; i++) {
+    if (table->spectators[i] == conn) {
+      table->spectators[i] = table->spectators[--table->num_spectators];
+      table_output_drained(server, table_id);
+      return;
+    }
+  }
+}
+
+int table_resume(struct Server *server, int conn, uint64_t session,
+                 uint32_t last_seq, long long now_ms) {
+  for (int id = 0; id < MAX_TABLES; id++) {
+    struct Table *table = &server->tables[id];
+    if (!table->in_use || !table->started || table->finished) {
+      continue;
+    }
+    for (int seat = 0; seat < MAX_PLAYERS; seat++) {
+      if (session == 0 || table->sessions[seat] != session) {
+        continue;
+      }
+      if (table->seats[seat] >= 0) {
+        // the old connection has not timed out yet, this one wins
+        server_close_connection(server, table->seats[seat]);
+      }
+      table->seats[seat] = conn;
+      server->conns[conn].table_id = id;
+      server->conns[conn].seat = seat;
+      timer_cancel(&server->timers, &table->abandon_timer);
+
+      struct Packet welcome = {0};
+      welcome.type = MSG_WELCOME;
+      welcome.data.welcome.player_id = seat;
+      welcome.data.welcome.session = session;
+      server_send_packet(server, conn, &welcome);
+
+      // every MSG_STATE is a full snapshot, the latest one alone brings
+      // the client up to date however many it missed
+      server_send_buf(server, conn, table->last_state);
+      set_active_game(&table->game);
+      send_player_hand_to_client(server, table, conn, seat);
+      LOG_INFO("Table %d: player %d resumed at seq %u (%u behind)", id, seat,
+               last_seq, table->seq - last_seq);
+
+      // take the turn back from the covering bot, or restart a paused game,
+      // without touching another player's running deadline
+      if (get_current_player() == seat ||
+          (!timer_pending(&table->bot_timer) &&
+           !timer_pending(&table->turn_timer))) {
+        schedule_turn(server, table, now_ms);
+      }
+      return seat;
+    }
+  }
+  return -1;
+}
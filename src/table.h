@@ -0,0 +1,50 @@
+#ifndef UNO_TABLE_H
+#define UNO_TABLE_H
+
+#include "server.h"
+
+// claims a free table, returns its id or -1 when the server is full
+int table_open(struct Server *server, int is_private, long long now_ms);
+
+// seats a lobby connection, returns the seat or -1 if the table is full
+int table_seat(struct Server *server, int table_id, int conn, long long now_ms);
+
+// fills empty seats with bots, deals and sends the first turn
+void table_start(struct Server *server, int table_id, long long now_ms);
+
+// handles a packet from a seated player
+void table_handle_packet(struct Server *server, int table_id, int seat,
+                         struct Packet *packet, long long now_ms);
+
+// a seated player went away, a bot covers a started game's seat until the
+// player resumes
+void table_player_left(struct Server *server, int table_id, int seat);
+
+// puts a returning player back in their seat and sends the current state,
+// which is a full snapshot, and their hand. -1 if no table has the session
+int table_resume(struct Server *server, int conn, uint64_t session,
+                 uint32_t last_seq, long long now_ms);
+
+// frees the game and closes every human connection at the table
+void table_close(struct Server *server, int table_id);
+
+// a connection at the table has written everything it had queued, a
+// finished table closes once that is true of all of them
+void table_output_drained(struct Server *server, int table_id);
+
+// tells everyone at a table that has not started who is there
+void table_send_lobby_status(struct Server *server, int table_id);
+
+// private table with this code that is still waiting for players, or -1
+int table_find_code(struct Server *server, const char *code);
+
+// table with this code in any state, or the first running table when the
+// code is empty, -1 if none
+int table_find_watchable(struct Server *server, const char *code);
+
+// adds a read-only viewer that gets every public update
+int table_add_spectator(struct Server *server, int table_id, int conn);
+
+void table_spectator_left(struct Server *server, int table_id, int conn);
+
+#endif // UNO_TABLE_H
@@ -0,0 +1,162 @@
+#include "timer.h"
+#include <stddef.h>
+#include <string.h>
+
+void timer_wheel_init(struct TimerWheel *wheel, long long now_ms) {
+  memset(wheel, 0, sizeof(*wheel));
+  wheel->clock = now_ms;
+}
+
+void timer_init(struct Timer *timer, timer_fn fn, void *ctx, int arg) {
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->expires = 0;
+  timer->fn = fn;
+  timer->ctx = ctx;
+  timer->arg = arg;
+}
+
+static void link_timer(struct TimerWheel *wheel, struct Timer *timer) {
+  long long expires = timer->expires;
+  long long delta = expires - wheel->clock;
+  int level = 0;
+
+  if (delta < 0) {
+    expires = wheel->clock; // overdue, runs on the next tick processed
+    delta = 0;
+  }
+  while (level < TIMER_LEVELS - 1 &&
+         delta >= (1LL << (TIMER_BITS * (level + 1)))) {
+    level++;
+  }
+  if (level == TIMER_LEVELS - 1 &&
+      delta >= (1LL << (TIMER_BITS * TIMER_LEVELS))) {
+    // beyond the wheel, park it in the furthest slot and cascade again
+    expires = wheel->clock + (1LL << (TIMER_BITS * TIMER_LEVELS)) - 1;
+  }
+
+  struct Timer **slot =
+      &wheel->slots[level][(expires >> (TIMER_BITS * level)) & TIMER_MASK];
+  timer->next = *slot;
+  if (*slot) {
+    (*slot)->pprev = &timer->next;
+  }
+  timer->pprev = slot;
+  *slot = timer;
+}
+
+static void unlink_timer(struct Timer *timer) {
+  *timer->pprev = timer->next;
+  if (timer->next) {
+    timer->next->pprev = timer->pprev;
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+}
+
+void timer_schedule(struct TimerWheel *wheel, struct Timer *timer,
+                    long long due_ms) {
+  if (timer->pprev) {
+    unlink_timer(timer);
+    wheel->count--;
+  }
+  timer->expires = due_ms;
+  link_timer(wheel, timer);
+  wheel->count++;
+}
+
+void timer_cancel(struct TimerWheel *wheel, struct Timer *timer) {
+  if (timer->pprev) {
+    unlink_timer(timer);
+    wheel->count--;
+  }
+}
+
+int timer_pending(const struct Timer *timer) { return timer->pprev != NULL; }
+
+// moves one slot of a higher level down now that its range is close
+static void cascade(struct TimerWheel *wheel, int level) {
+  int index = (wheel->clock >> (TIMER_BITS * level)) & TIMER_MASK;
+  struct Timer *timer = wheel->slots[level][index];
+  wheel->slots[level][index] = NULL;
+  while (timer) {
+    struct Timer *next = timer->next;
+    link_timer(wheel, timer);
+    timer = next;
+  }
+}
+
+void timer_wheel_advance(struct TimerWheel *wheel, long long now_ms) {
+  if (wheel->count == 0) {
+    wheel->clock = now_ms + 1;
+    return;
+  }
+
+  while (wheel->clock <= now_ms) {
+    int index = wheel->clock & TIMER_MASK;
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+      if ((wheel->clock & ((1LL << (TIMER_BITS * level)) - 1)) != 0) {
+        break;
+      }
+      cascade(wheel, level);
+    }
+
+    // callbacks may re-arm into this same slot, keep going until it drains
+    struct Timer **slot = &wheel->slots[0][index];
+    while (*slot) {
+      struct Timer *timer = *slot;
+      unlink_timer(timer);
+      wheel->count--;
+      timer->fn(timer, now_ms);
+    }
+    wheel->clock++;
+
+    if (wheel->count == 0) {
+      wheel->clock = now_ms + 1;
+      return;
+    }
+  }
+}
+
+int timer_wheel_timeout(const struct TimerWheel *wheel, long long now_ms) {
+  if (wheel->count == 0) {
+    return -1;
+  }
+
+  // levels cover disjoint, increasing ranges, so the first busy slot of each
+  // level holds that level's earliest timers
+  long long earliest = -1;
+  for (int level = 0; level < TIMER_LEVELS; level++) {
+    int shift = TIMER_BITS * level;
+    int position = (wheel->clock >> shift) & TIMER_MASK;
+    // a higher level's current slot was emptied when the clock entered it,
+    // unless the clock sits on the boundary and that cascade is still due
+    int first = 0;
+    if (level > 0 && (wheel->clock & ((1LL << shift) - 1)) != 0) {
+      first = 1;
+    }
+    for (int i = first; i < TIMER_SLOTS + first; i++) {
+      const struct Timer *timer =
+          wheel->slots[level][(position + i) & TIMER_MASK];
+      if (!timer) {
+        continue;
+      }
+      for (; timer; timer = timer->next) {
+        if (earliest < 0 || timer->expires < earliest) {
+          earliest = timer->expires;
+        }
+      }
+      break;
+    }
+  }
+
+  // overdue timers still wait for the tick they were parked on
+  if (earliest < wheel->clock) {
+    earliest = wheel->clock;
+  }
+  if (earliest <= now_ms) {
+    return 0;
+  }
+  long long wait = earliest - now_ms;
+  return wait > 0x7fffffff ? 0x7fffffff : (int)wait;
+}
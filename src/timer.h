@@ -0,0 +1,51 @@
+#ifndef UNO_TIMER_H
+#define UNO_TIMER_H
+
+// hierarchical timer wheel with 1 ms ticks, TIMER_LEVELS levels of
+// TIMER_SLOTS slots each reach 64^4 ms (~4.6 hours), later deadlines are
+// clamped to the last slot
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_LEVELS 4
+
+struct Timer;
+
+typedef void (*timer_fn)(struct Timer *timer, long long now_ms);
+
+// embedded in whatever owns the deadline, no allocation when arming
+struct Timer {
+  struct Timer *next;
+  struct Timer **pprev; // NULL when not scheduled
+  long long expires;
+  timer_fn fn;
+  void *ctx;
+  int arg;
+};
+
+struct TimerWheel {
+  long long clock; // next tick to process
+  int count;
+  struct Timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+void timer_wheel_init(struct TimerWheel *wheel, long long now_ms);
+
+void timer_init(struct Timer *timer, timer_fn fn, void *ctx, int arg);
+
+// arms or re-arms the timer, O(1)
+void timer_schedule(struct TimerWheel *wheel, struct Timer *timer,
+                    long long due_ms);
+
+// O(1), safe on a timer that is not scheduled
+void timer_cancel(struct TimerWheel *wheel, struct Timer *timer);
+
+int timer_pending(const struct Timer *timer);
+
+// runs every timer due at or before now_ms
+void timer_wheel_advance(struct TimerWheel *wheel, long long now_ms);
+
+// milliseconds until the next timer fires, -1 if none is scheduled
+int timer_wheel_timeout(const struct TimerWheel *wheel, long long now_ms);
+
+#endif // UNO_TIMER_H
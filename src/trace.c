@@ -0,0 +1,149 @@
+#define _GNU_SOURCE 1 // clock_gettime under -std=c99
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+struct TraceEvent {
+  const char *name; // a string literal, only the pointer is kept
+  int table;
+  long long start_ns;
+  long long dur_ns;
+};
+
+// touched by its own thread only, the file lock is taken to write it out
+struct TraceBuffer {
+  int thread; // numbered in the order threads first traced
+  int count;
+  unsigned long long turns; // seen, sampled or not
+  int table;                // of the turn in progress
+  int sampled;              // the turn in progress is recorded
+  struct TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file;
+static int events_written; // none yet means no separator before the next
+static int sample_every;   // 0 while tracing is off
+static int next_thread;
+static __thread struct TraceBuffer *local_buffer;
+
+static long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int trace_open(const char *path, int every) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  fputs("[", file);
+  pthread_mutex_lock(&file_lock);
+  trace_file = file;
+  events_written = 0;
+  pthread_mutex_unlock(&file_lock);
+  __atomic_store_n(&sample_every, every > 0 ? every : 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void trace_close(void) {
+  if (!trace_enabled()) {
+    return;
+  }
+  trace_flush();
+  __atomic_store_n(&sample_every, 0, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&file_lock);
+  fputs("\n]\n", trace_file);
+  fclose(trace_file);
+  trace_file = NULL;
+  pthread_mutex_unlock(&file_lock);
+}
+
+int trace_enabled(void) {
+  return __atomic_load_n(&sample_every, __ATOMIC_ACQUIRE) != 0;
+}
+
+static struct TraceBuffer *buffer() {
+  if (local_buffer == NULL) {
+    local_buffer = calloc(1, sizeof(struct TraceBuffer));
+    if (local_buffer != NULL) {
+      local_buffer->thread =
+          __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+    }
+  }
+  return local_buffer;
+}
+
+long long trace_clock(void) {
+  return trace_enabled() ? now_ns() : 0;
+}
+
+long long trace_turn_begin(int table_id) {
+  int every = __atomic_load_n(&sample_every, __ATOMIC_ACQUIRE);
+  if (every == 0) {
+    return 0;
+  }
+  struct TraceBuffer *buf = buffer();
+  if (buf == NULL || buf->turns++ % every != 0) {
+    return 0;
+  }
+  buf->table = table_id;
+  buf->sampled = 1;
+  return now_ns();
+}
+
+void trace_turn_end(const char *name, long long start_ns) {
+  trace_end(name, start_ns);
+  if (local_buffer != NULL) {
+    local_buffer->sampled = 0;
+  }
+}
+
+long long trace_begin(void) {
+  return local_buffer != NULL && local_buffer->sampled ? now_ns() : 0;
+}
+
+void trace_end(const char *name, long long start_ns) {
+  struct TraceBuffer *buf = local_buffer;
+  if (start_ns == 0 || buf == NULL) {
+    return;
+  }
+  if (buf->count == TRACE_BUFFER_EVENTS) {
+    trace_flush();
+  }
+  struct TraceEvent *event = &buf->events[buf->count++];
+  event->name = name;
+  event->table = buf->table;
+  event->start_ns = start_ns;
+  event->dur_ns = now_ns() - start_ns;
+}
+
+void trace_flush(void) {
+  struct TraceBuffer *buf = local_buffer;
+  if (buf == NULL || buf->count == 0) {
+    return;
+  }
+  int pid = getpid();
+  pthread_mutex_lock(&file_lock);
+  for (int i = 0; trace_file != NULL && i < buf->count; i++) {
+    const struct TraceEvent *event = &buf->events[i];
+    // a complete event, times in microseconds; each table gets a lane
+    fprintf(trace_file,
+            "%s\n{\"name\":\"%s\",\"cat\":\"turn\",\"ph\":\"X\","
+            "\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"thread\":%d}}",
+            events_written++ ? "," : "", event->name, event->start_ns / 1000,
+            event->start_ns % 1000, event->dur_ns / 1000, event->dur_ns % 1000,
+            pid, event->table, buf->thread);
+  }
+  if (trace_file != NULL) {
+    fflush(trace_file);
+  }
+  pthread_mutex_unlock(&file_lock);
+  buf->count = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef UNO_TRACE_H
+#define UNO_TRACE_H
+
+// Optional per-turn tracing in Chrome trace-event format, for chrome://tracing
+// or Perfetto. Each sampled turn records complete spans for its stages, one
+// lane per table. Spans are buffered per thread with no locking and written
+// out when a buffer fills or its thread calls trace_flush; the file is a
+// JSON array that is never closed, which trace viewers accept, so a server
+// that is killed leaves a readable trace behind.
+
+#define TRACE_BUFFER_EVENTS 4096 // per thread, flushed when full
+#define TRACE_FLUSH_MS 1000      // how often the server flushes its buffer
+
+// starts tracing one turn in sample_every into path. -1 if it cannot be
+// written
+int trace_open(const char *path, int sample_every);
+
+// flushes the calling thread and closes the file
+void trace_close(void);
+
+// nonzero once trace_open succeeded
+int trace_enabled(void);
+
+// the time now while tracing is on, else 0. Starts a span that begins
+// before it is known whether a sampled turn holds it, it can go to
+// trace_end once trace_turn_begin says so
+long long trace_clock(void);
+
+// a turn begins at table_id. Returns its start time, or 0 when tracing is
+// off or the turn was not sampled, in which case the spans inside record
+// nothing
+long long trace_turn_begin(int table_id);
+
+// records the whole turn as a span called name and ends it
+void trace_turn_end(const char *name, long long start_ns);
+
+// start time of a span inside the current turn, 0 outside a sampled turn
+long long trace_begin(void);
+
+// records the span begun at start_ns, nothing when start_ns is 0
+void trace_end(const char *name, long long start_ns);
+
+// writes the calling thread's buffered spans
+void trace_flush(void);
+
+#endif // UNO_TRACE_H
@@ -8,32 +8,43 @@
 #include <time.h>
 
 
-struct GameDetails game_details;
+// engine functions operate on the active table; servers hosting several
+// tables switch it with set_active_game() before each turn
+static struct GameDetails default_game;
+static struct GameDetails* active_game = &default_game;
+
+void set_active_game(struct GameDetails* game) {
+    active_game = game ? game : &default_game;
+}
+
+struct GameDetails* get_active_game() {
+    return active_game;
+}
 
 
 void add_to_hand(uint8_t player_num, CardDetails* card) {
     if (player_num >= 4) return; // invalid player number
-    game_details.hands[player_num].cards = 
-        realloc(game_details.hands[player_num].cards,
-                (game_details.hands[player_num].card_count + 1) * sizeof(CardDetails));
-    game_details.hands[player_num].cards[game_details.hands[player_num].card_count] = *card;
-    game_details.hands[player_num].card_count++;
+    active_game->hands[player_num].cards = 
+        realloc(active_game->hands[player_num].cards,
+                (active_game->hands[player_num].card_count + 1) * sizeof(CardDetails));
+    active_game->hands[player_num].cards[active_game->hands[player_num].card_count] = *card;
+    active_game->hands[player_num].card_count++;
 }
 
 void remove_from_hand(uint8_t player_num, int card_index) {
-    if (player_num >= 4 || card_index >= game_details.hands[player_num].card_count) return; // invalid
-    for (uint8_t i = card_index; i < game_details.hands[player_num].card_count - 1; i++) {
-        game_details.hands[player_num].cards[i] = game_details.hands[player_num].cards[i + 1];
+    if (player_num >= 4 || card_index >= active_game->hands[player_num].card_count) return; // invalid
+    for (uint8_t i = card_index; i < active_game->hands[player_num].card_count - 1; i++) {
+        active_game->hands[player_num].cards[i] = active_game->hands[player_num].cards[i + 1];
     }
-    game_details.hands[player_num].card_count--;
-    game_details.hands[player_num].cards = 
-        realloc(game_details.hands[player_num].cards,
-                game_details.hands[player_num].card_count * sizeof(CardDetails));
+    active_game->hands[player_num].card_count--;
+    active_game->hands[player_num].cards = 
+        realloc(active_game->hands[player_num].cards,
+                active_game->hands[player_num].card_count * sizeof(CardDetails));
 }
 
 Hand* get_player_hand(uint8_t player_num) {
     if (player_num >= 4) return NULL; // invalid
-    return &game_details.hands[player_num];
+    return &active_game->hands[player_num];
 }
 
 void get_card_details(const char* card_text, CardDetails* details) {
@@ -48,7 +59,13 @@ void get_card_details(const char* card_text, CardDetails* details) {
 }
 
 void shuffle_deck(CardDetails* cards, int count) {
-    srand(time(NULL));
+    // seed once, reseeding every shuffle gives tables created in the same
+    // second identical decks
+    static int seeded = 0;
+    if (!seeded) {
+        srand(time(NULL));
+        seeded = 1;
+    }
     for (int i = count - 1; i > 0; i--) {
         int j = rand() % (i + 1);
         CardDetails temp = cards[i];
@@ -57,33 +74,41 @@ void shuffle_deck(CardDetails* cards, int count) {
     }
 }
 
-// dequeu card from deck and add to hand
+// dequeu card from deck and add to hand, NULL once every card is in a hand
 CardDetails* draw_card_from_deck() {
-    if (game_details.deck_stack.stack_top_index < 0) {
-        //refill deck from discard pile except the top card
-        // save last played card to avoid losing it during shuffle
-        CardDetails* last_played_card = &game_details.discard_pile.cards[game_details.discard_pile.stack_top_index];
-        shuffle_deck(game_details.discard_pile.cards, game_details.discard_pile.stack_top_index + 1);
-        CardDetails* temp = game_details.deck_stack.cards;
-        game_details.deck_stack.cards = game_details.discard_pile.cards;
-        game_details.discard_pile.cards = temp;
-        game_details.deck_stack.stack_top_index = game_details.discard_pile.stack_top_index - 1; // -1 to keep the last played card in discard pile
-        game_details.discard_pile.stack_top_index = 0; // reset discard pile to only have the last played card
-        game_details.discard_pile.cards[0] = *last_played_card;
-        
+    if (active_game->deck_stack.stack_top_index < 0) {
+        // refill deck from the discard pile, the top card stays in play
+        int reusable = active_game->discard_pile.stack_top_index;
+        if (reusable <= 0) {
+            return NULL;
+        }
+        CardDetails last_played_card = active_game->discard_pile.cards[reusable];
+        for (int i = 0; i < reusable; i++) {
+            // wilds were recoloured when played, turn them back to black
+            char text[sizeof(active_game->discard_pile.cards[i].original_text)];
+            memcpy(text, active_game->discard_pile.cards[i].original_text, sizeof(text));
+            get_card_details(text, &active_game->discard_pile.cards[i]);
+        }
+        shuffle_deck(active_game->discard_pile.cards, reusable);
+        CardDetails* temp = active_game->deck_stack.cards;
+        active_game->deck_stack.cards = active_game->discard_pile.cards;
+        active_game->discard_pile.cards = temp;
+        active_game->deck_stack.stack_top_index = reusable - 1;
+        active_game->discard_pile.stack_top_index = 0; // reset discard pile to only have the last played card
+        active_game->discard_pile.cards[0] = last_played_card;
     }
-    CardDetails* drawn_card = &game_details.deck_stack.cards[
-        game_details.deck_stack.card_indices_queue[game_details.deck_stack.stack_top_index]
+    CardDetails* drawn_card = &active_game->deck_stack.cards[
+        active_game->deck_stack.card_indices_queue[active_game->deck_stack.stack_top_index]
         ];
-    game_details.deck_stack.stack_top_index--;
+    active_game->deck_stack.stack_top_index--;
     return drawn_card;
 }
 
 // enqueue card back to deck from hand
 void discard_card_to_pile(CardDetails* card) {
     // discard pile will not be full as someone must've won before that happens, so no need to check for overflow
-    game_details.discard_pile.stack_top_index++;
-    game_details.discard_pile.cards[game_details.discard_pile.stack_top_index] = *card;
+    active_game->discard_pile.stack_top_index++;
+    active_game->discard_pile.cards[active_game->discard_pile.stack_top_index] = *card;
 
 }
 
@@ -94,47 +119,51 @@ void createDeck() {
         cards[i].discarded = 0;
     }
     shuffle_deck(cards, DECK_SIZE);
-    game_details.deck_stack.size = DECK_SIZE;
-    game_details.deck_stack.cards = cards;
-    game_details.deck_stack.stack_top_index = DECK_SIZE - 1;
-    game_details.deck_stack.card_indices_queue = malloc(DECK_SIZE * sizeof(int));
+    active_game->deck_stack.size = DECK_SIZE;
+    active_game->deck_stack.cards = cards;
+    active_game->deck_stack.stack_top_index = DECK_SIZE - 1;
+    active_game->deck_stack.card_indices_queue = malloc(DECK_SIZE * sizeof(int));
     for (int i = 0; i < DECK_SIZE; i++) {
-        game_details.deck_stack.card_indices_queue[i] = i;
+        active_game->deck_stack.card_indices_queue[i] = i;
     }
     for (int i = 0; i < 4; i++) {
-        game_details.hands[i].cards = malloc(sizeof(CardDetails) * 7); // starting hand size
-        game_details.hands[i].card_count = 0;
+        active_game->hands[i].cards = malloc(sizeof(CardDetails) * 7); // starting hand size
+        active_game->hands[i].card_count = 0;
     }
-    game_details.discard_pile.cards = calloc(DECK_SIZE, sizeof(CardDetails));
-    game_details.discard_pile.stack_top_index = -1;
+    active_game->discard_pile.cards = calloc(DECK_SIZE, sizeof(CardDetails));
+    active_game->discard_pile.stack_top_index = -1;
 
 }
 
 int cleanup() {
-    free(game_details.deck_stack.cards);
+    free(active_game->deck_stack.cards);
+    free(active_game->deck_stack.card_indices_queue);
+    free(active_game->discard_pile.cards);
     for (int i = 0; i < 4; i++) {
-        free(game_details.hands[i].cards);
+        free(active_game->hands[i].cards);
     }
+    memset(active_game, 0, sizeof(*active_game));
     return 0;
 }
 
-// Returns 1 if card can be played, 0 otherwise
-int can_play_card(int player_num, int card_index) {
-    if (player_num >= 4 || card_index >= game_details.hands[player_num].card_count) return 0; // invalid
-
-    CardDetails* played_card = &game_details.hands[player_num].cards[card_index];
-    CardDetails* top_discard = get_top_discard();
-
+// Returns 1 if card may go on top, 0 otherwise
+int card_playable(const CardDetails* card, const CardDetails* top) {
     // Wild cards can always be played
-    if (strcmp(played_card->color_str, "black") == 0) return 1;
+    if (strcmp(card->color_str, "black") == 0) return 1;
 
     // Matching color or matching value
-    if (strcmp(played_card->color_str, top_discard->color_str) == 0 ||
-        strcmp(played_card->value_str, top_discard->value_str) == 0) {
-        return 1;
-    }
+    return strcmp(card->color_str, top->color_str) == 0 ||
+           strcmp(card->value_str, top->value_str) == 0;
+}
 
-    return 0;
+// Returns 1 if card can be played, 0 otherwise
+int can_play_card(int player_num, int card_index) {
+    if (player_num >= 4 || card_index >= active_game->hands[player_num].card_count) return 0; // invalid
+
+    CardDetails* top = get_top_discard();
+    if (top == NULL) return 0; // nothing to match against yet
+
+    return card_playable(&active_game->hands[player_num].cards[card_index], top);
 }
 
 // Returns an int representing the card effect:
@@ -147,27 +176,28 @@ int can_play_card(int player_num, int card_index) {
 int play_card(int player_num, int card_index) {
     if (!can_play_card(player_num, card_index)) return -1; // Cannot play card
 
-    CardDetails* played_card = &game_details.hands[player_num].cards[card_index];
-    discard_card_to_pile(played_card);
+    discard_card_to_pile(&active_game->hands[player_num].cards[card_index]);
     remove_from_hand(player_num, card_index);
+    // the hand may have been reallocated, read the copy on the pile
+    CardDetails* played_card = get_top_discard();
 
     if (strcmp(played_card->value_str, "Skip") == 0) {
-        game_details.current_player = (game_details.current_player + game_details.direction + 4) % 4; // Skip next player
+        active_game->current_player = (active_game->current_player + active_game->direction + 4) % 4; // Skip next player
         return 1;
     } else if (strcmp(played_card->value_str, "Reverse") == 0) {
-        game_details.direction *= -1; // Toggle direction
+        active_game->direction *= -1; // Toggle direction
         return 2;
     } else if (strcmp(played_card->value_str, "Draw2") == 0) {
-        pickup_card((game_details.current_player + game_details.direction + 4) % 4);
-        pickup_card((game_details.current_player + game_details.direction + 4) % 4);
+        pickup_card((active_game->current_player + active_game->direction + 4) % 4);
+        pickup_card((active_game->current_player + active_game->direction + 4) % 4);
         return 3;
     } else if (strcmp(played_card->value_str, "wild") == 0) {
         return 4;
     } else if (strcmp(played_card->value_str, "4") == 0 && strcmp(played_card->color_str, "black") == 0) { // Wild Draw 4
-        pickup_card((game_details.current_player + game_details.direction + 4) % 4);
-        pickup_card((game_details.current_player + game_details.direction + 4) % 4);
-        pickup_card((game_details.current_player + game_details.direction + 4) % 4);
-        pickup_card((game_details.current_player + game_details.direction + 4) % 4);
+        pickup_card((active_game->current_player + active_game->direction + 4) % 4);
+        pickup_card((active_game->current_player + active_game->direction + 4) % 4);
+        pickup_card((active_game->current_player + active_game->direction + 4) % 4);
+        pickup_card((active_game->current_player + active_game->direction + 4) % 4);
         return 5;
     } else {
         return 0; // Normal card
@@ -175,45 +205,46 @@ int play_card(int player_num, int card_index) {
 }
 
 void next_player() {
-    game_details.current_player = (game_details.current_player + game_details.direction + 4) % 4;
+    active_game->current_player = (active_game->current_player + active_game->direction + 4) % 4;
 }
 
 
 CardDetails* pickup_card(int player_num) {
     if (player_num >= 4) return NULL; // invalid
     CardDetails* card = draw_card_from_deck();
+    if (card == NULL) return NULL; // nothing left to draw
     add_to_hand(player_num, card);
 
-    return &game_details.hands[player_num].cards[game_details.hands[player_num].card_count - 1];
+    return &active_game->hands[player_num].cards[active_game->hands[player_num].card_count - 1];
 }
 
 void init_game() {
     createDeck();
-    game_details.discard_pile.stack_top_index = 0;
-    game_details.discard_pile.cards[0] = *draw_card_from_deck(); // draw first card to start discard pile
+    active_game->discard_pile.stack_top_index = 0;
+    active_game->discard_pile.cards[0] = *draw_card_from_deck(); // draw first card to start discard pile
     for (int i = 0; i < 7; i++) {
         for (int j = 0; j < 4; j++) {
             CardDetails* card = draw_card_from_deck();
             add_to_hand(j, card);
         }
     }
-    game_details.current_player = 0; // Start with player 0
-    game_details.direction = 1; // Clockwise
+    active_game->current_player = 0; // Start with player 0
+    active_game->direction = 1; // Clockwise
     return;
 
 }
 
 int get_deck_size() {
-    return game_details.deck_stack.stack_top_index + 1;
+    return active_game->deck_stack.stack_top_index + 1;
 }
 
 int get_current_player() {
-    return game_details.current_player;
+    return active_game->current_player;
 }
 
 CardDetails* get_top_discard() {
-    if (game_details.discard_pile.stack_top_index < 0) return NULL;
-    return &game_details.discard_pile.cards[game_details.discard_pile.stack_top_index];
+    if (active_game->discard_pile.stack_top_index < 0) return NULL;
+    return &active_game->discard_pile.cards[active_game->discard_pile.stack_top_index];
 }
 
 void change_color(uint8_t color_code) {
@@ -277,5 +308,5 @@ int bot_play(int player_num) {
 
 
 int get_direction() {
-    return game_details.direction;
+    return active_game->direction;
 }
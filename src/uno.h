@@ -2,6 +2,7 @@
 #ifndef UNO_H
 #define UNO_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #define DECK_SIZE 108
@@ -44,6 +45,11 @@ struct GameDetails {
 
 int get_direction();
 
+// every function below acts on the active game, NULL selects the default one
+void set_active_game(struct GameDetails* game);
+
+struct GameDetails* get_active_game();
+
 void get_card_details(const char* card_text, CardDetails* details);
 
 void shuffle_deck(CardDetails* cards, int count);
@@ -58,9 +64,11 @@ int cleanup();
 
 int play_card(int player_num, int card_index); // Changed return type to int
 int can_play_card(int player_num, int card_index); // Added for validation
+int card_playable(const CardDetails* card, const CardDetails* top); // the matching rule alone, for any copy of a hand and pile
 void next_player(); // Added to advance player considering direction
 
 CardDetails* pickup_card(int player_num);
+CardDetails* draw_card_from_deck(); // reshuffles the discard pile when the deck runs out
 
 void init_game();
 
@@ -0,0 +1,284 @@
+#include "vterm.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum VTermState {
+  VTERM_GROUND,
+  VTERM_ESCAPE, // seen ESC
+  VTERM_CSI,    // seen ESC [, collecting parameters
+};
+
+static const struct Cell blank = {{' '}, 1, COLOR_DEFAULT};
+
+int vterm_init(struct VTerm *vt, int rows, int cols) {
+  memset(vt, 0, sizeof(*vt));
+  vt->cells = malloc(sizeof(struct Cell) * rows * cols);
+  if (vt->cells == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < rows * cols; i++) {
+    vt->cells[i] = blank;
+  }
+  vt->rows = rows;
+  vt->cols = cols;
+  vt->fg = COLOR_DEFAULT;
+  vt->cursor_visible = 1;
+  vt->state = VTERM_GROUND;
+  return 0;
+}
+
+void vterm_free(struct VTerm *vt) {
+  free(vt->cells);
+  free(vt->pending.data);
+  vt->cells = NULL;
+  memset(&vt->pending, 0, sizeof(vt->pending));
+}
+
+void vterm_write(struct VTerm *vt, const void *bytes, size_t len) {
+  frame_buf_append(&vt->pending, bytes, len);
+  vt->bytes += len;
+}
+
+static int continuation_bytes(unsigned char lead) {
+  if (lead < 0x80) {
+    return 0;
+  }
+  if (lead >= 0xF0) {
+    return 3;
+  }
+  if (lead >= 0xE0) {
+    return 2;
+  }
+  return 1;
+}
+
+static void clear_cells(struct VTerm *vt, int from, int to) {
+  for (int i = from; i < to; i++) {
+    vt->cells[i] = blank;
+  }
+}
+
+static void line_feed(struct VTerm *vt) {
+  if (vt->y < vt->rows - 1) {
+    vt->y++;
+    return;
+  }
+  // scroll the screen up a line
+  memmove(vt->cells, vt->cells + vt->cols,
+          sizeof(struct Cell) * (vt->rows - 1) * vt->cols);
+  clear_cells(vt, (vt->rows - 1) * vt->cols, vt->rows * vt->cols);
+}
+
+static void put_glyph(struct VTerm *vt) {
+  if (vt->wrap_pending) {
+    vt->wrap_pending = 0;
+    vt->x = 0;
+    line_feed(vt);
+  }
+  struct Cell *cell = &vt->cells[vt->y * vt->cols + vt->x];
+  memcpy(cell->glyph, vt->glyph, vt->glyph_len);
+  cell->len = vt->glyph_len;
+  cell->fg = vt->fg;
+  if (vt->x < vt->cols - 1) {
+    vt->x++;
+  } else {
+    vt->wrap_pending = 1;
+  }
+}
+
+static int param(const struct VTerm *vt, int index, int fallback) {
+  if (index >= vt->param_count || vt->params[index] == 0) {
+    return fallback;
+  }
+  return vt->params[index];
+}
+
+static int clamp(int value, int low, int high) {
+  return value < low ? low : value > high ? high : value;
+}
+
+static void select_graphic_rendition(struct VTerm *vt) {
+  if (vt->param_count == 0) {
+    vt->fg = COLOR_DEFAULT;
+    return;
+  }
+  for (int i = 0; i < vt->param_count; i++) {
+    int p = vt->params[i];
+    if (p == 0 || p == 39) {
+      vt->fg = COLOR_DEFAULT;
+    } else if (p == 38 && i + 2 < vt->param_count && vt->params[i + 1] == 5) {
+      vt->fg = vt->params[i + 2];
+      i += 2;
+    } else if (p >= 30 && p <= 37) {
+      vt->fg = p - 30;
+    } else if (p >= 90 && p <= 97) {
+      vt->fg = p - 90 + 8;
+    } else {
+      vt->unknown++;
+    }
+  }
+}
+
+static void set_private_mode(struct VTerm *vt, int on) {
+  switch (param(vt, 0, 0)) {
+  case 25:
+    vt->cursor_visible = on;
+    break;
+  case 2026:
+    vt->synchronized = on;
+    break;
+  default:
+    vt->unknown++;
+  }
+}
+
+static void control_sequence(struct VTerm *vt, unsigned char final) {
+  int cursor = vt->y * vt->cols + vt->x;
+  vt->wrap_pending = 0;
+
+  if (vt->private_mode) {
+    if (final == 'h' || final == 'l') {
+      set_private_mode(vt, final == 'h');
+    } else {
+      vt->unknown++;
+    }
+    return;
+  }
+
+  switch (final) {
+  case 'H':
+  case 'f':
+    vt->y = clamp(param(vt, 0, 1) - 1, 0, vt->rows - 1);
+    vt->x = clamp(param(vt, 1, 1) - 1, 0, vt->cols - 1);
+    break;
+  case 'A':
+    vt->y = clamp(vt->y - param(vt, 0, 1), 0, vt->rows - 1);
+    break;
+  case 'B':
+    vt->y = clamp(vt->y + param(vt, 0, 1), 0, vt->rows - 1);
+    break;
+  case 'C':
+    vt->x = clamp(vt->x + param(vt, 0, 1), 0, vt->cols - 1);
+    break;
+  case 'D':
+    vt->x = clamp(vt->x - param(vt, 0, 1), 0, vt->cols - 1);
+    break;
+  case 'J':
+    if (param(vt, 0, 0) == 2) {
+      clear_cells(vt, 0, vt->rows * vt->cols);
+    } else if (param(vt, 0, 0) == 1) {
+      clear_cells(vt, 0, cursor + 1);
+    } else {
+      clear_cells(vt, cursor, vt->rows * vt->cols);
+    }
+    break;
+  case 'K': {
+    int line = vt->y * vt->cols;
+    if (param(vt, 0, 0) == 2) {
+      clear_cells(vt, line, line + vt->cols);
+    } else if (param(vt, 0, 0) == 1) {
+      clear_cells(vt, line, cursor + 1);
+    } else {
+      clear_cells(vt, cursor, line + vt->cols);
+    }
+    break;
+  }
+  case 'm':
+    select_graphic_rendition(vt);
+    break;
+  default:
+    vt->unknown++;
+  }
+}
+
+static void feed_byte(struct VTerm *vt, unsigned char byte) {
+  switch (vt->state) {
+  case VTERM_GROUND:
+    if (vt->glyph_need > 0) {
+      vt->glyph[vt->glyph_len++] = byte;
+      if (--vt->glyph_need == 0) {
+        put_glyph(vt);
+      }
+      return;
+    }
+    if (byte == 27) {
+      vt->state = VTERM_ESCAPE;
+    } else if (byte == '\r') {
+      vt->x = 0;
+      vt->wrap_pending = 0;
+    } else if (byte == '\n') {
+      line_feed(vt);
+    } else if (byte == '\b') {
+      vt->x = vt->x > 0 ? vt->x - 1 : 0;
+      vt->wrap_pending = 0;
+    } else if (byte >= 0x20) {
+      vt->glyph[0] = byte;
+      vt->glyph_len = 1;
+      vt->glyph_need = continuation_bytes(byte);
+      if (vt->glyph_need == 0) {
+        put_glyph(vt);
+      }
+    }
+    break;
+
+  case VTERM_ESCAPE:
+    if (byte == '[') {
+      vt->state = VTERM_CSI;
+      vt->private_mode = 0;
+      vt->param_count = 0;
+      memset(vt->params, 0, sizeof(vt->params));
+    } else {
+      vt->unknown++;
+      vt->state = VTERM_GROUND;
+    }
+    break;
+
+  case VTERM_CSI:
+    if (byte == '?') {
+      vt->private_mode = 1;
+    } else if (byte >= '0' && byte <= '9') {
+      if (vt->param_count == 0) {
+        vt->param_count = 1;
+      }
+      if (vt->param_count <= VTERM_MAX_PARAMS) {
+        int *p = &vt->params[vt->param_count - 1];
+        *p = *p * 10 + (byte - '0');
+      }
+    } else if (byte == ';') {
+      if (vt->param_count == 0) {
+        vt->param_count = 1; // an empty first parameter
+      }
+      vt->param_count++;
+    } else if (byte >= 0x40 && byte <= 0x7e) {
+      if (vt->param_count > VTERM_MAX_PARAMS) {
+        vt->param_count = VTERM_MAX_PARAMS;
+      }
+      control_sequence(vt, byte);
+      vt->state = VTERM_GROUND;
+    }
+    break;
+  }
+}
+
+void vterm_update(struct VTerm *vt) {
+  const unsigned char *p = (const unsigned char *)vt->pending.data;
+  for (size_t i = 0; i < vt->pending.len; i++) {
+    feed_byte(vt, p[i]);
+  }
+  vt->pending.len = 0;
+}
+
+void vterm_dump(struct VTerm *vt, FILE *out) {
+  vterm_update(vt);
+  for (int y = 0; y < vt->rows; y++) {
+    const struct Cell *row = &vt->cells[y * vt->cols];
+    int end = vt->cols;
+    while (end > 0 && row[end - 1].len == 1 && row[end - 1].glyph[0] == ' ') {
+      end--;
+    }
+    for (int x = 0; x < end; x++) {
+      fwrite(row[x].glyph, 1, row[x].len, out);
+    }
+    fputc('\n', out);
+  }
+}
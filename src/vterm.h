@@ -0,0 +1,57 @@
+#ifndef UNO_VTERM_H
+#define UNO_VTERM_H
+
+#include "render.h"
+#include <stdio.h>
+
+// In-memory terminal for running the renderer without a tty. It
+// understands what the client emits: UTF-8 text, cursor moves, erases,
+// 256-colour foregrounds and the private modes it toggles; anything else
+// is counted and skipped. A screen with its vterm field set presents into
+// one of these instead of writing to a file descriptor.
+
+#define VTERM_MAX_PARAMS 8
+
+struct VTerm {
+  int rows;
+  int cols;
+  struct Cell *cells; // rows * cols, what the terminal shows
+  int x;              // cursor, 0-based
+  int y;
+  int wrap_pending; // printed in the last column, next glyph wraps
+  short fg;
+  int cursor_visible;
+  int synchronized; // between ?2026h and ?2026l
+
+  // bytes written but not interpreted yet, see vterm_write
+  struct FrameBuf pending;
+
+  // escape sequence parser
+  int state;
+  int private_mode; // the sequence started with '?'
+  int params[VTERM_MAX_PARAMS];
+  int param_count;
+  char glyph[4]; // UTF-8 code point being assembled
+  int glyph_len;
+  int glyph_need;
+
+  unsigned long long bytes;   // written in total
+  unsigned long long unknown; // sequences it could not interpret
+};
+
+int vterm_init(struct VTerm *vt, int rows, int cols);
+
+void vterm_free(struct VTerm *vt);
+
+// takes the output of one frame. The bytes are only queued, so timing the
+// code that renders into the vterm does not also time the emulation
+void vterm_write(struct VTerm *vt, const void *bytes, size_t len);
+
+// interprets everything queued so far
+void vterm_update(struct VTerm *vt);
+
+// the screen as text, one line per row with trailing blanks trimmed and
+// colours left out, for snapshot comparison
+void vterm_dump(struct VTerm *vt, FILE *out);
+
+#endif // UNO_VTERM_H